@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Clock.h"
+
+/// @brief Clock backed by the SysTick based timers of the Arduino core.
+class ArduinoClock : public Clock {
+    public:
+        uint32_t Millis() override
+        {
+            return millis();
+        }
+
+        uint32_t Micros() override
+        {
+            return micros();
+        }
+
+        void Idle() override
+        {
+            // Nothing else runs on the bootloader, keep polling
+        }
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Platform.h"
+
+/// @brief The time source of the protocol code, `millis` and `micros` on the target, a virtual clock on the host.
+class Clock {
+    public:
+        virtual uint32_t Millis() = 0;
+
+        virtual uint32_t Micros() = 0;
+
+        /// @brief  Called by wait loops that found nothing to do. The target just keeps spinning, a simulated clock
+        ///         uses it to move time forward to the next event.
+        virtual void Idle() = 0;
+};
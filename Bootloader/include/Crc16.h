@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Platform.h"
+
+/// @brief  Lookup tables for the CRC16 slicing-by-4 kernel. `Slice[0]` is the classic byte table,
+///         `Slice[n]` is the checksum of a byte followed by `n` zero bytes.
+struct Crc16Tables {
+    uint16_t Slice[4][256];
+
+    /// @brief Builds the lookup tables, evaluated by the compiler so they live in flash.
+    /// @param polynomial The generator polynomial.
+    static constexpr Crc16Tables Build(uint16_t polynomial)
+    {
+        Crc16Tables tables = {};
+
+        for (uint16_t i = 0; i < 256; i++)
+        {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (uint8_t bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ polynomial) : (uint16_t)(crc << 1);
+            }
+
+            tables.Slice[0][i] = crc;
+        }
+
+        for (uint8_t slice = 1; slice < 4; slice++)
+        {
+            for (uint16_t i = 0; i < 256; i++)
+            {
+                uint16_t previous = tables.Slice[slice - 1][i];
+                tables.Slice[slice][i] = (uint16_t)((previous << 8) ^ tables.Slice[0][previous >> 8]);
+            }
+        }
+
+        return tables;
+    }
+};
+
+/// @brief  CRC16-CCITT as used by YModem (polynomial 0x1021, initial value 0, no reflection, no final XOR).
+///         Produces the same checksum as `Crc16Ccitt` in the uploader created with `InitialCrcValue.Zeros`.
+class Crc16 {
+    public:
+        static const uint16_t Polynomial = 0x1021;
+
+        static constexpr Crc16Tables Tables = Crc16Tables::Build(Polynomial);
+
+        /// @brief Reference implementation, processes the data one bit at a time.
+        /// @param data The data to checksum.
+        /// @param length The length of the data in bytes.
+        /// @param crc The checksum of the preceding data, 0 when starting a new checksum.
+        /// @return The checksum.
+        static uint16_t ComputeBitwise(const uint8_t* data, uint32_t length, uint16_t crc = 0)
+        {
+            for (uint32_t i = 0; i < length; i++)
+            {
+                crc ^= (uint16_t)(data[i] << 8);
+                for (uint8_t bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ Polynomial) : (uint16_t)(crc << 1);
+                }
+            }
+
+            return crc;
+        }
+
+        /// @brief Processes the data one byte at a time using a single lookup table.
+        /// @param data The data to checksum.
+        /// @param length The length of the data in bytes.
+        /// @param crc The checksum of the preceding data, 0 when starting a new checksum.
+        /// @return The checksum.
+        static uint16_t ComputeTable(const uint8_t* data, uint32_t length, uint16_t crc = 0)
+        {
+            for (uint32_t i = 0; i < length; i++)
+            {
+                crc = (uint16_t)((crc << 8) ^ Tables.Slice[0][(crc >> 8) ^ data[i]]);
+            }
+
+            return crc;
+        }
+
+        /// @brief  Processes the data four bytes at a time (slicing-by-4). The two bytes overlapping the
+        ///         current checksum and the two following bytes are looked up independently and combined.
+        /// @param data The data to checksum.
+        /// @param length The length of the data in bytes.
+        /// @param crc The checksum of the preceding data, 0 when starting a new checksum.
+        /// @return The checksum.
+        static uint16_t ComputeSliced(const uint8_t* data, uint32_t length, uint16_t crc = 0)
+        {
+            while (length >= 4)
+            {
+                crc = Tables.Slice[3][data[0] ^ (crc >> 8)]
+                    ^ Tables.Slice[2][data[1] ^ (crc & 0xff)]
+                    ^ Tables.Slice[1][data[2]]
+                    ^ Tables.Slice[0][data[3]];
+
+                data += 4;
+                length -= 4;
+            }
+
+            return ComputeTable(data, length, crc);
+        }
+
+        /// @brief Computes the checksum with the fastest available kernel.
+        /// @param data The data to checksum.
+        /// @param length The length of the data in bytes.
+        /// @param crc The checksum of the preceding data, 0 when starting a new checksum.
+        /// @return The checksum.
+        static uint16_t Compute(const uint8_t* data, uint32_t length, uint16_t crc = 0)
+        {
+            return ComputeSliced(data, length, crc);
+        }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Platform.h"
+
+/// @brief Lookup table for the CRC32 byte kernel.
+struct Crc32Table {
+    uint32_t Entries[256];
+
+    /// @brief Builds the lookup table, evaluated by the compiler so it lives in flash.
+    /// @param polynomial The generator polynomial.
+    static constexpr Crc32Table Build(uint32_t polynomial)
+    {
+        Crc32Table table = {};
+
+        for (uint16_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = (uint32_t)i << 24;
+            for (uint8_t bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x80000000) ? ((crc << 1) ^ polynomial) : (crc << 1);
+            }
+
+            table.Entries[i] = crc;
+        }
+
+        return table;
+    }
+};
+
+/// @brief  CRC-32/MPEG-2 (polynomial 0x04C11DB7, initial value 0xFFFFFFFF, no reflection, no final XOR) over 32-bit
+///         words, the way the STM32 CRC unit computes it: each word is processed most significant byte first.
+///         Data is read from memory as little-endian words, a trailing partial word is padded with 0xFF.
+class Crc32 {
+    public:
+        static const uint32_t Polynomial = 0x04C11DB7;
+        static const uint32_t InitialValue = 0xFFFFFFFF;
+
+        static constexpr Crc32Table Table = Crc32Table::Build(Polynomial);
+
+        /// @brief Adds a single word to the checksum.
+        /// @param crc The checksum of the preceding words.
+        /// @param word The word to add.
+        /// @return The checksum.
+        static uint32_t UpdateWord(uint32_t crc, uint32_t word)
+        {
+            for (uint8_t i = 0; i < 4; i++)
+            {
+                crc = (crc << 8) ^ Table.Entries[(crc >> 24) ^ (word >> 24)];
+                word <<= 8;
+            }
+
+            return crc;
+        }
+
+        /// @brief Adds a block of data to the checksum.
+        /// @param crc The checksum of the preceding data, `InitialValue` when starting a new checksum.
+        /// @param data The data to add.
+        /// @param length The length of the data in bytes. Only the last block of a checksum may have a partial word.
+        /// @return The checksum.
+        static uint32_t Update(uint32_t crc, const uint8_t* data, uint32_t length)
+        {
+            while (length >= 4)
+            {
+                uint32_t word;
+                memcpy(&word, data, sizeof(word));
+                crc = UpdateWord(crc, word);
+
+                data += 4;
+                length -= 4;
+            }
+
+            if (length > 0)
+            {
+                uint32_t word = 0xFFFFFFFF;
+                memcpy(&word, data, length);
+                crc = UpdateWord(crc, word);
+            }
+
+            return crc;
+        }
+};
+
+/// @brief  A `Crc32` accumulated block by block, e.g. over an image while it is being received. Runs on the STM32 CRC
+///         unit on the target, one word per write, and on the table everywhere else. The unit holds a single
+///         checksum, so only one instance may be running at a time.
+class RunningCrc32 {
+    private:
+#if !defined(ARDUINO)
+        uint32_t crc = Crc32::InitialValue;
+#endif
+
+    public:
+        /// @brief Starts a new checksum.
+        void Begin()
+        {
+#if defined(ARDUINO)
+            RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+            CRC->CR = CRC_CR_RESET;
+#else
+            crc = Crc32::InitialValue;
+#endif
+        }
+
+        /// @brief Adds a single word.
+        void AddWord(uint32_t word)
+        {
+#if defined(ARDUINO)
+            CRC->DR = word;
+#else
+            crc = Crc32::UpdateWord(crc, word);
+#endif
+        }
+
+        /// @brief Adds a block of data, only the last block of a checksum may have a partial word.
+        void Add(const uint8_t* data, uint32_t length)
+        {
+#if defined(ARDUINO)
+            for (; length >= 4; data += 4, length -= 4)
+            {
+                uint32_t word;
+                memcpy(&word, data, sizeof(word));
+                CRC->DR = word;
+            }
+
+            if (length > 0)
+            {
+                uint32_t word = 0xFFFFFFFF;
+                memcpy(&word, data, length);
+                CRC->DR = word;
+            }
+#else
+            crc = Crc32::Update(crc, data, length);
+#endif
+        }
+
+        /// @return The checksum of everything added since `Begin`.
+        uint32_t Value() const
+        {
+#if defined(ARDUINO)
+            return CRC->DR;
+#else
+            return crc;
+#endif
+        }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Platform.h"
+
+enum struct FlashStatus : uint8_t {
+    /// @brief The last operation has completed, the flash accepts a new one.
+    Ready,
+
+    /// @brief An operation is still in progress.
+    Busy,
+
+    /// @brief The last operation failed (programming sequence, alignment or write protection error).
+    Error,
+};
+
+/// @brief  Low level access to the flash memory. Operations are only started by the `Begin...` calls,
+///         their completion has to be polled with `GetStatus`, so the caller can keep working meanwhile.
+class FlashBackend {
+    public:
+        /// @brief Allows program operations.
+        virtual void Unlock() = 0;
+
+        /// @brief Disallows program operations.
+        virtual void Lock() = 0;
+
+        /// @brief Queries the state of the last started operation.
+        virtual FlashStatus GetStatus() = 0;
+
+        /// @brief Clears the error reported by `GetStatus`.
+        virtual void ClearError() = 0;
+
+        /// @brief Starts programming a single 32-bit word.
+        /// @param address The absolute, word aligned address to program.
+        /// @param word The value to program.
+        virtual void BeginProgramWord(uint32_t address, uint32_t word) = 0;
+
+        /// @brief  Programs consecutive words back to back, as many as the backend takes in one go. All but the last
+        ///         one are waited for, the last one is left running like with `BeginProgramWord`.
+        /// @param address The absolute, word aligned address of the first word.
+        /// @param data The words, in memory order. Need not be aligned.
+        /// @param count The amount of words, at least 1.
+        /// @return The amount of words started, less than `count` if the backend stopped early or an operation
+        ///         failed, see `GetStatus`.
+        virtual uint16_t ProgramWords(uint32_t address, const uint8_t* data, uint16_t count) = 0;
+
+        /// @brief Starts erasing a whole sector, setting all of its bytes to 0xFF.
+        /// @param sector The index of the sector, see `Hardware::SectorOffsets`.
+        virtual void BeginEraseSector(uint8_t sector) = 0;
+
+        /// @brief Reads a single 32-bit word.
+        /// @param address The absolute, word aligned address to read.
+        virtual uint32_t ReadWord(uint32_t address) = 0;
+
+        /// @brief Looks for data in a range, the flash has to be idle.
+        /// @param address The absolute, word aligned address to start at.
+        /// @param end The absolute, word aligned end of the range.
+        /// @return The address of the first word that is not 0xFFFFFFFF, `end` if the range is blank.
+        virtual uint32_t BlankCheck(uint32_t address, uint32_t end) = 0;
+};
@@ -0,0 +1,818 @@
+#pragma once
+
+#include "Platform.h"
+#include "FlashBackend.h"
+#include "Hardware.h"
+#include "Crc32.h"
+#include "Profiler.h"
+
+enum struct FlashWriterResult : uint8_t {
+    /// @brief Everything submitted so far is either programmed or still in progress.
+    Ok,
+
+    /// @brief The flash reported an error, the writer does not accept data anymore.
+    Failed,
+
+    /// @brief Everything has been programmed, but a sector did not read back as programmed, see `GetMismatchAddress`.
+    Mismatch,
+};
+
+struct FlashWriterStats {
+    /// @brief The amount of sectors that held data and were erased.
+    uint8_t SectorsErased;
+
+    /// @brief The amount of sectors that passed the blank check and did not need erasing.
+    uint8_t SectorsSkipped;
+
+    /// @brief The amount of sectors whose contents already matched the image, neither erased nor programmed.
+    uint8_t SectorsUnchanged;
+
+    /// @brief The amount of sectors read back after programming.
+    uint8_t SectorsVerified;
+
+    /// @brief The amount of sectors that did not read back as programmed.
+    uint8_t SectorsMismatched;
+
+    /// @brief The amount of words that matched the flash and were not programmed.
+    uint32_t WordsUnchanged;
+
+    /// @brief The amount of words of the erased value, which were not programmed into the erased flash.
+    uint32_t WordsErased;
+
+    /// @brief The typical erase and program time avoided by the unchanged sectors, in milliseconds.
+    uint32_t MillisSaved;
+
+    /// @brief Adds the statistics of another file, for the totals of a session.
+    void Add(const FlashWriterStats& other)
+    {
+        SectorsErased += other.SectorsErased;
+        SectorsSkipped += other.SectorsSkipped;
+        SectorsUnchanged += other.SectorsUnchanged;
+        SectorsVerified += other.SectorsVerified;
+        SectorsMismatched += other.SectorsMismatched;
+        WordsUnchanged += other.WordsUnchanged;
+        WordsErased += other.WordsErased;
+        MillisSaved += other.MillisSaved;
+    }
+};
+
+/// @brief  Streams data into the flash through two ping-pong buffers. While one buffer is being programmed word by
+///         word the other one can be filled, so programming a packet overlaps with receiving the next one.
+///         Programming only advances when `Poll` is called, which has to happen whenever the caller is waiting.
+///         Sectors are erased lazily, when the first word is about to be programmed into them, and only if a blank
+///         check finds data in them. With reference digests of the image, sectors already holding the same data are
+///         neither erased nor programmed, the incoming data is only compared with them. Each programmed sector is
+///         read back once it is complete and compared with a checksum of the words programmed into it, while the
+///         writer would otherwise wait for data or, if two sectors are waiting for that already, before the next
+///         one is started. The flash type is a template parameter so calls into a `final` backend are bound at
+///         compile time, the buffer capacity so a build for small packets does not carry 1K buffers.
+template <typename TFlash, uint16_t Capacity>
+class BasicFlashWriter {
+    static_assert(Capacity % 4 == 0, "Buffers hold whole words");
+
+    public:
+        /// @brief The capacity of a single buffer.
+        static const uint16_t BufferSize = Capacity;
+
+        /// @brief The amount of bytes blank checked, digested or compared by a single `Poll`.
+        static const uint16_t BlankCheckChunk = 1024;
+
+        /// @brief  The granularity of the reference digests. It is the smallest sector size, so every sector of the
+        ///         application area covers a whole number of chunks.
+        static const uint32_t DigestChunkSize = 16 * 1024;
+
+        /// @brief The maximum amount of reference digests, enough to cover the whole flash.
+        static const uint8_t MaxDigests = Hardware::FlashSize / DigestChunkSize;
+
+    private:
+        struct Buffer {
+            alignas(4) uint8_t Data[BufferSize];
+            uint32_t Address;
+            uint16_t Length;
+        };
+
+        enum struct SectorPhase : uint8_t {
+            /// @brief Comparing the digests of the flash contents with the reference digests.
+            Digest,
+
+            /// @brief Looking for data in the sector.
+            BlankCheck,
+
+            /// @brief Waiting for the erase to finish.
+            Erase,
+        };
+
+        /// @brief  The words programmed into a sector and their Fletcher checksum: `Low` sums the words, `High` sums
+        ///         `Low` after each word, so swapped or shifted words do not add up to the same.
+        struct ProgrammedRange {
+            uint32_t Start;
+            uint32_t End;
+            uint32_t Low;
+            uint32_t High;
+        };
+
+        TFlash* flash = nullptr;
+        Buffer buffers[2];
+
+        /// @brief The index of the buffer being programmed.
+        uint8_t head = 0;
+
+        /// @brief The amount of buffers waiting for or under programming.
+        uint8_t queued = 0;
+
+        /// @brief The offset of the next word to program within the head buffer.
+        uint16_t programOffset = 0;
+
+        /// @brief  The end of the run of words from `programOffset` on that goes to the flash in bursts, see
+        ///         `FlashBackend::ProgramWords`. It stops at a word of the erased value and at the end of a sector.
+        uint16_t runEnd = 0;
+
+        /// @brief The flash address the next submitted data is written to.
+        uint32_t nextAddress = 0;
+
+        /// @brief The address the session started at, sectors starting below it are never erased.
+        uint32_t startAddress = 0;
+
+        /// @brief One bit per sector that is blank or has been erased during this session.
+        uint32_t preparedSectors = 0;
+
+        /// @brief One bit per sector that already holds the image and is only compared.
+        uint32_t unchangedSectors = 0;
+
+        /// @brief One bit per sector that is never taken as unchanged, see `RequireErase`.
+        uint32_t dirtySectors = 0;
+
+        /// @brief The range the blank check skips, see `PreserveArea`.
+        uint32_t preservedStart = 0;
+        uint32_t preservedEnd = 0;
+
+        /// @brief The sector being checked or erased, -1 if none.
+        int8_t preparingSector = -1;
+
+        SectorPhase phase = SectorPhase::BlankCheck;
+
+        /// @brief The address of the next word to check within `preparingSector`.
+        uint32_t checkAddress = 0;
+
+        /// @brief The digest of the current chunk up to `checkAddress`.
+        uint32_t digest = 0;
+
+        /// @brief The sector being programmed, -1 if none, and what has been programmed into it so far.
+        int8_t programmedSector = -1;
+        ProgrammedRange programmed;
+
+        /// @brief Completed sectors waiting to be read back, oldest first.
+        ProgrammedRange verifyQueue[2];
+        uint8_t verifyHead = 0;
+        uint8_t verifyCount = 0;
+
+        /// @brief The address of the next word to read back and the checksum of the oldest waiting sector up to it.
+        uint32_t verifyAddress = 0;
+        uint32_t verifyLow = 0;
+        uint32_t verifyHigh = 0;
+
+        /// @brief The start of the lowest sector that did not read back as programmed, 0 if none.
+        uint32_t mismatchAddress = 0;
+
+        /// @brief CRC32 of each `DigestChunkSize` chunk of the image, see `SetReference`.
+        uint32_t referenceDigests[MaxDigests];
+        uint8_t referenceCount = 0;
+        uint32_t imageSize = 0;
+
+        bool failed = false;
+
+        /// @brief Whether the last `Poll` had nothing to do, see `IsWaiting`.
+        bool waiting = true;
+
+        /// @brief The checksum of everything queued, see `GetCrc`.
+        RunningCrc32 imageCrc;
+
+        /// @brief Times the running flash operation for the statistics.
+        ProfileOperation operation;
+
+        FlashWriterStats stats = {};
+
+        /// @brief Reads a word of the image from the flash, bytes past the end of the image read as 0xFF.
+        uint32_t ReadImageWord(uint32_t address)
+        {
+            uint32_t word = flash->ReadWord(address);
+            uint32_t remaining = startAddress + imageSize - address;
+
+            if (remaining < 4)
+            {
+                word |= 0xFFFFFFFF << (remaining * 8);
+            }
+
+            return word;
+        }
+
+        /// @brief Whether the reference digests cover every chunk of the image within a sector.
+        bool HasReferenceFor(uint32_t sectorStart, uint32_t sectorEnd)
+        {
+            uint32_t imageEnd = startAddress + imageSize;
+
+            if (referenceCount == 0 || sectorStart < startAddress || sectorStart >= imageEnd)
+            {
+                return false;
+            }
+
+            uint32_t end = sectorEnd < imageEnd ? sectorEnd : imageEnd;
+            return (end - 1 - startAddress) / DigestChunkSize < referenceCount;
+        }
+
+        /// @brief  Makes sure the sector containing an address is ready before the first word is programmed into
+        ///         it. The sector is checked a chunk at a time: first its digests are compared with the reference, if
+        ///         that fails it is blank checked, and only erased if it holds data.
+        /// @param sector The sector about to be programmed.
+        /// @return True if the sector is ready for programming, false while it is still being checked or erased.
+        bool PrepareSector(int8_t sector)
+        {
+            uint32_t sectorBit = 1UL << sector;
+            if (preparedSectors & sectorBit)
+            {
+                return true;
+            }
+
+            uint32_t sectorStart = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector];
+            uint32_t sectorEnd = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector + 1];
+
+            if (preparingSector != sector)
+            {
+                preparingSector = sector;
+                phase = (dirtySectors & sectorBit) == 0 && HasReferenceFor(sectorStart, sectorEnd) ? SectorPhase::Digest : SectorPhase::BlankCheck;
+                checkAddress = sectorStart;
+                digest = Crc32::InitialValue;
+            }
+
+            if (phase == SectorPhase::Erase)
+            {
+                // The flash has reported the end of the erase already
+                preparingSector = -1;
+                preparedSectors |= sectorBit;
+                stats.SectorsErased++;
+                return true;
+            }
+
+            if (phase == SectorPhase::Digest)
+            {
+                uint32_t imageEnd = startAddress + imageSize;
+                uint32_t end = sectorEnd < imageEnd ? sectorEnd : imageEnd;
+                uint32_t chunkEnd = checkAddress + BlankCheckChunk;
+
+                for (; checkAddress < chunkEnd && checkAddress < end; checkAddress += 4)
+                {
+                    digest = Crc32::UpdateWord(digest, ReadImageWord(checkAddress));
+
+                    uint32_t offset = checkAddress + 4 - startAddress;
+                    if (offset % DigestChunkSize == 0 || checkAddress + 4 >= end)
+                    {
+                        if (digest != referenceDigests[(offset - 1) / DigestChunkSize])
+                        {
+                            phase = SectorPhase::BlankCheck;
+                            checkAddress = sectorStart;
+                            return false;
+                        }
+
+                        digest = Crc32::InitialValue;
+                    }
+                }
+
+                if (checkAddress >= end)
+                {
+                    preparingSector = -1;
+                    preparedSectors |= sectorBit;
+                    unchangedSectors |= sectorBit;
+                    stats.SectorsUnchanged++;
+                    return true;
+                }
+
+                return false;
+            }
+
+            uint32_t chunkEnd = checkAddress + BlankCheckChunk;
+            if (chunkEnd > sectorEnd)
+            {
+                chunkEnd = sectorEnd;
+            }
+
+            bool preserve = (dirtySectors & sectorBit) == 0;
+            while (checkAddress < chunkEnd)
+            {
+                if (preserve && checkAddress >= preservedStart && checkAddress < preservedEnd)
+                {
+                    checkAddress = preservedEnd < chunkEnd ? preservedEnd : chunkEnd;
+                    continue;
+                }
+
+                uint32_t end = preserve && checkAddress < preservedStart && preservedStart < chunkEnd ? preservedStart : chunkEnd;
+                checkAddress = flash->BlankCheck(checkAddress, end);
+
+                if (checkAddress < end)
+                {
+                    // Never erase what lies before the start of the session
+                    if (sectorStart < startAddress)
+                    {
+                        failed = true;
+                        return false;
+                    }
+
+                    flash->BeginEraseSector((uint8_t)sector);
+                    operation.Begin(ProfilePhase::Erase);
+                    phase = SectorPhase::Erase;
+                    return false;
+                }
+            }
+
+            if (checkAddress == sectorEnd)
+            {
+                preparingSector = -1;
+                preparedSectors |= sectorBit;
+                stats.SectorsSkipped++;
+                return true;
+            }
+
+            return false;
+        }
+
+        /// @brief  Queues the sector being programmed for reading back.
+        /// @return False if two sectors are waiting already, `VerifyChunk` has to make room first.
+        bool CloseSector()
+        {
+            if (programmedSector < 0)
+            {
+                return true;
+            }
+
+            if (verifyCount == 2)
+            {
+                return false;
+            }
+
+            if (verifyCount == 0)
+            {
+                verifyAddress = programmed.Start;
+                verifyLow = 0;
+                verifyHigh = 0;
+            }
+
+            verifyQueue[(verifyHead + verifyCount) & 1] = programmed;
+            verifyCount++;
+            programmedSector = -1;
+            return true;
+        }
+
+        /// @brief  Reads back the next chunk of the oldest sector waiting, with the flash idle. Once the sector is
+        ///         complete its checksum has to match the one of the words programmed into it.
+        void VerifyChunk()
+        {
+            PROFILE_PHASE(Verify);
+
+            const ProgrammedRange& range = verifyQueue[verifyHead];
+            uint32_t chunkEnd = verifyAddress + BlankCheckChunk;
+            if (chunkEnd > range.End)
+            {
+                chunkEnd = range.End;
+            }
+
+            for (; verifyAddress < chunkEnd; verifyAddress += 4)
+            {
+                verifyLow += flash->ReadWord(verifyAddress);
+                verifyHigh += verifyLow;
+            }
+
+            if (verifyAddress < range.End)
+            {
+                return;
+            }
+
+            stats.SectorsVerified++;
+            if (verifyLow != range.Low || verifyHigh != range.High)
+            {
+                stats.SectorsMismatched++;
+                if (mismatchAddress == 0 || range.Start < mismatchAddress)
+                {
+                    mismatchAddress = range.Start;
+                }
+            }
+
+            verifyHead ^= 1;
+            verifyCount--;
+            verifyAddress = verifyQueue[verifyHead].Start;
+            verifyLow = 0;
+            verifyHigh = 0;
+        }
+
+    public:
+        /// @brief Starts a new write session.
+        /// @param backend The flash to write to.
+        /// @param address The absolute address of the first byte to write.
+        void Begin(TFlash* backend, uint32_t address)
+        {
+            flash = backend;
+            dirtySectors = 0;
+            preservedStart = 0;
+            preservedEnd = 0;
+            stats = {};
+
+            Rewind(address);
+        }
+
+        /// @brief  Starts programming over at a sector start after `Finish` reported a mismatch there, or earlier.
+        ///         What lies before the address stays, the data from there on has to be submitted again. The
+        ///         statistics and what `PreserveArea` and `RequireErase` set carry over, the reference digests do not.
+        /// @param address The absolute address of the first byte to write.
+        void Rewind(uint32_t address)
+        {
+            head = 0;
+            queued = 0;
+            programOffset = 0;
+            runEnd = 0;
+            nextAddress = address;
+            startAddress = address;
+            preparedSectors = 0;
+            unchangedSectors = 0;
+            preparingSector = -1;
+            programmedSector = -1;
+            verifyCount = 0;
+            mismatchAddress = 0;
+            referenceCount = 0;
+            imageSize = 0;
+            failed = false;
+            imageCrc.Begin();
+
+            flash->ClearError();
+            flash->Unlock();
+        }
+
+        /// @brief  Provides the digests of the incoming image, enabling the unchanged sector detection. Must be called
+        ///         right after `Begin`.
+        /// @param digests `Crc32` of each `DigestChunkSize` chunk of the image, the last one may be partial.
+        /// @param count The amount of digests, at most `MaxDigests`.
+        /// @param size The size of the image in bytes.
+        void SetReference(const uint32_t* digests, uint8_t count, uint32_t size)
+        {
+            referenceCount = count <= MaxDigests ? count : MaxDigests;
+            memcpy(referenceDigests, digests, referenceCount * sizeof(uint32_t));
+            imageSize = size;
+        }
+
+        /// @brief  Continues an image whose start is already in flash, from `imageStart` up to the address given to
+        ///         `Begin`: reads that part back into the running checksum, so `GetCrc` covers the whole image. Must be
+        ///         called right after `Begin`, `SetReference` then only covers the part still to be written.
+        /// @return The checksum of the part already in flash.
+        uint32_t Resume(uint32_t imageStart)
+        {
+            for (uint32_t address = imageStart; address < startAddress; address += 4)
+            {
+                imageCrc.AddWord(flash->ReadWord(address));
+            }
+
+            return imageCrc.Value();
+        }
+
+        /// @brief  Lets the blank check skip a range no data is written to, like the descriptor log: records there do
+        ///         not make its sector need an erase. Sectors passed to `RequireErase` are checked completely. Must
+        ///         be called right after `Begin`.
+        void PreserveArea(uint32_t address, uint32_t size)
+        {
+            preservedStart = address;
+            preservedEnd = address + size;
+        }
+
+        /// @brief  Keeps a sector from being left alone as unchanged, it is blank checked and erased if it holds
+        ///         data, like without reference digests. For sectors that hold more than the image, e.g. a full
+        ///         descriptor log. Must be called right after `Begin`.
+        void RequireErase(uint8_t sector)
+        {
+            dirtySectors |= 1UL << sector;
+        }
+
+        /// @brief Whether `Submit` would accept data right now.
+        bool HasFreeBuffer() const
+        {
+            return queued < 2;
+        }
+
+        /// @brief  Whether the last `Poll` found nothing to do until the flash finishes its operation or more data
+        ///         is queued. Otherwise it has more work right away, like the next chunk of a sector check.
+        bool IsWaiting() const
+        {
+            return waiting;
+        }
+
+        /// @brief Whether everything submitted has been programmed, or the writer has failed.
+        bool IsDrained() const
+        {
+            return queued == 0 || failed;
+        }
+
+        /// @brief  The free buffer, for producers that fill it in place instead of copying with `Submit`. Only valid
+        ///         while `HasFreeBuffer` is true, `Commit` queues it.
+        uint8_t* GetFreeBuffer()
+        {
+            return buffers[(head + queued) & 1].Data;
+        }
+
+        /// @brief  Queues the free buffer for programming after it has been filled through `GetFreeBuffer`. The data
+        ///         is written right after the previously queued data.
+        /// @param length The length of the data, at most `BufferSize`. Only the last buffer may be a partial word.
+        /// @return False if there is no free buffer, call `Poll` until `HasFreeBuffer` is true.
+        bool Commit(uint16_t length)
+        {
+            PROFILE_PHASE(Flash);
+
+            if (HasFreeBuffer() == false || failed)
+            {
+                return false;
+            }
+
+            Buffer& buffer = buffers[(head + queued) & 1];
+
+            // Pad the last word with the erased value, so it leaves the following bytes untouched
+            while (length & 3)
+            {
+                buffer.Data[length++] = 0xFF;
+            }
+
+            imageCrc.Add(buffer.Data, length);
+
+            buffer.Address = nextAddress;
+            buffer.Length = length;
+            nextAddress += length;
+            queued++;
+
+            return true;
+        }
+
+        /// @brief  Copies data into the free buffer and queues it for programming. The data is written right after
+        ///         the previously queued data.
+        /// @param data The data to write.
+        /// @param length The length of the data, at most `BufferSize`.
+        /// @return False if there is no free buffer, call `Poll` until `HasFreeBuffer` is true.
+        bool Submit(const uint8_t* data, uint16_t length)
+        {
+            if (HasFreeBuffer() == false || failed)
+            {
+                return false;
+            }
+
+            memcpy(GetFreeBuffer(), data, length);
+            return Commit(length);
+        }
+
+        /// @brief  Advances programming by one burst of words, as many as the flash takes in one go, and only waits for
+        ///         the flash within that burst. Within unchanged sectors a whole chunk is compared instead, a run of
+        ///         words of the erased value is passed over up to a chunk at once. With nothing to program, a chunk of
+        ///         a completed sector is read back.
+        /// @return The state of the writer.
+        FlashWriterResult Poll()
+        {
+            PROFILE_PHASE(Flash);
+
+            waiting = true;
+
+            if (failed)
+            {
+                return FlashWriterResult::Failed;
+            }
+
+            if (queued == 0 && verifyCount == 0)
+            {
+                return FlashWriterResult::Ok;
+            }
+
+            FlashStatus status = flash->GetStatus();
+
+            if (status == FlashStatus::Busy)
+            {
+                return FlashWriterResult::Ok;
+            }
+
+            operation.End();
+            waiting = false;
+
+            if (status == FlashStatus::Error)
+            {
+                failed = true;
+                flash->Lock();
+                return FlashWriterResult::Failed;
+            }
+
+            // Waiting for data leaves the time to read back what has been programmed
+            if (queued == 0)
+            {
+                VerifyChunk();
+                return FlashWriterResult::Ok;
+            }
+
+            Buffer& buffer = buffers[head];
+
+            if (programOffset < buffer.Length)
+            {
+                uint32_t address = buffer.Address + programOffset;
+                int8_t sector = Hardware::SectorOf((int32_t)(address - Hardware::STM32BaseAddress));
+
+                if (sector < 0)
+                {
+                    failed = true;
+                    return FlashWriterResult::Failed;
+                }
+
+                if (PrepareSector(sector) == false)
+                {
+                    return failed ? FlashWriterResult::Failed : FlashWriterResult::Ok;
+                }
+
+                if (unchangedSectors & (1UL << sector))
+                {
+                    // A buffer may run into the next sector, which has its own decision
+                    uint32_t sectorEnd = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector + 1];
+                    uint16_t compareEnd = programOffset + BlankCheckChunk;
+                    if (compareEnd > buffer.Length)
+                    {
+                        compareEnd = buffer.Length;
+                    }
+
+                    for (; programOffset < compareEnd && buffer.Address + programOffset < sectorEnd; programOffset += 4)
+                    {
+                        uint32_t word;
+                        memcpy(&word, &buffer.Data[programOffset], sizeof(word));
+
+                        // The reference digests did not tell the truth, the sector can not be rewritten anymore
+                        if (ReadImageWord(buffer.Address + programOffset) != word)
+                        {
+                            failed = true;
+                            return FlashWriterResult::Failed;
+                        }
+
+                        stats.WordsUnchanged++;
+                    }
+
+                    return FlashWriterResult::Ok;
+                }
+
+                if (sector != programmedSector)
+                {
+                    // The reading back has fallen two sectors behind, it catches up before the next one starts
+                    if (CloseSector() == false)
+                    {
+                        VerifyChunk();
+                        return FlashWriterResult::Ok;
+                    }
+
+                    programmedSector = sector;
+                    programmed = { address, address, 0, 0 };
+                }
+
+                uint32_t word;
+                memcpy(&word, &buffer.Data[programOffset], sizeof(word));
+
+                // The sector is erased or blank, words of the erased value are there already. They are only added
+                // to the checksum of the sector, reading it back checks them as well.
+                if (word == 0xFFFFFFFF)
+                {
+                    uint32_t sectorEnd = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector + 1];
+                    uint16_t skipEnd = programOffset + BlankCheckChunk;
+                    if (skipEnd > buffer.Length)
+                    {
+                        skipEnd = buffer.Length;
+                    }
+
+                    for (; programOffset < skipEnd && buffer.Address + programOffset < sectorEnd; programOffset += 4)
+                    {
+                        memcpy(&word, &buffer.Data[programOffset], sizeof(word));
+                        if (word != 0xFFFFFFFF)
+                        {
+                            break;
+                        }
+
+                        programmed.Low += word;
+                        programmed.High += programmed.Low;
+                        programmed.End = buffer.Address + programOffset + 4;
+                        stats.WordsErased++;
+                    }
+
+                    return FlashWriterResult::Ok;
+                }
+
+                // The run of words to program goes on up to the next one of the erased value, each word is only
+                // looked at once
+                if (runEnd <= programOffset)
+                {
+                    uint32_t sectorEnd = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector + 1];
+                    runEnd = programOffset + 4;
+
+                    while (runEnd < buffer.Length && buffer.Address + runEnd < sectorEnd)
+                    {
+                        memcpy(&word, &buffer.Data[runEnd], sizeof(word));
+                        if (word == 0xFFFFFFFF)
+                        {
+                            break;
+                        }
+
+                        runEnd += 4;
+                    }
+                }
+
+                uint16_t started = flash->ProgramWords(address, &buffer.Data[programOffset], (runEnd - programOffset) / 4);
+                operation.Begin(ProfilePhase::Program);
+
+                for (uint16_t end = programOffset + started * 4; programOffset < end; programOffset += 4)
+                {
+                    memcpy(&word, &buffer.Data[programOffset], sizeof(word));
+                    programmed.Low += word;
+                    programmed.High += programmed.Low;
+                }
+                programmed.End = buffer.Address + programOffset;
+            }
+            else
+            {
+                // The last word of the buffer has finished, hand it back
+                head ^= 1;
+                queued--;
+                programOffset = 0;
+                runEnd = 0;
+            }
+
+            return FlashWriterResult::Ok;
+        }
+
+        /// @brief Programs everything queued, reads back the sectors not verified yet, waits for the flash and locks it.
+        /// @return The state of the writer.
+        FlashWriterResult Finish()
+        {
+            while (queued > 0 && Poll() == FlashWriterResult::Ok)
+            {
+            }
+
+            if (failed)
+            {
+                return FlashWriterResult::Failed;
+            }
+
+            // The last word has finished, the flash can be read right away
+            while (CloseSector() == false)
+            {
+                VerifyChunk();
+            }
+
+            while (verifyCount > 0)
+            {
+                VerifyChunk();
+            }
+
+            stats.MillisSaved = stats.WordsUnchanged * Hardware::WordProgramMicros / 1000;
+            for (uint8_t sector = 0; sector < Hardware::SectorCount; sector++)
+            {
+                if (unchangedSectors & (1UL << sector))
+                {
+                    stats.MillisSaved += Hardware::SectorEraseMillis(sector);
+                }
+            }
+
+            if (flash != nullptr)
+            {
+                flash->Lock();
+            }
+
+            return mismatchAddress != 0 ? FlashWriterResult::Mismatch : FlashWriterResult::Ok;
+        }
+
+        /// @brief  `Crc32` of everything queued since `Begin`, kept up while the data passes through, so the image
+        ///         does not have to be read back for it.
+        uint32_t GetCrc() const
+        {
+            return imageCrc.Value();
+        }
+
+        /// @brief The start of the lowest sector that did not read back as programmed, 0 if all did.
+        uint32_t GetMismatchAddress() const
+        {
+            return mismatchAddress;
+        }
+
+        /// @brief Sector statistics of the current session.
+        const FlashWriterStats& GetStats() const
+        {
+            return stats;
+        }
+
+        /// @brief Drops everything not yet programmed and locks the flash.
+        void Stop()
+        {
+            queued = 0;
+            programOffset = 0;
+            runEnd = 0;
+            preparingSector = -1;
+            programmedSector = -1;
+            verifyCount = 0;
+
+            if (flash != nullptr)
+            {
+                flash->Lock();
+            }
+        }
+};
+
+/// @brief The writer for 1K packets on any backend, also where the constants that do not depend on either come from.
+using FlashWriter = BasicFlashWriter<FlashBackend, 1024>;
@@ -1,11 +1,11 @@
 #pragma once
 
-#include <Arduino.h>
+#include "Platform.h"
 
 class Hardware {
     public:
-        /// @brief The size of the flash memory of STM32F402RTC6
-        static const int32_t FlashSize = 256 * 1024 * 1024;
+        /// @brief The size of the flash memory of STM32F401RCT6
+        static const int32_t FlashSize = 256 * 1024;
 
         /// @brief The position of the flash memory within an STM32 MCU.
         static const int32_t STM32BaseAddress = 0x08000000;
@@ -16,6 +16,62 @@ class Hardware {
         /// @brief  The offset from `STM32BaseAddress` where the reset handler address is stored within the stock elegoo firmware
         ///         assuming it's flashed to `STM32BaseAddress + FirmwareBinaryFileOffset`
         static const int32_t FirmwareCodeOffset = 0xC000;
+
+        /// @brief The size of the image descriptor log, see `ImageDescriptor`.
+        static const int32_t DescriptorLogSize = 512;
+
+        /// @brief The offset from `STM32BaseAddress` of the image descriptor log, the very end of the flash.
+        static const int32_t DescriptorLogOffset = FlashSize - DescriptorLogSize;
+
+        /// @brief The largest image that fits between `FirmwareBinaryFileOffset` and the descriptor log.
+        static const int32_t MaxImageSize = DescriptorLogOffset - FirmwareBinaryFileOffset;
+
+        /// @brief The amount of flash sectors. Sectors are the unit of erasing and are not evenly sized.
+        static const uint8_t SectorCount = 6;
+
+        /// @brief  The offsets from `STM32BaseAddress` where each flash sector starts (4x 16K, 1x 64K, 1x 128K).
+        ///         The extra last entry is the end of the flash.
+        static constexpr int32_t SectorOffsets[SectorCount + 1] = { 0x0000, 0x4000, 0x8000, 0xC000, 0x10000, 0x20000, 0x40000 };
+
+        /// @brief Finds the sector containing an offset.
+        /// @param offset The offset from `STM32BaseAddress`.
+        /// @return The index of the sector, -1 if the offset is outside of the flash.
+        static int8_t SectorOf(int32_t offset)
+        {
+            for (int8_t sector = 0; sector < SectorCount; sector++)
+            {
+                if (offset >= SectorOffsets[sector] && offset < SectorOffsets[sector + 1])
+                {
+                    return sector;
+                }
+            }
+
+            return -1;
+        }
+
+        /// @brief  The program and erase parallelism in bits. x32 is the widest the STM32F401 has, it requires a supply
+        ///         voltage of 2.7V - 3.6V, which the boards have.
+        static const uint8_t ProgramParallelism = 32;
+
+        /// @brief  Typical time of a single program operation in microseconds, the same for all parallelisms. A word
+        ///         takes `32 / parallelism` of them.
+        static const uint16_t WordProgramMicros = 16;
+
+        /// @brief Typical time of erasing a sector, in milliseconds.
+        /// @param sector The index of the sector.
+        /// @param parallelism 8, 16 or 32 bits, smaller parallelisms take longer.
+        static uint16_t SectorEraseMillis(uint8_t sector, uint8_t parallelism = ProgramParallelism)
+        {
+            int32_t size = SectorOffsets[sector + 1] - SectorOffsets[sector];
+            uint8_t column = parallelism >= 32 ? 2 : parallelism >= 16 ? 1 : 0;
+            static const uint16_t millis[3][3] = {
+                { 400, 300, 250 },
+                { 1200, 700, 550 },
+                { 2000, 1100, 1000 },
+            };
+
+            return millis[size <= 16 * 1024 ? 0 : size <= 64 * 1024 ? 1 : 2][column];
+        }
 };
 
 /*
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Platform.h"
+
+/// @brief  Streaming decoder for the heatshrink LZSS format (https://github.com/atomicobject/heatshrink) with a 1K
+///         window and up to 32 byte matches, what `heatshrink -w 10 -l 5` produces. The bit stream is MSB first,
+///         a 1 bit is followed by a literal byte, a 0 bit by a back reference of `WindowBits` bits offset - 1 and
+///         `LookaheadBits` bits length - 1. Input and output can be split at any byte, the only RAM needed is the
+///         window.
+class HeatshrinkDecoder {
+    public:
+        static const uint8_t WindowBits = 10;
+        static const uint8_t LookaheadBits = 5;
+        static const uint16_t WindowSize = 1 << WindowBits;
+
+    private:
+        enum struct State : uint8_t {
+            Tag,
+            Literal,
+            Offset,
+            Length,
+            Copy,
+        };
+
+        uint8_t window[WindowSize];
+        uint16_t windowHead = 0;
+        State state = State::Tag;
+
+        /// @brief The input byte bits are taken from, and how many of its bits are left.
+        uint8_t inputByte = 0;
+        uint8_t inputBits = 0;
+
+        /// @brief The field read so far, it may span input blocks.
+        uint16_t field = 0;
+        uint8_t fieldBits = 0;
+
+        uint16_t copyOffset = 0;
+        uint8_t copyRemaining = 0;
+
+        /// @brief The amount of output bytes still to produce.
+        uint32_t remaining = 0;
+
+        /// @brief Completes reading a field of `count` bits into `field`.
+        /// @return False if the input ran out first, the bits read so far are kept.
+        bool ReadField(uint8_t count, const uint8_t*& input, const uint8_t* end)
+        {
+            while (fieldBits < count)
+            {
+                if (inputBits == 0)
+                {
+                    if (input == end)
+                    {
+                        return false;
+                    }
+
+                    inputByte = *input++;
+                    inputBits = 8;
+                }
+
+                uint8_t take = count - fieldBits < inputBits ? count - fieldBits : inputBits;
+                inputBits -= take;
+                field = (uint16_t)((field << take) | ((inputByte >> inputBits) & ((1 << take) - 1)));
+                fieldBits += take;
+            }
+
+            return true;
+        }
+
+        uint16_t TakeField()
+        {
+            uint16_t value = field;
+            field = 0;
+            fieldBits = 0;
+            return value;
+        }
+
+    public:
+        /// @brief Starts decoding a new stream.
+        /// @param outputSize The size of the decoded data, input past it is ignored.
+        void Begin(uint32_t outputSize)
+        {
+            // The window starts zeroed like heatshrink's, references before the first byte read zeros
+            memset(window, 0, sizeof(window));
+            windowHead = 0;
+            state = State::Tag;
+            inputBits = 0;
+            field = 0;
+            fieldBits = 0;
+            copyRemaining = 0;
+            remaining = outputSize;
+        }
+
+        /// @brief Whether all of the output has been produced.
+        bool IsDone() const
+        {
+            return remaining == 0;
+        }
+
+        /// @brief  Decodes until the input is used up, the output is full or the stream is done. Call again with an
+        ///         empty input to continue a back reference that did not fit into the output.
+        /// @param input The encoded data.
+        /// @param inputLength The length of the encoded data.
+        /// @param output The buffer to write decoded data to.
+        /// @param outputCapacity The capacity of `output`.
+        /// @param produced The pointer to store the amount of decoded bytes.
+        /// @return The amount of input bytes used.
+        uint16_t Decode(const uint8_t* input, uint16_t inputLength, uint8_t* output, uint16_t outputCapacity, uint16_t* produced)
+        {
+            const uint8_t* cursor = input;
+            const uint8_t* end = input + inputLength;
+            uint16_t written = 0;
+
+            while (remaining > 0 && written < outputCapacity)
+            {
+                if (state == State::Copy)
+                {
+                    while (copyRemaining > 0 && remaining > 0 && written < outputCapacity)
+                    {
+                        uint8_t value = window[(windowHead - copyOffset) & (WindowSize - 1)];
+                        window[windowHead++ & (WindowSize - 1)] = value;
+                        output[written++] = value;
+                        copyRemaining--;
+                        remaining--;
+                    }
+
+                    if (copyRemaining == 0)
+                    {
+                        state = State::Tag;
+                    }
+                    continue;
+                }
+
+                uint8_t count = state == State::Tag ? 1
+                    : state == State::Literal ? 8
+                    : state == State::Offset ? WindowBits
+                    : LookaheadBits;
+
+                if (ReadField(count, cursor, end) == false)
+                {
+                    break;
+                }
+
+                uint16_t value = TakeField();
+                switch (state)
+                {
+                    case State::Tag:
+                        state = value ? State::Literal : State::Offset;
+                        break;
+
+                    case State::Literal:
+                        window[windowHead++ & (WindowSize - 1)] = (uint8_t)value;
+                        output[written++] = (uint8_t)value;
+                        remaining--;
+                        state = State::Tag;
+                        break;
+
+                    case State::Offset:
+                        copyOffset = value + 1;
+                        state = State::Length;
+                        break;
+
+                    case State::Length:
+                        copyRemaining = (uint8_t)(value + 1);
+                        state = State::Copy;
+                        break;
+
+                    case State::Copy:
+                        break;
+                }
+            }
+
+            *produced = written;
+            return (uint16_t)(cursor - input);
+        }
+};
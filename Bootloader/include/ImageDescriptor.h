@@ -0,0 +1,234 @@
+#pragma once
+
+#include "Platform.h"
+#include "Crc32.h"
+#include "FlashBackend.h"
+#include "Hardware.h"
+
+/// @brief One entry of the descriptor log.
+struct ImageRecord {
+    uint32_t Magic;
+
+    /// @brief The size of the image at `FirmwareBinaryFileOffset` in bytes.
+    uint32_t Size;
+
+    /// @brief `Crc32` of the image.
+    uint32_t Crc;
+
+    /// @brief The version the uploader gave the image, 0 if none.
+    uint32_t Version;
+
+    /// @brief The inverted XOR of the other fields, tells a complete record from one cut short by a reset.
+    uint32_t Check;
+};
+
+/// @brief  The progress of an update, appended to the descriptor log while the image is being written. An update
+///         that breaks off leaves it as the latest record, a later one for the same image continues from there.
+struct ProgressRecord {
+    uint32_t Magic;
+
+    /// @brief The size of the image being written.
+    uint32_t Size;
+
+    /// @brief The amount of bytes programmed from the start of the image, the start of a sector.
+    uint32_t Offset;
+
+    /// @brief `Crc32` of the image up to `Offset`.
+    uint32_t Crc;
+
+    /// @brief The inverted XOR of the other fields.
+    uint32_t Check;
+};
+
+static_assert(sizeof(ProgressRecord) == sizeof(ImageRecord), "Both records share the slots of the log");
+
+enum struct ImageCheckResult : uint8_t {
+    /// @brief The latest descriptor describes a complete image.
+    Valid,
+
+    /// @brief  There is no complete descriptor: none has been written yet, the log has been erased, or an update
+    ///         has invalidated it and not finished.
+    Missing,
+
+    /// @brief The flash does not hold the image the latest descriptor describes.
+    Mismatch,
+};
+
+/// @brief  The record of what the last successful update wrote, kept in a small log at the end of the flash. Records
+///         are appended into blank slots, so an update only costs an erase when the log is full. Only the last
+///         written slot counts: an update clears the magic of that record before it touches the image and appends
+///         a new one with the CRC32 it computed on the way once everything is programmed. So the boot decision
+///         only has to read the log, an interrupted update leaves no complete record behind. The functions taking the
+///         flash are templates, so they read a `final` backend without virtual calls.
+class ImageDescriptor {
+    public:
+        static const uint32_t Magic = 0x32474D49; // "IMG2"
+        static const uint32_t ProgressMagic = 0x31475250; // "PRG1"
+
+        static const uint32_t ImageAddress = Hardware::STM32BaseAddress + Hardware::FirmwareBinaryFileOffset;
+        static const uint32_t LogAddress = Hardware::STM32BaseAddress + Hardware::DescriptorLogOffset;
+        static const uint8_t SlotCount = Hardware::DescriptorLogSize / sizeof(ImageRecord);
+
+        /// @brief The sector holding the log, erasing it drops all records.
+        static uint8_t LogSector()
+        {
+            return (uint8_t)Hardware::SectorOf(Hardware::DescriptorLogOffset);
+        }
+
+        static ImageRecord Make(uint32_t size, uint32_t crc, uint32_t version)
+        {
+            return { Magic, size, crc, version, ~(Magic ^ size ^ crc ^ version) };
+        }
+
+        static ProgressRecord MakeProgress(uint32_t size, uint32_t offset, uint32_t crc)
+        {
+            return { ProgressMagic, size, offset, crc, ~(ProgressMagic ^ size ^ offset ^ crc) };
+        }
+
+        static bool IsComplete(const ImageRecord& record)
+        {
+            return record.Magic == Magic && record.Check == ~(record.Magic ^ record.Size ^ record.Crc ^ record.Version);
+        }
+
+        static bool IsComplete(const ProgressRecord& record)
+        {
+            return record.Magic == ProgressMagic && record.Check == ~(record.Magic ^ record.Size ^ record.Offset ^ record.Crc);
+        }
+
+        static uint32_t SlotAddress(uint8_t slot)
+        {
+            return LogAddress + slot * sizeof(ImageRecord);
+        }
+
+        template <typename TFlash>
+        static ImageRecord ReadSlot(TFlash* flash, uint8_t slot)
+        {
+            ImageRecord record;
+            uint32_t* words = (uint32_t*)&record;
+
+            for (uint8_t i = 0; i < sizeof(ImageRecord) / 4; i++)
+            {
+                words[i] = flash->ReadWord(SlotAddress(slot) + i * 4);
+            }
+
+            return record;
+        }
+
+        /// @return The slot after the last one that has been written to, `SlotCount` if the log is full.
+        template <typename TFlash>
+        static uint8_t FreeSlot(TFlash* flash)
+        {
+            uint8_t slot = SlotCount;
+
+            while (slot > 0)
+            {
+                ImageRecord record = ReadSlot(flash, slot - 1);
+                if ((record.Magic & record.Size & record.Crc & record.Version & record.Check) != 0xFFFFFFFF)
+                {
+                    break;
+                }
+
+                slot--;
+            }
+
+            return slot;
+        }
+
+        /// @brief Reads the record in the last written slot.
+        /// @param slot The pointer to store the index of the slot, may be null.
+        /// @return False if there is none or it is not complete.
+        template <typename TFlash>
+        static bool FindLatest(TFlash* flash, ImageRecord* record, uint8_t* slot = nullptr)
+        {
+            uint8_t last = FreeSlot(flash);
+            if (last == 0)
+            {
+                return false;
+            }
+
+            *record = ReadSlot(flash, last - 1);
+            if (slot != nullptr)
+            {
+                *slot = last - 1;
+            }
+
+            return IsComplete(*record);
+        }
+
+        /// @brief Reads the record in the last written slot, when it is the progress of an update.
+        /// @return False if there is none, it is not complete or it describes an image.
+        template <typename TFlash>
+        static bool FindProgress(TFlash* flash, ProgressRecord* progress)
+        {
+            uint8_t last = FreeSlot(flash);
+            if (last == 0)
+            {
+                return false;
+            }
+
+            ImageRecord record = ReadSlot(flash, last - 1);
+            memcpy(progress, &record, sizeof(*progress));
+
+            return IsComplete(*progress);
+        }
+
+        /// @brief  Computes the `Crc32` of an image in flash, a trailing partial word is padded with 0xFF. Uses the
+        ///         CRC unit on the target, no other `RunningCrc32` may be running.
+        template <typename TFlash>
+        static uint32_t ComputeCrc(TFlash* flash, uint32_t address, uint32_t size)
+        {
+            RunningCrc32 crc;
+            uint32_t end = address + size;
+
+            crc.Begin();
+            for (; address + 4 <= end; address += 4)
+            {
+                crc.AddWord(flash->ReadWord(address));
+            }
+
+            if (address < end)
+            {
+                crc.AddWord(flash->ReadWord(address) | (0xFFFFFFFF << ((end - address) * 8)));
+            }
+
+            return crc.Value();
+        }
+
+        /// @brief The boot decision: whether the latest record describes a complete image. Only reads the log.
+        template <typename TFlash>
+        static ImageCheckResult Check(TFlash* flash)
+        {
+            ImageRecord record;
+
+            if (FindLatest(flash, &record) == false)
+            {
+                return ImageCheckResult::Missing;
+            }
+
+            if (record.Size == 0 || record.Size > (uint32_t)Hardware::MaxImageSize)
+            {
+                return ImageCheckResult::Mismatch;
+            }
+
+            return ImageCheckResult::Valid;
+        }
+
+        /// @brief Like `Check`, and also reads the whole image back to compare its checksum with the record.
+        template <typename TFlash>
+        static ImageCheckResult Verify(TFlash* flash)
+        {
+            ImageCheckResult result = Check(flash);
+            if (result != ImageCheckResult::Valid)
+            {
+                return result;
+            }
+
+            ImageRecord record;
+            if (FindLatest(flash, &record) == false)
+            {
+                return ImageCheckResult::Missing;
+            }
+
+            return ComputeCrc(flash, ImageAddress, record.Size) == record.Crc ? ImageCheckResult::Valid : ImageCheckResult::Mismatch;
+        }
+};
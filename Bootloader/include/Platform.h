@@ -0,0 +1,11 @@
+#pragma once
+
+// The protocol code is built for the target with the Arduino framework and natively on the host (`pio run -e native`),
+// where only the standard C headers are available.
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
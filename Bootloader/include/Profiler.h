@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Platform.h"
+
+enum struct ProfilePhase : uint8_t {
+    /// @brief Protocol handling outside of the other phases.
+    Protocol,
+
+    /// @brief Reading packets from the transport, including waiting for them.
+    Receive,
+
+    /// @brief Checking the CRC16 of packets.
+    Crc,
+
+    /// @brief Driving the flash writer.
+    Flash,
+
+    /// @brief Expanding compressed files.
+    Decompress,
+
+    /// @brief A sector erase, from starting it until the writer sees it finish.
+    Erase,
+
+    /// @brief A word program, from starting it until the writer sees it finish.
+    Program,
+
+    /// @brief Sending the reply to a packet.
+    Ack,
+
+    /// @brief Reading back a programmed sector.
+    Verify,
+
+    Count,
+};
+
+/// @brief The statistics of one phase, in ticks of `Profiler::TicksPerSecond`.
+struct PhaseStats {
+    static const uint8_t BucketCount = 32;
+
+    uint32_t Count;
+    uint32_t Min;
+    uint32_t Max;
+    uint64_t Total;
+
+    /// @brief Bucket `i` counts the samples of 2^i to 2^(i+1) - 1 ticks, bucket 0 also those of 0 ticks.
+    uint32_t Buckets[BucketCount];
+};
+
+#if defined(YMODEM_STATS)
+#if !defined(ARDUINO)
+#include <chrono>
+#endif
+
+/// @brief  Collects where the time of a YModem session goes. Every phase keeps the count, min, max, total and a log2
+///         histogram of its samples. On top of that the time between samples is charged to the innermost phase, so
+///         the exclusive times of the CPU phases add up to the session. Ticks are CPU cycles from the DWT cycle
+///         counter on the target and nanoseconds of the monotonic clock on the host, where waiting in the simulation
+///         costs no time. Only built with `YMODEM_STATS`, without it the hooks compile to nothing.
+class Profiler {
+    private:
+        static ProfilePhase current;
+        static uint32_t last;
+
+    public:
+        static PhaseStats Stats[(uint8_t)ProfilePhase::Count];
+
+        /// @brief The ticks charged to each phase while it was the innermost one.
+        static uint64_t Exclusive[(uint8_t)ProfilePhase::Count];
+
+        static uint32_t Now()
+        {
+#if defined(ARDUINO)
+            return DWT->CYCCNT;
+#else
+            return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        static uint32_t TicksPerSecond()
+        {
+#if defined(ARDUINO)
+            return SystemCoreClock;
+#else
+            return 1000000000;
+#endif
+        }
+
+        /// @brief Adds a sample to the statistics of a phase.
+        static void Record(ProfilePhase phase, uint32_t ticks)
+        {
+            PhaseStats& stats = Stats[(uint8_t)phase];
+
+            if (stats.Count == 0 || ticks < stats.Min)
+            {
+                stats.Min = ticks;
+            }
+            if (ticks > stats.Max)
+            {
+                stats.Max = ticks;
+            }
+
+            stats.Count++;
+            stats.Total += ticks;
+            stats.Buckets[ticks == 0 ? 0 : 31 - __builtin_clz(ticks)]++;
+        }
+
+        /// @brief Charges the time since the last switch to the current phase and makes `phase` the current one.
+        /// @return The phase that was current before.
+        static ProfilePhase Switch(ProfilePhase phase, uint32_t now = Now())
+        {
+            Exclusive[(uint8_t)current] += now - last;
+            last = now;
+
+            ProfilePhase previous = current;
+            current = phase;
+            return previous;
+        }
+
+        /// @brief Clears the statistics and starts charging to `ProfilePhase::Protocol`.
+        static void Reset()
+        {
+#if defined(ARDUINO)
+            CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+            DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+            memset(Stats, 0, sizeof(Stats));
+            memset(Exclusive, 0, sizeof(Exclusive));
+            current = ProfilePhase::Protocol;
+            last = Now();
+        }
+};
+
+/// @brief Makes a phase current for the lifetime of the scope and records its duration.
+class ProfileScope {
+    private:
+        ProfilePhase phase;
+        ProfilePhase previous;
+        uint32_t start;
+
+    public:
+        ProfileScope(ProfilePhase phase)
+            : phase(phase), start(Profiler::Now())
+        {
+            previous = Profiler::Switch(phase, start);
+        }
+
+        ~ProfileScope()
+        {
+            uint32_t now = Profiler::Now();
+            Profiler::Record(phase, now - start);
+            Profiler::Switch(previous, now);
+        }
+};
+
+/// @brief Times an operation that runs in the background, like a flash erase.
+class ProfileOperation {
+    private:
+        ProfilePhase phase;
+        uint32_t start;
+        bool running = false;
+
+    public:
+        void Begin(ProfilePhase operationPhase)
+        {
+            phase = operationPhase;
+            start = Profiler::Now();
+            running = true;
+        }
+
+        void End()
+        {
+            if (running)
+            {
+                Profiler::Record(phase, Profiler::Now() - start);
+                running = false;
+            }
+        }
+};
+
+ProfilePhase Profiler::current = ProfilePhase::Protocol;
+uint32_t Profiler::last = 0;
+PhaseStats Profiler::Stats[(uint8_t)ProfilePhase::Count];
+uint64_t Profiler::Exclusive[(uint8_t)ProfilePhase::Count];
+
+#define PROFILE_PHASE(phase) ProfileScope profileScope(ProfilePhase::phase)
+#define PROFILE_RESET() Profiler::Reset()
+#else
+class ProfileOperation {
+    public:
+        void Begin(ProfilePhase)
+        {
+        }
+
+        void End()
+        {
+        }
+};
+
+#define PROFILE_PHASE(phase)
+#define PROFILE_RESET()
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include "Platform.h"
+
+/// @brief  Lock-free byte queue between one producer and one consumer, e.g. the USB receive interrupt and the
+///         protocol loop. Each side only writes its own index and publishes it with release ordering after the data,
+///         so neither ever blocks or disables interrupts. The indices run freely and wrap at 2^32, `Capacity` has to be
+///         a power of two for the masking to stay correct across that wrap.
+template <uint32_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+    private:
+        uint8_t data[Capacity];
+
+        /// @brief The total amount of bytes pushed, only written by the producer.
+        std::atomic<uint32_t> head { 0 };
+
+        /// @brief The total amount of bytes popped, only written by the consumer.
+        std::atomic<uint32_t> tail { 0 };
+
+    public:
+        /// @return The amount of bytes that can be popped, may grow at any time when called by the consumer.
+        uint32_t Available() const
+        {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+        }
+
+        /// @return The amount of bytes that can be pushed, may grow at any time when called by the producer.
+        uint32_t Free() const
+        {
+            return Capacity - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+        }
+
+        /// @brief Adds bytes, producer only. Bytes that do not fit are dropped.
+        /// @return The amount of bytes added.
+        uint32_t Push(const uint8_t* bytes, uint32_t length)
+        {
+            uint32_t position = head.load(std::memory_order_relaxed);
+            uint32_t free = Capacity - (position - tail.load(std::memory_order_acquire));
+            if (length > free)
+            {
+                length = free;
+            }
+
+            uint32_t offset = position & (Capacity - 1);
+            uint32_t first = Capacity - offset < length ? Capacity - offset : length;
+            memcpy(&data[offset], bytes, first);
+            memcpy(data, &bytes[first], length - first);
+
+            head.store(position + length, std::memory_order_release);
+            return length;
+        }
+
+        /// @brief Takes bytes out, consumer only.
+        /// @return The amount of bytes taken, less than `length` if fewer were available.
+        uint32_t Pop(uint8_t* bytes, uint32_t length)
+        {
+            uint32_t position = tail.load(std::memory_order_relaxed);
+            uint32_t available = head.load(std::memory_order_acquire) - position;
+            if (length > available)
+            {
+                length = available;
+            }
+
+            uint32_t offset = position & (Capacity - 1);
+            uint32_t first = Capacity - offset < length ? Capacity - offset : length;
+            memcpy(bytes, &data[offset], first);
+            memcpy(&bytes[first], data, length - first);
+
+            tail.store(position + length, std::memory_order_release);
+            return length;
+        }
+
+        /// @brief Drops everything, only while the producer is stopped.
+        void Clear()
+        {
+            tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+        }
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <Arduino.h>
+#include "FlashBackend.h"
+
+/// @brief  Places a function in RAM, the startup code copies it there with the initialized data. The flash can not
+///         be read while it programs, code running from it stalls until the operation is done.
+#define RAM_FUNCTION __attribute__((section(".RamFunc"), noinline))
+
+/// @brief  Flash backend driving the STM32F4 flash controller registers directly. Programming uses x32 parallelism,
+///         which requires a supply voltage of 2.7V - 3.6V.
+class Stm32Flash final : public FlashBackend {
+    private:
+        static const uint32_t ErrorFlags = FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+
+        /// @brief  The most words `ProgramWords` programs in one go, about 256us with the CPU held. Reception does
+        ///         not lose data meanwhile, the USB peripheral holds off the host once its buffer is full.
+        static const uint16_t BurstWords = 16;
+
+        /// @brief Whether the last started operation is an erase.
+        bool erasing = false;
+
+        /// @brief Drops data cached by the ART accelerator, it may hold the contents from before an erase.
+        void FlushDataCache()
+        {
+            if (FLASH->ACR & FLASH_ACR_DCEN)
+            {
+                FLASH->ACR &= ~FLASH_ACR_DCEN;
+                FLASH->ACR |= FLASH_ACR_DCRST;
+                FLASH->ACR &= ~FLASH_ACR_DCRST;
+                FLASH->ACR |= FLASH_ACR_DCEN;
+            }
+        }
+
+    public:
+        void Unlock() override
+        {
+            if (FLASH->CR & FLASH_CR_LOCK)
+            {
+                FLASH->KEYR = FLASH_KEY1;
+                FLASH->KEYR = FLASH_KEY2;
+            }
+        }
+
+        void Lock() override
+        {
+            FLASH->CR &= ~FLASH_CR_PG;
+            FLASH->CR |= FLASH_CR_LOCK;
+        }
+
+        FlashStatus GetStatus() override
+        {
+            uint32_t status = FLASH->SR;
+
+            if (status & FLASH_SR_BSY)
+            {
+                return FlashStatus::Busy;
+            }
+
+            if (erasing)
+            {
+                erasing = false;
+                FLASH->CR &= ~FLASH_CR_SER;
+                FlushDataCache();
+            }
+
+            if (status & ErrorFlags)
+            {
+                return FlashStatus::Error;
+            }
+
+            return FlashStatus::Ready;
+        }
+
+        void ClearError() override
+        {
+            // Error flags are cleared by writing 1
+            FLASH->SR = ErrorFlags;
+        }
+
+        void BeginProgramWord(uint32_t address, uint32_t word) override
+        {
+            FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SER)) | FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+            *(volatile uint32_t*)address = word;
+        }
+
+        void BeginEraseSector(uint8_t sector) override
+        {
+            FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_PG | FLASH_CR_SNB))
+                | FLASH_CR_PSIZE_1
+                | FLASH_CR_SER
+                | ((uint32_t)sector << FLASH_CR_SNB_Pos);
+            FLASH->CR |= FLASH_CR_STRT;
+            erasing = true;
+        }
+
+        /// @brief  Runs from RAM, so the next word starts as soon as the flash is done with the previous one instead of
+        ///         after a round trip through the caller's code in flash, which would stall on every fetch anyway.
+        ///         Only inlined code and registers may be used here.
+        RAM_FUNCTION uint16_t ProgramWords(uint32_t address, const uint8_t* data, uint16_t count) override
+        {
+            uint16_t burst = count < BurstWords ? count : BurstWords;
+            FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SER)) | FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+
+            for (uint16_t i = 0; i < burst; i++)
+            {
+                if (i > 0)
+                {
+                    while (FLASH->SR & FLASH_SR_BSY)
+                    {
+                    }
+
+                    if (FLASH->SR & ErrorFlags)
+                    {
+                        return i;
+                    }
+                }
+
+                uint32_t word = (uint32_t)data[i * 4] | (uint32_t)data[i * 4 + 1] << 8 | (uint32_t)data[i * 4 + 2] << 16 | (uint32_t)data[i * 4 + 3] << 24;
+                *(volatile uint32_t*)(address + i * 4) = word;
+            }
+
+            return burst;
+        }
+
+        uint32_t ReadWord(uint32_t address) override
+        {
+            return *(volatile uint32_t*)address;
+        }
+
+        uint32_t BlankCheck(uint32_t address, uint32_t end) override
+        {
+            for (; address < end; address += 4)
+            {
+                if (*(volatile uint32_t*)address != 0xFFFFFFFF)
+                {
+                    break;
+                }
+            }
+
+            return address;
+        }
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "Platform.h"
+#include "Clock.h"
+#include "Transport.h"
+
+enum struct TraceKind : uint8_t {
+    /// @brief Bytes of the host, as the transport handed them to the protocol.
+    In,
+
+    /// @brief Bytes sent to the host.
+    Out,
+
+    /// @brief A decision of the protocol, the data is a `TraceState` and its value.
+    State,
+};
+
+enum struct TraceState : uint8_t {
+    /// @brief `ReceiveFile` has started a session.
+    Session,
+
+    /// @brief A header packet has been handled, the value is the `FileNamePacketResult`.
+    Header,
+
+    /// @brief A packet arrived broken or not at all, the value is the `ReceivePacketResult`.
+    PacketError,
+
+    /// @brief An EOT ended the data of a file, the value is the `FlashWriterResult` of finishing it.
+    Eot,
+
+    /// @brief The file continues at a sector that failed verification, the value is the offset into the image.
+    Rewind,
+
+    /// @brief `ReceiveFile` has ended the session, the value is the `ReceiveFileResult`.
+    End,
+};
+
+#if defined(YMODEM_TRACE)
+
+#if !defined(YMODEM_TRACE_SIZE)
+#define YMODEM_TRACE_SIZE (16 * 1024)
+#endif
+
+/// @brief  Records what goes over the transport and what the protocol decided, with timestamps, into a RAM ring. A
+///         record is the `TraceKind`, the microseconds since the previous record as a LEB128 varint, the length of
+///         its data in a byte and the data, longer data is split into several records. When the ring is full the
+///         oldest records make room. Only built with `YMODEM_TRACE`, and records only between `Start` and `Stop`.
+class Trace {
+    public:
+        static const uint32_t Size = YMODEM_TRACE_SIZE;
+        static_assert((Size & (Size - 1)) == 0, "The trace ring is a power of two");
+
+        /// @brief The most data a single record carries.
+        static const uint8_t MaxRecordData = 255;
+
+    private:
+        static uint8_t ring[Size];
+
+        /// @brief The amount of bytes ever written and the start of the oldest record, both wrap with the ring.
+        static uint32_t head;
+        static uint32_t tail;
+
+        static Clock* clock;
+        static uint32_t lastMicros;
+        static bool paused;
+
+        static void Put(uint8_t value)
+        {
+            ring[head++ & (Size - 1)] = value;
+        }
+
+        /// @return The size of the record starting at a position.
+        static uint32_t RecordSizeAt(uint32_t position)
+        {
+            uint32_t size = 1;
+            while (ring[(position + size++) & (Size - 1)] & 0x80)
+            {
+            }
+
+            return size + 1 + ring[(position + size) & (Size - 1)];
+        }
+
+        static void Append(TraceKind kind, uint32_t micros, const uint8_t* data, uint8_t length)
+        {
+            uint8_t varint[5];
+            uint8_t varintLength = 0;
+            do
+            {
+                varint[varintLength++] = (uint8_t)((micros & 0x7F) | (micros > 0x7F ? 0x80 : 0));
+                micros >>= 7;
+            } while (micros > 0);
+
+            uint32_t size = 2u + varintLength + length;
+            while (Size - (head - tail) < size)
+            {
+                tail += RecordSizeAt(tail);
+                Dropped++;
+            }
+
+            Put((uint8_t)kind);
+            for (uint8_t i = 0; i < varintLength; i++)
+            {
+                Put(varint[i]);
+            }
+            Put(length);
+            for (uint8_t i = 0; i < length; i++)
+            {
+                Put(data[i]);
+            }
+        }
+
+    public:
+        /// @brief The amount of records the ring has dropped to make room since `Clear`.
+        static uint32_t Dropped;
+
+        /// @brief Starts recording into an empty ring, with timestamps from a clock.
+        static void Start(Clock* source)
+        {
+            clock = source;
+            Clear();
+        }
+
+        static void Stop()
+        {
+            clock = nullptr;
+        }
+
+        /// @brief Holds recording back without clearing, e.g. while the trace itself is being sent.
+        static void Pause(bool pause)
+        {
+            paused = pause;
+        }
+
+        /// @brief Empties the ring, the next record is timed from now.
+        static void Clear()
+        {
+            head = 0;
+            tail = 0;
+            Dropped = 0;
+            lastMicros = clock != nullptr ? clock->Micros() : 0;
+        }
+
+        static void Record(TraceKind kind, const uint8_t* data, uint16_t length)
+        {
+            if (clock == nullptr || paused)
+            {
+                return;
+            }
+
+            uint32_t now = clock->Micros();
+            uint32_t delta = now - lastMicros;
+            lastMicros = now;
+
+            do
+            {
+                uint8_t chunk = length < MaxRecordData ? (uint8_t)length : MaxRecordData;
+                Append(kind, delta, data, chunk);
+                data += chunk;
+                length -= chunk;
+                delta = 0;
+            } while (length > 0);
+        }
+
+        /// @brief Records a decision of the protocol: the state and its value as a varint.
+        static void RecordState(TraceState state, uint32_t value)
+        {
+            uint8_t data[6] = { (uint8_t)state };
+            uint8_t length = 1;
+            do
+            {
+                data[length++] = (uint8_t)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+                value >>= 7;
+            } while (value > 0);
+
+            Record(TraceKind::State, data, length);
+        }
+
+        /// @return The amount of bytes the records in the ring take.
+        static uint32_t Length()
+        {
+            return head - tail;
+        }
+
+        /// @brief Copies bytes of the records, counted from the start of the oldest one.
+        static void Copy(uint32_t offset, uint8_t* out, uint16_t length)
+        {
+            for (uint16_t i = 0; i < length; i++)
+            {
+                out[i] = ring[(tail + offset + i) & (Size - 1)];
+            }
+        }
+};
+
+uint8_t Trace::ring[Trace::Size];
+uint32_t Trace::head = 0;
+uint32_t Trace::tail = 0;
+Clock* Trace::clock = nullptr;
+uint32_t Trace::lastMicros = 0;
+bool Trace::paused = false;
+uint32_t Trace::Dropped = 0;
+
+/// @brief  Wraps a transport and records every byte in and out with `Trace`. `final` like the transports it wraps,
+///         so the protocol's calls through it are still bound at compile time.
+/// @tparam TTransport The transport that carries the bytes.
+template <typename TTransport>
+class TracedTransport final : public Transport {
+    private:
+        TTransport& inner;
+
+    public:
+        explicit TracedTransport(TTransport& transport)
+            : inner(transport)
+        {
+        }
+
+        void Begin() override
+        {
+            inner.Begin();
+        }
+
+        void End() override
+        {
+            inner.End();
+        }
+
+        uint32_t Available() override
+        {
+            return inner.Available();
+        }
+
+        uint16_t Read(uint8_t* data, uint16_t length) override
+        {
+            uint16_t read = inner.Read(data, length);
+            if (read > 0)
+            {
+                Trace::Record(TraceKind::In, data, read);
+            }
+
+            return read;
+        }
+
+        void Write(const uint8_t* data, uint16_t length) override
+        {
+            Trace::Record(TraceKind::Out, data, length);
+            inner.Write(data, length);
+        }
+
+        void Flush() override
+        {
+            inner.Flush();
+        }
+};
+
+#define TRACE_STATE(state, value) Trace::RecordState(TraceState::state, (uint32_t)(value))
+#define TRACE_CLEAR() Trace::Clear()
+#else
+#define TRACE_STATE(state, value)
+#define TRACE_CLEAR()
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Platform.h"
+
+/// @brief  The byte stream a YModem session runs over: the USB CDC port on the target, a simulated link when the
+///         protocol runs natively on the host.
+class Transport {
+    public:
+        virtual void Begin() = 0;
+
+        virtual void End() = 0;
+
+        /// @return The amount of received bytes that can be read without waiting.
+        virtual uint32_t Available() = 0;
+
+        /// @brief Reads received bytes, never waits for more to arrive.
+        /// @param data The buffer to store the bytes in.
+        /// @param length The amount of bytes to read, at most `Available`.
+        /// @return The amount of bytes read.
+        virtual uint16_t Read(uint8_t* data, uint16_t length) = 0;
+
+        /// @brief Queues bytes for sending.
+        virtual void Write(const uint8_t* data, uint16_t length) = 0;
+
+        /// @brief Waits until the queued bytes have been sent.
+        virtual void Flush() = 0;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <usbd_cdc_if.h>
+#include "SpscRing.h"
+#include "Transport.h"
+
+/// @brief  Transport over the USB CDC port of the STM32duino core. Received data bypasses the core's queue: the CDC
+///         receive callback, running in the USB interrupt, pushes every packet straight into a lock-free ring the
+///         protocol loop reads without any locking. The OUT endpoint is only re-armed while the ring has room for
+///         another packet, otherwise the host is held off by NAKs until the protocol loop has read enough. Sending
+///         still goes through `SerialUSB`.
+class UsbTransport final : public Transport {
+    public:
+        /// @brief Holds more than a 1K packet, so one can arrive completely while the previous one is being flashed.
+        static const uint32_t RingSize = 4096;
+
+    private:
+        static SpscRing<RingSize> Ring;
+
+        /// @brief The core's CDC callbacks with `Receive` replaced.
+        static USBD_CDC_ItfTypeDef Callbacks;
+
+        /// @brief The buffer the OUT endpoint receives into, only touched by the USB peripheral and interrupt.
+        static uint8_t Packet[CDC_DATA_FS_MAX_PACKET_SIZE];
+
+        /// @brief Set by the interrupt when the ring was too full to re-arm the endpoint, cleared by the reader.
+        static std::atomic<bool> Paused;
+
+        static void Rearm()
+        {
+            USBD_CDC_SetRxBuffer(&hUSBD_Device_CDC, Packet);
+            USBD_CDC_ReceivePacket(&hUSBD_Device_CDC);
+        }
+
+        static int8_t OnReceive(uint8_t* data, uint32_t* length)
+        {
+            // Always fits, the endpoint is only armed while the ring has room for a whole packet
+            Ring.Push(data, *length);
+
+            if (Ring.Free() >= CDC_DATA_FS_MAX_PACKET_SIZE)
+            {
+                Rearm();
+            }
+            else
+            {
+                Paused.store(true, std::memory_order_release);
+            }
+
+            return USBD_OK;
+        }
+
+    public:
+        void Begin() override
+        {
+            Ring.Clear();
+            Paused.store(false, std::memory_order_relaxed);
+
+            SerialUSB.begin();
+
+            // The host cannot send before it has enumerated the device and opened the port, long after this
+            Callbacks = USBD_CDC_fops;
+            Callbacks.Receive = OnReceive;
+            USBD_CDC_RegisterInterface(&hUSBD_Device_CDC, &Callbacks);
+        }
+
+        void End() override
+        {
+            SerialUSB.end();
+        }
+
+        uint32_t Available() override
+        {
+            return Ring.Available();
+        }
+
+        uint16_t Read(uint8_t* data, uint16_t length) override
+        {
+            uint16_t read = (uint16_t)Ring.Pop(data, length);
+
+            // The interrupt stays quiet while paused, so the endpoint can be re-armed from here without racing it
+            if (Paused.load(std::memory_order_acquire) && Ring.Free() >= CDC_DATA_FS_MAX_PACKET_SIZE)
+            {
+                Paused.store(false, std::memory_order_relaxed);
+                Rearm();
+            }
+
+            return read;
+        }
+
+        void Write(const uint8_t* data, uint16_t length) override
+        {
+            SerialUSB.write(data, length);
+        }
+
+        void Flush() override
+        {
+            SerialUSB.flush();
+        }
+};
+
+SpscRing<UsbTransport::RingSize> UsbTransport::Ring;
+USBD_CDC_ItfTypeDef UsbTransport::Callbacks;
+uint8_t UsbTransport::Packet[CDC_DATA_FS_MAX_PACKET_SIZE];
+std::atomic<bool> UsbTransport::Paused { false };
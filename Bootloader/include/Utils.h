@@ -1,6 +1,6 @@
-#pragma Once
+#pragma once
 
-#include <Arduino.h>
+#include "Platform.h"
 
 #define IS_AF(c)  ((c >= 'A') && (c <= 'F'))
 #define IS_af(c)  ((c >= 'a') && (c <= 'f'))
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+#include "HeatshrinkDecoder.h"
+
+/// @brief  Encoder for the format `HeatshrinkDecoder` reads, the same greedy search as the uploader's. Matches are
+///         found through hash chains over byte pairs, a match pays off from 2 bytes on (16 bits against 18 for two
+///         literals).
+class HeatshrinkEncoder {
+    private:
+        static const uint16_t MaxLength = 1 << HeatshrinkDecoder::LookaheadBits;
+        static const uint16_t MinLength = 2;
+        static const uint16_t MaxChain = 256;
+
+        std::vector<uint8_t> output;
+        uint8_t currentByte = 0;
+        uint8_t currentBits = 0;
+
+        void WriteBits(uint16_t value, uint8_t count)
+        {
+            while (count-- > 0)
+            {
+                currentByte = (uint8_t)((currentByte << 1) | ((value >> count) & 1));
+                if (++currentBits == 8)
+                {
+                    output.push_back(currentByte);
+                    currentBits = 0;
+                }
+            }
+        }
+
+    public:
+        std::vector<uint8_t> Encode(const std::vector<uint8_t>& data)
+        {
+            output.clear();
+            currentBits = 0;
+
+            std::vector<int32_t> head(1 << 16, -1);
+            std::vector<int32_t> previous(data.size(), -1);
+            size_t position = 0;
+
+            auto insert = [&](size_t at) {
+                if (at + 1 < data.size())
+                {
+                    uint16_t key = (uint16_t)(data[at] << 8 | data[at + 1]);
+                    previous[at] = head[key];
+                    head[key] = (int32_t)at;
+                }
+            };
+
+            while (position < data.size())
+            {
+                size_t bestLength = 0;
+                size_t bestOffset = 0;
+
+                if (position + 1 < data.size())
+                {
+                    int32_t candidate = head[(uint16_t)(data[position] << 8 | data[position + 1])];
+                    size_t limit = std::min((size_t)MaxLength, data.size() - position);
+
+                    for (uint16_t chain = 0; candidate >= 0 && position - candidate <= HeatshrinkDecoder::WindowSize && chain < MaxChain; chain++)
+                    {
+                        size_t length = 0;
+                        while (length < limit && data[candidate + length] == data[position + length])
+                        {
+                            length++;
+                        }
+
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestOffset = position - candidate;
+                            if (length == limit)
+                            {
+                                break;
+                            }
+                        }
+
+                        candidate = previous[candidate];
+                    }
+                }
+
+                if (bestLength >= MinLength)
+                {
+                    WriteBits(0, 1);
+                    WriteBits((uint16_t)(bestOffset - 1), HeatshrinkDecoder::WindowBits);
+                    WriteBits((uint16_t)(bestLength - 1), HeatshrinkDecoder::LookaheadBits);
+                }
+                else
+                {
+                    bestLength = 1;
+                    WriteBits(1, 1);
+                    WriteBits(data[position], 8);
+                }
+
+                for (size_t i = 0; i < bestLength; i++)
+                {
+                    insert(position++);
+                }
+            }
+
+            if (currentBits > 0)
+            {
+                WriteBits(0, 8 - currentBits);
+            }
+
+            return output;
+        }
+};
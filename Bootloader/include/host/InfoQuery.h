@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "Crc16.h"
+#include "ymodem.h"
+#include "host/SimulatedLink.h"
+
+/// @brief Host peer that sends the `INFO` command and decodes the answer, like the uploader's check after an upload.
+class InfoQuery : public HostPeer {
+    private:
+        std::vector<uint8_t> answer;
+
+    public:
+        static const uint8_t AnswerSize = 21;
+
+        /// @brief Whether the bootloader has a complete descriptor.
+        bool HasDescriptor = false;
+
+        /// @brief Whether the bootloader read the image back and found it matching the descriptor.
+        bool Verified = false;
+
+        uint32_t Size = 0;
+        uint32_t Crc = 0;
+        uint32_t Version = 0;
+
+        /// @brief The time the previous boot took to start the application, 0 if not known.
+        uint32_t BootMicros = 0;
+
+        void Start(SimulatedLink& link, uint64_t now) override
+        {
+            uint8_t command = INFO;
+            link.SendToDevice(&command, 1, now);
+        }
+
+        void Receive(SimulatedLink&, const uint8_t* data, uint16_t length, uint64_t) override
+        {
+            answer.insert(answer.end(), data, data + length);
+        }
+
+        /// @brief Decodes the answer received so far.
+        /// @return False if it is incomplete or corrupted.
+        bool Decode()
+        {
+            if (answer.size() < AnswerSize || answer[0] != INFO || answer[1] != INFO_VERSION)
+            {
+                return false;
+            }
+
+            uint16_t crc = (uint16_t)(answer[AnswerSize - 2] << 8 | answer[AnswerSize - 1]);
+            if (Crc16::ComputeBitwise(&answer[1], AnswerSize - 3) != crc)
+            {
+                return false;
+            }
+
+            HasDescriptor = answer[2] & 1;
+            Verified = answer[2] & 2;
+            memcpy(&Size, &answer[3], sizeof(Size));
+            memcpy(&Crc, &answer[7], sizeof(Crc));
+            memcpy(&Version, &answer[11], sizeof(Version));
+            memcpy(&BootMicros, &answer[15], sizeof(BootMicros));
+            return true;
+        }
+};
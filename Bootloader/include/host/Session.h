@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "ymodem.h"
+#include "host/SimulatedFlash.h"
+#include "host/SimulatedLink.h"
+#include "host/VirtualClock.h"
+#include "host/YModemSender.h"
+#if defined(YMODEM_TRACE)
+#include "host/TraceQuery.h"
+#include "host/TraceReplay.h"
+#endif
+
+/// @brief The bootloader as built for the target, on the simulated link and flash.
+using Receiver = YModem<SimulatedLink, SimulatedFlash>;
+
+/// @brief A build that only takes 128 byte packets.
+using SmallReceiver = YModem<SimulatedLink, SimulatedFlash, PACKET_SIZE>;
+
+/// @brief A build that also takes extended frames up to 8K.
+using FrameReceiver = YModem<SimulatedLink, SimulatedFlash, PACKET_MAX_FRAME_SIZE>;
+
+#if defined(YMODEM_TRACE)
+/// @brief A build recording its sessions with `Trace`, like the target's trace build.
+template <uint16_t MaxPacketSize = PACKET_1K_SIZE>
+using TracedReceiver = YModem<TracedTransport<SimulatedLink>, SimulatedFlash, MaxPacketSize>;
+#endif
+
+/// @brief Fills the descriptor log with records of earlier updates.
+inline void FillDescriptorLog(SimulatedFlash& flash)
+{
+    for (uint8_t slot = 0; slot < ImageDescriptor::SlotCount; slot++)
+    {
+        ImageRecord record = ImageDescriptor::Make(1024 * (slot + 1), slot, slot);
+        memcpy(flash.At(ImageDescriptor::SlotAddress(slot)), &record, sizeof(record));
+    }
+}
+
+/// @brief Runs one session on a link that may have carried earlier ones.
+/// @tparam TReceiver The build of the bootloader to run.
+template <typename TReceiver = Receiver>
+ReceiveFileResult RunSession(VirtualClock& clock, SimulatedLink& link, SimulatedFlash& flash, YModemSender& sender)
+{
+    TReceiver::Init(&link, &clock, &flash);
+    link.Connect(&sender);
+
+    int32_t fileSize = 0;
+    auto result = TReceiver::ReceiveFile(&fileSize);
+
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    return result;
+}
+
+#if defined(YMODEM_TRACE)
+/// @brief  Replays the session of a trace on a virtual clock started with it and takes the trace of the replay.
+/// @tparam MaxPacketSize The build of the bootloader to replay on, the one the trace was taken with.
+/// @param latencyNanos The latency of the traced link, the host sends each record that much before it arrived.
+/// @param prepare Puts what the flash held at the start of the traced session into the simulated flash.
+template <uint16_t MaxPacketSize, typename Prepare>
+TraceLog ReplayTrace(const TraceLog& log, uint64_t latencyNanos, Prepare prepare)
+{
+    VirtualClock clock;
+    SimulatedLink link(clock);
+    TracedTransport<SimulatedLink> traced(link);
+    link.LatencyNanos = latencyNanos;
+    link.UsbPacketSize = UINT16_MAX;
+    SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+    prepare(flash);
+
+    TraceReplayer replayer(clock, log);
+    Trace::Start(&clock);
+    TracedReceiver<MaxPacketSize>::Init(&traced, &clock, &flash);
+    link.Connect(&replayer);
+
+    int32_t fileSize = 0;
+    TracedReceiver<MaxPacketSize>::ReceiveFile(&fileSize);
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    TraceQuery query;
+    link.Connect(&query);
+    TracedReceiver<MaxPacketSize>::ServeCommands(100);
+    Trace::Stop();
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    query.Decode();
+    return query.Log;
+}
+#endif
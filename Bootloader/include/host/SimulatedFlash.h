@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "FlashBackend.h"
+#include "Hardware.h"
+#include "host/VirtualClock.h"
+
+/// @brief  Host stand-in for the STM32 flash. Keeps the contents in memory and stays busy for a configurable time
+///         of virtual time after each operation, so code driving it sees realistic program and erase latencies. The
+///         timing model also covers the parallelism and how the words are fed to the flash, see `PollLatencyNanos`
+///         and `BurstWords`.
+class SimulatedFlash final : public FlashBackend, public SimulatedDevice {
+    private:
+        VirtualClock& clock;
+        uint32_t baseAddress;
+        std::vector<uint8_t> memory;
+        uint64_t busyUntil = 0;
+        bool locked = true;
+        bool error = false;
+
+        void BeBusy(uint64_t nanos)
+        {
+            busyUntil = clock.Nanos() + nanos;
+            BusyNanos += nanos;
+        }
+
+        /// @brief The time a word takes, in as many operations as the parallelism needs.
+        uint64_t WordNanos() const
+        {
+            return ProgramNanos * (32 / Parallelism);
+        }
+
+        /// @brief Changes the contents like programming a word does.
+        /// @return False if the word may not be programmed.
+        bool Program(uint32_t address, uint32_t word)
+        {
+            if (locked || (address & 3) || address < baseAddress || address + 4 > baseAddress + memory.size())
+            {
+                error = true;
+                return false;
+            }
+
+            // Like the real flash, programming can only clear bits
+            uint32_t current;
+            memcpy(&current, At(address), sizeof(current));
+            uint32_t cleared = current & ~word;
+            if (address == WeakAddress && WeakWrites > 0 && cleared != 0)
+            {
+                word |= cleared & (0 - cleared);
+                WeakWrites--;
+            }
+            current &= word;
+            memcpy(At(address), &current, sizeof(current));
+
+            WordsProgrammed++;
+            return true;
+        }
+
+    public:
+        /// @brief  Time a single program operation takes, 16us is the typical figure of the STM32F401 datasheet. A
+        ///         word takes one with x32 parallelism, two with x16 and four with x8.
+        uint64_t ProgramNanos = Hardware::WordProgramMicros * 1000;
+
+        /// @brief The program and erase parallelism in bits, 8, 16 or 32. Erase times follow `Hardware::SectorEraseMillis`.
+        uint8_t Parallelism = Hardware::ProgramParallelism;
+
+        /// @brief  The time from the end of a program operation until the caller starts the next one, a round trip
+        ///         through its main loop in flash. Charged once per `BeginProgramWord` or `ProgramWords`, the words
+        ///         within a burst follow each other right away. None by default.
+        uint64_t PollLatencyNanos = 0;
+
+        /// @brief  The most words `ProgramWords` takes in one go, with the CPU held until the last one starts, like
+        ///         the RAM-resident loop of the target. 1 by default, a word per call.
+        uint16_t BurstWords = 1;
+
+        /// @brief Scales the typical sector erase times of `Hardware::SectorEraseMillis`, in percent.
+        uint32_t EraseLatencyPercent = 100;
+
+        /// @brief  A word that does not take its data, like a worn out cell: programming it leaves the lowest bit
+        ///         that should be cleared set, the next `WeakWrites` times. None if 0.
+        uint32_t WeakAddress = 0;
+        uint32_t WeakWrites = 0;
+
+        /// @brief The amount of words programmed so far.
+        uint32_t WordsProgrammed = 0;
+
+        /// @brief The amount of sectors erased so far.
+        uint32_t SectorsErased = 0;
+
+        /// @brief The time spent busy with operations in nanoseconds.
+        uint64_t BusyNanos = 0;
+
+        /// @param clock The clock operations take their time on.
+        /// @param baseAddress The absolute address of the first byte of the simulated flash.
+        /// @param size The size of the simulated flash in bytes.
+        SimulatedFlash(VirtualClock& clock, uint32_t baseAddress, uint32_t size)
+            : clock(clock), baseAddress(baseAddress), memory(size, 0xFF)
+        {
+            clock.Attach(this);
+        }
+
+        uint64_t NextEventNanos() override
+        {
+            return busyUntil > clock.Nanos() ? busyUntil : NoEvent;
+        }
+
+        /// @brief Direct access to the simulated contents at an absolute address.
+        uint8_t* At(uint32_t address)
+        {
+            return &memory[address - baseAddress];
+        }
+
+        void Unlock() override
+        {
+            locked = false;
+        }
+
+        void Lock() override
+        {
+            locked = true;
+        }
+
+        FlashStatus GetStatus() override
+        {
+            if (clock.Nanos() < busyUntil)
+            {
+                return FlashStatus::Busy;
+            }
+
+            return error ? FlashStatus::Error : FlashStatus::Ready;
+        }
+
+        void ClearError() override
+        {
+            error = false;
+        }
+
+        void BeginProgramWord(uint32_t address, uint32_t word) override
+        {
+            if (Program(address, word))
+            {
+                BeBusy(WordNanos());
+                busyUntil += PollLatencyNanos;
+            }
+        }
+
+        uint16_t ProgramWords(uint32_t address, const uint8_t* data, uint16_t count) override
+        {
+            uint16_t burst = count < BurstWords ? count : BurstWords;
+
+            for (uint16_t i = 0; i < burst; i++)
+            {
+                // The CPU waits for every word but the last one
+                if (i > 0)
+                {
+                    clock.Advance(WordNanos());
+                    BusyNanos += WordNanos();
+                }
+
+                uint32_t word;
+                memcpy(&word, &data[i * 4], sizeof(word));
+                if (Program(address + i * 4, word) == false)
+                {
+                    return i;
+                }
+            }
+
+            BeBusy(WordNanos());
+            busyUntil += PollLatencyNanos;
+            return burst;
+        }
+
+        void BeginEraseSector(uint8_t sector) override
+        {
+            uint32_t start = Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector];
+            uint32_t size = Hardware::SectorOffsets[sector + 1] - Hardware::SectorOffsets[sector];
+
+            if (locked || sector >= Hardware::SectorCount || start < baseAddress || start + size > baseAddress + memory.size())
+            {
+                error = true;
+                return;
+            }
+
+            memset(At(start), 0xFF, size);
+
+            SectorsErased++;
+            BeBusy((uint64_t)Hardware::SectorEraseMillis(sector, Parallelism) * 10000 * EraseLatencyPercent);
+        }
+
+        uint32_t ReadWord(uint32_t address) override
+        {
+            uint32_t word;
+            memcpy(&word, At(address), sizeof(word));
+            return word;
+        }
+
+        uint32_t BlankCheck(uint32_t address, uint32_t end) override
+        {
+            for (; address < end; address += 4)
+            {
+                if (ReadWord(address) != 0xFFFFFFFF)
+                {
+                    break;
+                }
+            }
+
+            return address;
+        }
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "Transport.h"
+#include "host/VirtualClock.h"
+
+class SimulatedLink;
+
+/// @brief  Faults injected into the data of both directions. They come from a seeded generator, so every run of a
+///         scenario hits the same bytes.
+struct LinkFaults {
+    /// @brief The probability of a byte getting lost.
+    double DropRate = 0;
+
+    /// @brief The probability of a byte arriving with one bit flipped.
+    double FlipRate = 0;
+
+    /// @brief The probability of a transfer being held up by `DelayNanos`, like a stalled host.
+    double DelayRate = 0;
+    uint64_t DelayNanos = 0;
+
+    uint32_t Seed = 1;
+};
+
+/// @brief The host end of a simulated link, e.g. a YModem sender.
+class HostPeer {
+    public:
+        /// @brief Called when the link comes up.
+        /// @param now The virtual time in nanoseconds.
+        virtual void Start(SimulatedLink& link, uint64_t now) = 0;
+
+        /// @brief Called with data the device has written, once it has reached the host.
+        /// @param now The virtual time of the arrival in nanoseconds, replies are sent from then on.
+        virtual void Receive(SimulatedLink& link, const uint8_t* data, uint16_t length, uint64_t now) = 0;
+};
+
+/// @brief  Host stand-in for the USB CDC link. Data of the host arrives after a latency, at the link's bandwidth and
+///         in whole USB packets, the way a full speed bulk endpoint hands it over. Data of the device reaches the host
+///         peer after the same latency, its reaction is timed from the arrival, however late the link is polled.
+class SimulatedLink final : public Transport, public SimulatedDevice {
+    private:
+        struct Transfer {
+            uint64_t Start;
+            std::vector<uint8_t> Data;
+            size_t Consumed;
+        };
+
+        struct Delivery {
+            uint64_t Time;
+            std::vector<uint8_t> Data;
+        };
+
+        VirtualClock& clock;
+        HostPeer* peer = nullptr;
+        std::deque<Transfer> toDevice;
+        std::deque<Delivery> toHost;
+
+        /// @brief  The amount of transfers at the front of `toDevice` that have completely arrived, and their unread
+        ///         bytes. Keeps polling cheap while the host is far ahead, as in YModem-G.
+        size_t arrivedTransfers = 0;
+        uint64_t arrivedUnread = 0;
+
+        /// @brief The time each side is done sending the data it has been given so far.
+        uint64_t hostBusyUntil = 0;
+        uint64_t deviceBusyUntil = 0;
+
+        std::mt19937 random;
+        std::uniform_real_distribution<double> chance { 0.0, 1.0 };
+
+        /// @brief Applies the faults to data handed to the link.
+        /// @return The extra time the data is held up by, in nanoseconds.
+        uint64_t InjectFaults(std::vector<uint8_t>& data)
+        {
+            if (Faults.DropRate > 0 || Faults.FlipRate > 0)
+            {
+                size_t kept = 0;
+                for (size_t i = 0; i < data.size(); i++)
+                {
+                    if (Faults.DropRate > 0 && chance(random) < Faults.DropRate)
+                    {
+                        BytesDropped++;
+                        continue;
+                    }
+
+                    data[kept] = data[i];
+                    if (Faults.FlipRate > 0 && chance(random) < Faults.FlipRate)
+                    {
+                        data[kept] ^= (uint8_t)(1 << (random() % 8));
+                        BitsFlipped++;
+                    }
+                    kept++;
+                }
+                data.resize(kept);
+            }
+
+            if (Faults.DelayRate > 0 && chance(random) < Faults.DelayRate)
+            {
+                TransfersDelayed++;
+                return Faults.DelayNanos;
+            }
+
+            return 0;
+        }
+
+        uint64_t TransferNanos(uint64_t bytes) const
+        {
+            return (bytes * 1000000000 + BytesPerSecond - 1) / BytesPerSecond;
+        }
+
+        /// @return How many bytes of a transfer have arrived by now.
+        size_t Arrived(const Transfer& transfer) const
+        {
+            if (clock.Nanos() < transfer.Start)
+            {
+                return 0;
+            }
+
+            uint64_t bytes = (clock.Nanos() - transfer.Start) * BytesPerSecond / 1000000000;
+            if (bytes >= transfer.Data.size())
+            {
+                return transfer.Data.size();
+            }
+
+            return bytes - bytes % UsbPacketSize;
+        }
+
+        void CountArrivedTransfers()
+        {
+            while (arrivedTransfers < toDevice.size() && Arrived(toDevice[arrivedTransfers]) == toDevice[arrivedTransfers].Data.size())
+            {
+                arrivedUnread += toDevice[arrivedTransfers].Data.size() - toDevice[arrivedTransfers].Consumed;
+                arrivedTransfers++;
+            }
+        }
+
+        /// @brief Hands the data of the device that has reached the host by now to the peer.
+        void Pump()
+        {
+            while (toHost.empty() == false && toHost.front().Time <= clock.Nanos())
+            {
+                Delivery delivery = std::move(toHost.front());
+                toHost.pop_front();
+
+                if (peer != nullptr)
+                {
+                    peer->Receive(*this, delivery.Data.data(), (uint16_t)delivery.Data.size(), delivery.Time);
+                }
+            }
+        }
+
+    public:
+        /// @brief The one way latency in nanoseconds, from handing data over to it being readable on the other end.
+        uint64_t LatencyNanos = 500000;
+
+        /// @brief The payload bandwidth, USB full speed bulk transfers reach about 1MB/s.
+        uint32_t BytesPerSecond = 1000000;
+
+        /// @brief The size of the USB packets the host data is delivered in.
+        uint16_t UsbPacketSize = 64;
+
+        /// @brief  The time each write of the device takes on top of its bytes, e.g. until the host polls for the next
+        ///         IN transfer. None by default.
+        uint64_t WriteOverheadNanos = 0;
+
+        uint64_t BytesToDevice = 0;
+        uint64_t BytesToHost = 0;
+        uint32_t WritesToHost = 0;
+
+        /// @brief The faults injected so far, see `SetFaults`.
+        LinkFaults Faults;
+        uint64_t BytesDropped = 0;
+        uint64_t BitsFlipped = 0;
+        uint32_t TransfersDelayed = 0;
+
+        SimulatedLink(VirtualClock& clock)
+            : clock(clock)
+        {
+            clock.Attach(this);
+        }
+
+        /// @brief Starts injecting faults into everything sent from now on, none by default.
+        void SetFaults(const LinkFaults& faults)
+        {
+            Faults = faults;
+            random.seed(faults.Seed);
+        }
+
+        /// @brief Attaches the host end and lets it start.
+        void Connect(HostPeer* hostPeer)
+        {
+            peer = hostPeer;
+            peer->Start(*this, clock.Nanos());
+        }
+
+        /// @brief Sends data of the host to the device.
+        /// @param now The virtual time the host sends at, in nanoseconds.
+        /// @return The time the last byte arrives at the device.
+        uint64_t SendToDevice(const uint8_t* data, size_t length, uint64_t now)
+        {
+            std::vector<uint8_t> sent(data, data + length);
+            uint64_t start = std::max(now, hostBusyUntil) + InjectFaults(sent);
+            hostBusyUntil = start + TransferNanos(sent.size());
+
+            toDevice.push_back({ start + LatencyNanos, std::move(sent), 0 });
+            BytesToDevice += length;
+            return hostBusyUntil + LatencyNanos;
+        }
+
+        uint64_t NextEventNanos() override
+        {
+            Pump();
+
+            uint64_t next = NoEvent;
+
+            if (toHost.empty() == false)
+            {
+                next = toHost.front().Time;
+            }
+
+            CountArrivedTransfers();
+            if (arrivedTransfers < toDevice.size())
+            {
+                const Transfer& transfer = toDevice[arrivedTransfers];
+                size_t nextPacket = std::min(Arrived(transfer) + UsbPacketSize, transfer.Data.size());
+                next = std::min(next, transfer.Start + TransferNanos(nextPacket));
+            }
+
+            return next;
+        }
+
+        void Begin() override
+        {
+        }
+
+        void End() override
+        {
+        }
+
+        uint32_t Available() override
+        {
+            Pump();
+            CountArrivedTransfers();
+
+            uint64_t available = arrivedUnread;
+            if (arrivedTransfers < toDevice.size())
+            {
+                available += Arrived(toDevice[arrivedTransfers]) - toDevice[arrivedTransfers].Consumed;
+            }
+
+            return (uint32_t)std::min(available, (uint64_t)UINT32_MAX);
+        }
+
+        uint16_t Read(uint8_t* data, uint16_t length) override
+        {
+            Pump();
+            CountArrivedTransfers();
+
+            uint16_t read = 0;
+            while (read < length && toDevice.empty() == false)
+            {
+                Transfer& transfer = toDevice.front();
+                size_t chunk = std::min((size_t)(length - read), Arrived(transfer) - transfer.Consumed);
+
+                memcpy(&data[read], &transfer.Data[transfer.Consumed], chunk);
+                transfer.Consumed += chunk;
+                read += chunk;
+
+                if (arrivedTransfers > 0)
+                {
+                    arrivedUnread -= chunk;
+                }
+
+                if (transfer.Consumed < transfer.Data.size())
+                {
+                    break;
+                }
+
+                toDevice.pop_front();
+                arrivedTransfers--;
+            }
+
+            return read;
+        }
+
+        void Write(const uint8_t* data, uint16_t length) override
+        {
+            std::vector<uint8_t> sent(data, data + length);
+            uint64_t start = std::max(clock.Nanos(), deviceBusyUntil) + InjectFaults(sent);
+            deviceBusyUntil = start + WriteOverheadNanos + TransferNanos(sent.size());
+
+            toHost.push_back({ deviceBusyUntil + LatencyNanos, std::move(sent) });
+            BytesToHost += length;
+            WritesToHost++;
+        }
+
+        void Flush() override
+        {
+        }
+};
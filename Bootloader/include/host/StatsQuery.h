@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Crc16.h"
+#include "FlashWriter.h"
+#include "Profiler.h"
+#include "ymodem.h"
+#include "host/SimulatedLink.h"
+
+/// @brief Host peer that sends the `STATS` command and decodes the answer, like the uploader's `--stats`.
+class StatsQuery : public HostPeer {
+    private:
+        std::vector<uint8_t> answer;
+
+        template <typename T>
+        static T Take(const uint8_t*& data)
+        {
+            T value;
+            memcpy(&value, data, sizeof(value));
+            data += sizeof(value);
+            return value;
+        }
+
+    public:
+        static constexpr const char* PhaseNames[] = { "protocol", "receive", "crc", "flash", "decompress", "erase", "program", "ack", "verify" };
+
+        /// @brief The size of the sector statistics in the answer.
+        static const size_t FlashStatsSize = 5 + 3 * 4;
+
+        uint32_t TicksPerSecond = 0;
+        FlashWriterStats Flash = {};
+        std::vector<PhaseStats> Phases;
+
+        void Start(SimulatedLink& link, uint64_t now) override
+        {
+            uint8_t command = STATS;
+            link.SendToDevice(&command, 1, now);
+        }
+
+        void Receive(SimulatedLink&, const uint8_t* data, uint16_t length, uint64_t) override
+        {
+            answer.insert(answer.end(), data, data + length);
+        }
+
+        /// @brief Decodes the answer received so far.
+        /// @return False if it is incomplete or corrupted.
+        bool Decode()
+        {
+            if (answer.size() < 10 + FlashStatsSize || answer[0] != STATS || answer[1] != STATS_VERSION)
+            {
+                return false;
+            }
+
+            uint8_t phaseCount = answer[2];
+            uint8_t bucketCount = answer[3];
+            size_t phaseSize = 20 + bucketCount * 4;
+            size_t size = 8 + FlashStatsSize + phaseCount * phaseSize + 2;
+            if (answer.size() < size || bucketCount != PhaseStats::BucketCount)
+            {
+                return false;
+            }
+
+            uint16_t crc = (uint16_t)(answer[size - 2] << 8 | answer[size - 1]);
+            if (Crc16::ComputeBitwise(&answer[1], size - 3) != crc)
+            {
+                return false;
+            }
+
+            const uint8_t* cursor = &answer[4];
+            TicksPerSecond = Take<uint32_t>(cursor);
+            Flash.SectorsErased = Take<uint8_t>(cursor);
+            Flash.SectorsSkipped = Take<uint8_t>(cursor);
+            Flash.SectorsUnchanged = Take<uint8_t>(cursor);
+            Flash.SectorsVerified = Take<uint8_t>(cursor);
+            Flash.SectorsMismatched = Take<uint8_t>(cursor);
+            Flash.WordsUnchanged = Take<uint32_t>(cursor);
+            Flash.WordsErased = Take<uint32_t>(cursor);
+            Flash.MillisSaved = Take<uint32_t>(cursor);
+            Phases.resize(phaseCount);
+            for (PhaseStats& stats : Phases)
+            {
+                stats.Count = Take<uint32_t>(cursor);
+                stats.Min = Take<uint32_t>(cursor);
+                stats.Max = Take<uint32_t>(cursor);
+                stats.Total = Take<uint64_t>(cursor);
+                for (uint32_t& bucket : stats.Buckets)
+                {
+                    bucket = Take<uint32_t>(cursor);
+                }
+            }
+
+            return true;
+        }
+
+        void Print() const
+        {
+            printf("sectors erased %u, blank %u, unchanged %u, verified %u, mismatched %u\n", Flash.SectorsErased,
+                Flash.SectorsSkipped, Flash.SectorsUnchanged, Flash.SectorsVerified, Flash.SectorsMismatched);
+            printf("words unchanged %u, erased value %u, flash time saved %u ms\n", Flash.WordsUnchanged, Flash.WordsErased,
+                Flash.MillisSaved);
+
+            if (Phases.empty())
+            {
+                return;
+            }
+
+            double microsPerTick = 1e6 / TicksPerSecond;
+
+            printf("%-10s %9s %10s %10s %10s  %s\n", "phase", "count", "min us", "mean us", "max us", "histogram (up to us: count)");
+            for (size_t phase = 0; phase < Phases.size(); phase++)
+            {
+                const PhaseStats& stats = Phases[phase];
+                if (stats.Count == 0)
+                {
+                    continue;
+                }
+
+                printf("%-10s %9u %10.2f %10.2f %10.2f ",
+                    phase < sizeof(PhaseNames) / sizeof(PhaseNames[0]) ? PhaseNames[phase] : "?",
+                    stats.Count,
+                    stats.Min * microsPerTick,
+                    (double)stats.Total / stats.Count * microsPerTick,
+                    stats.Max * microsPerTick);
+
+                for (uint8_t bucket = 0; bucket < PhaseStats::BucketCount; bucket++)
+                {
+                    if (stats.Buckets[bucket] > 0)
+                    {
+                        printf(" %g:%u", (double)(2ULL << bucket) * microsPerTick, stats.Buckets[bucket]);
+                    }
+                }
+                printf("\n");
+            }
+        }
+};
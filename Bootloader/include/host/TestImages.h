@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/// @brief A pseudo random image, the same for the same seed.
+inline std::vector<uint8_t> RandomImage(uint32_t size, uint32_t seed)
+{
+    std::vector<uint8_t> image(size);
+    for (uint32_t i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        image[i] = (uint8_t)(seed >> 16);
+    }
+
+    return image;
+}
+
+/// @brief  Something like a Cortex-M firmware image: vector table, Thumb code with literal pools, strings and
+///         tables, and runs of erased padding between the sections.
+inline std::vector<uint8_t> FirmwareImage(uint32_t size, uint32_t seed)
+{
+    auto next = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+
+    std::vector<uint8_t> image;
+    auto word = [&image](uint32_t value) {
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            image.push_back((uint8_t)(value >> (i * 8)));
+        }
+    };
+    auto half = [&image](uint16_t value) {
+        image.push_back((uint8_t)value);
+        image.push_back((uint8_t)(value >> 8));
+    };
+
+    // Vector table, most handlers are the default one
+    word(0x20010000);
+    for (uint8_t i = 1; i < 98; i++)
+    {
+        word(next(4) == 0 ? 0x0800C000 + next(0x8000) * 2 + 1 : 0x0800C1F5);
+    }
+
+    static const char* const words[] = { "error", "timeout", "sensor", "heater", "fan", "temp", "adc", "init", "failed", "%d", "%s", "ok", "\n" };
+    static const uint16_t opcodes[] = { 0xB580, 0xBD80, 0x4608, 0x6800, 0x6008, 0x2000, 0x2101, 0x4770, 0xE7FE, 0xD100, 0x3001, 0x4288, 0xF000 };
+
+    while (image.size() < size)
+    {
+        switch (next(10))
+        {
+            // Functions: prologue, a body from a small instruction vocabulary, epilogue and a literal pool
+            case 0: case 1: case 2: case 3: case 4: case 5:
+            {
+                half(0xB500 | (uint16_t)next(256));
+                for (uint32_t i = 0, length = 8 + next(120); i < length; i++)
+                {
+                    uint16_t opcode = opcodes[next(sizeof(opcodes) / sizeof(opcodes[0]))];
+                    if (opcode == 0xF000)
+                    {
+                        half(0xF000 | (uint16_t)next(0x800));
+                        half(0xF800 | (uint16_t)next(0x800));
+                    }
+                    else
+                    {
+                        half(opcode | (uint16_t)(next(4) == 0 ? next(8) : 0));
+                    }
+                }
+                half(0xBD00 | (uint16_t)next(256));
+                for (uint32_t i = 0, length = next(6); i < length; i++)
+                {
+                    word((next(2) ? 0x08000000 : 0x20000000) + next(0x10000) * 4);
+                }
+                break;
+            }
+
+            // Strings
+            case 6: case 7:
+                for (uint32_t i = 0, length = 2 + next(8); i < length; i++)
+                {
+                    const char* text = words[next(sizeof(words) / sizeof(words[0]))];
+                    image.insert(image.end(), text, text + strlen(text));
+                    image.push_back(next(3) ? ' ' : '\0');
+                }
+                break;
+
+            // Lookup tables and zero initialized data
+            case 8:
+                for (uint32_t i = 0, length = 16 + next(64); i < length; i++)
+                {
+                    half(next(3) ? 0 : (uint16_t)(i * 37 + next(16)));
+                }
+                break;
+
+            // Padding up to the next 4K boundary
+            default:
+                if (next(4) == 0)
+                {
+                    image.resize((image.size() + 4096) & ~(size_t)4095, 0xFF);
+                }
+                break;
+        }
+    }
+
+    image.resize(size);
+    return image;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "Crc16.h"
+#include "Trace.h"
+#include "ymodem.h"
+#include "host/SimulatedLink.h"
+
+/// @brief A record of a trace with its time made absolute, in microseconds since the ring was cleared.
+struct TraceRecord {
+    TraceKind Kind;
+    uint64_t Micros;
+    std::vector<uint8_t> Data;
+
+    TraceState State() const
+    {
+        return (TraceState)Data[0];
+    }
+
+    /// @return The value of a `TraceKind::State` record.
+    uint32_t Value() const
+    {
+        uint32_t value = 0;
+        for (size_t i = 1; i < Data.size() && i < 6; i++)
+        {
+            value |= (uint32_t)(Data[i] & 0x7F) << (7 * (i - 1));
+        }
+
+        return value;
+    }
+};
+
+/// @brief A trace as the `TRACE` command answers it, which is also the format of the uploader's --trace files.
+class TraceLog {
+    public:
+        static constexpr const char* StateNames[] = { "session", "header", "packet error", "eot", "rewind", "end" };
+
+        uint32_t Dropped = 0;
+        std::vector<TraceRecord> Records;
+
+        /// @brief Decodes a whole answer, from the 'T' to the CRC16.
+        /// @return False if it is incomplete or corrupted.
+        bool Decode(const std::vector<uint8_t>& answer)
+        {
+            if (answer.size() < 12 || answer[0] != TRACE || answer[1] != TRACE_VERSION)
+            {
+                return false;
+            }
+
+            uint32_t length;
+            memcpy(&Dropped, &answer[2], sizeof(Dropped));
+            memcpy(&length, &answer[6], sizeof(length));
+            size_t size = 10 + (size_t)length + 2;
+            if (answer.size() < size)
+            {
+                return false;
+            }
+
+            uint16_t crc = (uint16_t)(answer[size - 2] << 8 | answer[size - 1]);
+            if (Crc16::ComputeBitwise(&answer[1], size - 3) != crc)
+            {
+                return false;
+            }
+
+            return Parse(&answer[10], length);
+        }
+
+        /// @brief Decodes the records of a trace, oldest first.
+        /// @return False if the last record is cut off or one has an unknown kind.
+        bool Parse(const uint8_t* data, size_t length)
+        {
+            Records.clear();
+            uint64_t micros = 0;
+            size_t position = 0;
+
+            while (position < length)
+            {
+                TraceRecord record;
+                record.Kind = (TraceKind)data[position++];
+                if (record.Kind > TraceKind::State)
+                {
+                    return false;
+                }
+
+                uint32_t delta = 0;
+                uint8_t shift = 0;
+                uint8_t byte;
+                do
+                {
+                    if (position >= length || shift > 28)
+                    {
+                        return false;
+                    }
+                    byte = data[position++];
+                    delta |= (uint32_t)(byte & 0x7F) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+
+                if (position >= length || position + 1 + data[position] > length)
+                {
+                    return false;
+                }
+                uint8_t size = data[position++];
+
+                micros += delta;
+                record.Micros = micros;
+                record.Data.assign(&data[position], &data[position] + size);
+                position += size;
+
+                if (record.Kind == TraceKind::State && record.Data.empty())
+                {
+                    return false;
+                }
+                Records.push_back(std::move(record));
+            }
+
+            return true;
+        }
+
+        /// @return The records of the first session in the trace, up to and including the end of it.
+        std::vector<TraceRecord> Session() const
+        {
+            std::vector<TraceRecord> session;
+            for (const TraceRecord& record : Records)
+            {
+                session.push_back(record);
+                if (record.Kind == TraceKind::State && record.State() == TraceState::End)
+                {
+                    break;
+                }
+            }
+
+            return session;
+        }
+
+        /// @return Whether the trace holds a whole session: nothing dropped, from its start to its end.
+        bool IsComplete() const
+        {
+            std::vector<TraceRecord> session = Session();
+            return Dropped == 0
+                && session.empty() == false
+                && session.front().Kind == TraceKind::State && session.front().State() == TraceState::Session
+                && session.back().Kind == TraceKind::State && session.back().State() == TraceState::End;
+        }
+
+        /// @return The amount of bytes of one direction in the session.
+        uint64_t Bytes(TraceKind kind) const
+        {
+            uint64_t bytes = 0;
+            for (const TraceRecord& record : Session())
+            {
+                bytes += record.Kind == kind ? record.Data.size() : 0;
+            }
+
+            return bytes;
+        }
+
+        /// @brief Prints the protocol decisions of the session with their times.
+        void PrintStates() const
+        {
+            for (const TraceRecord& record : Session())
+            {
+                if (record.Kind == TraceKind::State)
+                {
+                    uint8_t state = (uint8_t)record.State();
+                    printf("%12.3f ms  %-12s %u\n", record.Micros / 1e3,
+                        state < sizeof(StateNames) / sizeof(StateNames[0]) ? StateNames[state] : "?", record.Value());
+                }
+            }
+        }
+};
+
+/// @brief  Host peer that sends the `TRACE` command and decodes the answer, like the uploader's --trace. The raw
+///         answer is what the uploader saves.
+class TraceQuery : public HostPeer {
+    public:
+        std::vector<uint8_t> Answer;
+        TraceLog Log;
+
+        void Start(SimulatedLink& link, uint64_t now) override
+        {
+            uint8_t command = TRACE;
+            link.SendToDevice(&command, 1, now);
+        }
+
+        void Receive(SimulatedLink&, const uint8_t* data, uint16_t length, uint64_t) override
+        {
+            Answer.insert(Answer.end(), data, data + length);
+        }
+
+        /// @brief Decodes the answer received so far.
+        /// @return False if it is incomplete or corrupted.
+        bool Decode()
+        {
+            return Log.Decode(Answer);
+        }
+};
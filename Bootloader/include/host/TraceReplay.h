@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+#include "host/SimulatedLink.h"
+#include "host/TraceQuery.h"
+
+/// @brief  Host peer that plays the host's side of a traced session back: every byte the device read is sent so it
+///         arrives at the time it was read. Run against a traced build on a virtual clock started with the session,
+///         the device reads the same bytes at the same times and takes the same decisions, unless the flash or the
+///         code behave differently than when the trace was taken.
+///
+///         The traced host could not send a reply before it had received what the device sent up to then, and time
+///         did not jump ahead to that reply either. So each record waits for the device's data the host had when it
+///         must have sent it, given the link's latency and bandwidth, and a device waiting for a reply runs into its
+///         timeouts as it did when the trace was taken. The link has to hand over whole transfers, with a
+///         `UsbPacketSize` larger than any of them, or the device reads the start of a record early.
+class TraceReplayer : public HostPeer, public SimulatedDevice {
+    private:
+        /// @brief The bytes the device read at one time.
+        struct Pending {
+            uint64_t SendAt;
+
+            /// @brief The amount of bytes of the device the traced host had received before sending them.
+            uint64_t After;
+            std::vector<uint8_t> Data;
+        };
+
+        VirtualClock& clock;
+        SimulatedLink* link = nullptr;
+        std::vector<TraceRecord> session;
+        std::vector<Pending> pending;
+        size_t next = 0;
+        uint64_t received = 0;
+
+        /// @brief Hands the records due by now to the link.
+        void Send(uint64_t now)
+        {
+            for (; next < pending.size() && pending[next].After <= received && pending[next].SendAt <= now; next++)
+            {
+                link->SendToDevice(pending[next].Data.data(), pending[next].Data.size(), pending[next].SendAt);
+            }
+        }
+
+    public:
+        /// @param clock The clock of the replay, started with the session.
+        TraceReplayer(VirtualClock& clock, const TraceLog& log)
+            : clock(clock), session(log.Session())
+        {
+            clock.Attach(this);
+        }
+
+        uint64_t NextEventNanos() override
+        {
+            if (link == nullptr)
+            {
+                return NoEvent;
+            }
+
+            Send(clock.Nanos());
+            if (next == pending.size() || pending[next].After > received)
+            {
+                return NoEvent;
+            }
+
+            return pending[next].SendAt;
+        }
+
+        void Start(SimulatedLink& link, uint64_t now) override
+        {
+            this->link = &link;
+
+            // Reads of the same microsecond arrive together
+            std::vector<std::pair<uint64_t, std::vector<uint8_t>>> arrivals;
+            for (const TraceRecord& record : session)
+            {
+                if (record.Kind == TraceKind::In)
+                {
+                    uint64_t arrival = now + record.Micros * 1000;
+                    if (arrivals.empty() || arrivals.back().first != arrival)
+                    {
+                        arrivals.push_back({ arrival, {} });
+                    }
+                    arrivals.back().second.insert(arrivals.back().second.end(), record.Data.begin(), record.Data.end());
+                }
+            }
+
+            // The host sends one transfer after the other, and has the device's data once it has crossed the link
+            pending.clear();
+            next = 0;
+            received = 0;
+            uint64_t sendAt = now;
+            uint64_t after = 0;
+            size_t record = 0;
+            for (auto& arrival : arrivals)
+            {
+                uint64_t transfer = link.LatencyNanos + (arrival.second.size() * 1000000000 + link.BytesPerSecond - 1) / link.BytesPerSecond;
+                sendAt = std::max(sendAt, arrival.first > now + transfer ? arrival.first - transfer : now);
+
+                for (; record < session.size() && now + session[record].Micros * 1000 + link.LatencyNanos <= sendAt; record++)
+                {
+                    after += session[record].Kind == TraceKind::Out ? session[record].Data.size() : 0;
+                }
+                pending.push_back({ sendAt, after, std::move(arrival.second) });
+            }
+
+            Send(now);
+        }
+
+        void Receive(SimulatedLink&, const uint8_t*, uint16_t length, uint64_t now) override
+        {
+            received += length;
+            Send(now);
+        }
+};
+
+/// @brief How the trace of a replay compares to the trace it replayed.
+struct TraceComparison {
+    /// @brief Whether the device sent the same bytes, and the offset of the first that differs if not.
+    bool OutputMatches = false;
+    uint64_t FirstDifference = 0;
+
+    /// @brief Whether the protocol took the same decisions with the same values.
+    bool StatesMatch = false;
+
+    /// @brief The largest difference in the time a byte was sent or a decision was taken, in microseconds.
+    uint64_t MaxDeviationMicros = 0;
+
+    bool Matches() const
+    {
+        return OutputMatches && StatesMatch;
+    }
+
+    /// @brief Compares the sessions of two traces.
+    static TraceComparison Compare(const TraceLog& expected, const TraceLog& actual)
+    {
+        struct Flat {
+            std::vector<uint8_t> Output;
+
+            /// @brief The offset into `Output` each write starts at, and its time.
+            std::vector<std::pair<uint64_t, uint64_t>> Writes;
+            std::vector<const TraceRecord*> States;
+        };
+
+        std::vector<TraceRecord> expectedSession = expected.Session();
+        std::vector<TraceRecord> actualSession = actual.Session();
+        auto flatten = [](const std::vector<TraceRecord>& session) {
+            Flat flat;
+            for (const TraceRecord& record : session)
+            {
+                if (record.Kind == TraceKind::Out)
+                {
+                    flat.Writes.push_back({ flat.Output.size(), record.Micros });
+                    flat.Output.insert(flat.Output.end(), record.Data.begin(), record.Data.end());
+                }
+                else if (record.Kind == TraceKind::State)
+                {
+                    flat.States.push_back(&record);
+                }
+            }
+            return flat;
+        };
+        Flat left = flatten(expectedSession);
+        Flat right = flatten(actualSession);
+
+        auto distance = [](uint64_t a, uint64_t b) { return a > b ? a - b : b - a; };
+
+        TraceComparison comparison;
+        auto mismatch = std::mismatch(left.Output.begin(), left.Output.end(), right.Output.begin(), right.Output.end());
+        comparison.FirstDifference = mismatch.first - left.Output.begin();
+        comparison.OutputMatches = left.Output.size() == right.Output.size() && mismatch.first == left.Output.end();
+
+        comparison.StatesMatch = left.States.size() == right.States.size();
+        for (size_t i = 0; i < left.States.size() && i < right.States.size(); i++)
+        {
+            comparison.StatesMatch = comparison.StatesMatch && left.States[i]->Data == right.States[i]->Data;
+            comparison.MaxDeviationMicros = std::max(comparison.MaxDeviationMicros, distance(left.States[i]->Micros, right.States[i]->Micros));
+        }
+
+        // The writes may be split differently, compare the time the first byte of each expected one went out
+        for (const auto& write : left.Writes)
+        {
+            if (write.first >= comparison.FirstDifference)
+            {
+                break;
+            }
+
+            auto containing = std::upper_bound(right.Writes.begin(), right.Writes.end(), std::make_pair(write.first, UINT64_MAX)) - 1;
+            comparison.MaxDeviationMicros = std::max(comparison.MaxDeviationMicros, distance(write.second, containing->second));
+        }
+
+        return comparison;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Clock.h"
+
+/// @brief A part of a simulation with things happening at known points of virtual time.
+class SimulatedDevice {
+    public:
+        static const uint64_t NoEvent = UINT64_MAX;
+
+        /// @return The virtual time of the next event in nanoseconds, `NoEvent` if nothing is pending.
+        virtual uint64_t NextEventNanos() = 0;
+};
+
+/// @brief  Deterministic clock for host simulations. Time only moves when the code under test idles, it then jumps
+///         straight to the next event of the attached devices. Waiting costs no real time and every run of a
+///         scenario produces the same timings.
+class VirtualClock : public Clock {
+    private:
+        uint64_t now = 0;
+        std::vector<SimulatedDevice*> devices;
+
+    public:
+        /// @brief How far time moves when no device has anything pending, e.g. while running into a timeout.
+        uint64_t IdleStepNanos = 1000000;
+
+        /// @brief How often the code under test idled.
+        uint64_t IdleCount = 0;
+
+        /// @brief Makes `Idle` consider the events of a device.
+        void Attach(SimulatedDevice* device)
+        {
+            devices.push_back(device);
+        }
+
+        uint64_t Nanos() const
+        {
+            return now;
+        }
+
+        /// @brief Moves time forward, e.g. to account for work the simulation does not model.
+        void Advance(uint64_t nanos)
+        {
+            now += nanos;
+        }
+
+        uint32_t Millis() override
+        {
+            return (uint32_t)(now / 1000000);
+        }
+
+        uint32_t Micros() override
+        {
+            return (uint32_t)(now / 1000);
+        }
+
+        void Idle() override
+        {
+            uint64_t next = SimulatedDevice::NoEvent;
+
+            for (SimulatedDevice* device : devices)
+            {
+                uint64_t event = device->NextEventNanos();
+                if (event > now && event < next)
+                {
+                    next = event;
+                }
+            }
+
+            now = next == SimulatedDevice::NoEvent ? now + IdleStepNanos : next;
+            IdleCount++;
+        }
+};
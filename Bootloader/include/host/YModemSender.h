@@ -0,0 +1,647 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "Crc16.h"
+#include "Crc32.h"
+#include "FlashWriter.h"
+#include "ymodem.h"
+#include "host/HeatshrinkEncoder.h"
+#include "host/SimulatedLink.h"
+
+/// @brief  Host side of a simulated session, sends files like the YModemUploader does: per file a 1K header packet
+///         with the extension options, data packets in plain YModem or YModem-G and EOT, then the closing packet.
+///         A NAK has the last packet or EOT sent again, other unexpected bytes are taken for answers garbled on the
+///         way and ignored, the bootloader asks with a NAK once it has waited too long. CA ends the session. An 'R'
+///         answering EOT has the file continue at the offset it carries, with the next packet numbers. Offers
+///         extended frames with the `frame` header option when `PacketSize` is larger than 1K, and falls back to 1K
+///         packets if the bootloader does not answer with a frame size.
+class YModemSender : public HostPeer {
+    private:
+        enum struct State : uint8_t {
+            HeaderAck,
+            Resume,
+            Mode,
+            Frame,
+            DataAck,
+            EotAck,
+            Rewind,
+            SecondEotAck,
+            CrcRequest,
+            ClosingAck,
+            Done,
+            Failed,
+        };
+
+        struct BatchFile {
+            std::vector<uint8_t> Data;
+            std::string Name;
+
+            /// @brief The address sent with the `addr` header option, none if 0.
+            uint32_t Address;
+
+            /// @brief What goes over the wire, the file or its compressed form.
+            std::vector<uint8_t> Payload;
+        };
+
+        std::vector<BatchFile> files;
+
+        /// @brief The index of the file being sent.
+        size_t current = 0;
+        State state = State::HeaderAck;
+        uint32_t nextPacket = 1;
+
+        /// @brief The payload size of the data packets of the current file, as negotiated.
+        uint16_t packetSize = 1024;
+
+        /// @brief The offset into the payload of the packet `nextPacket`, it starts over when the file is rewound.
+        size_t packetOffset = 0;
+        bool streaming = false;
+
+        /// @brief Whether the bootloader takes skip frames for the current file, see `OfferSparse`.
+        bool sparse = false;
+
+        /// @brief The answer to the `resume` option or the rewinding EOT received so far.
+        std::vector<uint8_t> resumeAnswer;
+
+        /// @brief The amount of data packets sent in the session, see `StopAfterPackets`.
+        uint32_t dataPacketsSent = 0;
+        bool stopped = false;
+
+        /// @brief  The time the last thing sent had arrived at the bootloader, and whether what is received now is a
+        ///         reply to it, see `Replies`.
+        uint64_t sentArrival = 0;
+        bool replying = false;
+
+        /// @brief Notes that something has been sent, and how long the reply it answers took.
+        void Sent(uint64_t arrival, uint64_t now)
+        {
+            if (replying)
+            {
+                uint64_t reply = now > sentArrival ? now - sentArrival : 0;
+                Replies++;
+                ReplyNanos += reply;
+                MaxReplyNanos = std::max(MaxReplyNanos, reply);
+                replying = false;
+            }
+
+            sentArrival = arrival;
+        }
+
+        /// @brief  Builds a packet. Uses the bitwise CRC on purpose, the sender checks the optimized kernels of the
+        ///         bootloader instead of sharing them.
+        static std::vector<uint8_t> BuildPacket(uint8_t start, uint8_t sequence, const uint8_t* data, size_t length, uint16_t size, uint8_t padding)
+        {
+            std::vector<uint8_t> packet(size + 5, padding);
+            packet[0] = start;
+            packet[1] = sequence;
+            packet[2] = 0xFF - sequence;
+            memcpy(&packet[3], data, length);
+
+            uint16_t crc = Crc16::ComputeBitwise(&packet[3], size);
+            packet[3 + size] = (uint8_t)(crc >> 8);
+            packet[4 + size] = (uint8_t)crc;
+            return packet;
+        }
+
+        /// @brief The amount of data packets the payload of the current file takes.
+        uint32_t PacketCount() const
+        {
+            return (uint32_t)((files[current].Payload.size() + packetSize - 1) / packetSize);
+        }
+
+        /// @brief Whether a range of the payload is all erased value.
+        bool IsErased(size_t start, size_t end) const
+        {
+            const std::vector<uint8_t>& payload = files[current].Payload;
+            return std::all_of(payload.begin() + start, payload.begin() + end, [](uint8_t value) { return value == 0xFF; });
+        }
+
+        /// @brief  The end of the packet at `packetOffset`. With skip frames a packet of the erased value takes the
+        ///         whole run of them along.
+        size_t PacketEnd(bool* skip) const
+        {
+            size_t size = files[current].Payload.size();
+            size_t end = std::min(packetOffset + packetSize, size);
+            *skip = sparse && IsErased(packetOffset, end);
+
+            while (*skip && end < size && IsErased(end, std::min(end + packetSize, size)))
+            {
+                end = std::min(end + packetSize, size);
+            }
+
+            while (*skip && ExactSkipRuns && end < size && files[current].Payload[end] == 0xFF)
+            {
+                end++;
+            }
+
+            return end;
+        }
+
+        /// @brief Moves on to the packet after `nextPacket`.
+        void NextPacket()
+        {
+            bool skip;
+            size_t end = PacketEnd(&skip);
+            BytesSkipped += skip ? end - packetOffset : 0;
+            packetOffset = end;
+            nextPacket++;
+        }
+
+        std::string BuildHeaderOptions() const
+        {
+            const std::vector<uint8_t>& file = files[current].Data;
+            std::string options;
+
+            if (OfferStreaming)
+            {
+                options += "stream=1";
+            }
+
+            if (OfferResume)
+            {
+                options += options.empty() ? "resume=1" : " resume=1";
+            }
+
+            if (OfferSparse && Compress == false)
+            {
+                options += options.empty() ? "sparse=1" : " sparse=1";
+            }
+
+            if (Compress)
+            {
+                char option[40];
+                snprintf(option, sizeof(option), "%sheatshrink=%x,%x,%x", options.empty() ? "" : " ",
+                    HeatshrinkDecoder::WindowBits, HeatshrinkDecoder::LookaheadBits, (unsigned)file.size());
+                options += option;
+            }
+
+            if (PacketSize > 1024)
+            {
+                char option[16];
+                snprintf(option, sizeof(option), "%sframe=%x", options.empty() ? "" : " ", PacketSize);
+                options += option;
+            }
+
+            if (files[current].Address != 0)
+            {
+                char option[24];
+                snprintf(option, sizeof(option), "%saddr=%x", options.empty() ? "" : " ", (unsigned)files[current].Address);
+                options += option;
+            }
+
+            if (Version != 0 && files[current].Address == 0)
+            {
+                char option[24];
+                snprintf(option, sizeof(option), "%sversion=%x", options.empty() ? "" : " ", (unsigned)Version);
+                options += option;
+            }
+
+            if (SendDigests)
+            {
+                options += options.empty() ? "delta=" : " delta=";
+
+                for (size_t offset = 0; offset < file.size(); offset += FlashWriter::DigestChunkSize)
+                {
+                    size_t length = std::min((size_t)FlashWriter::DigestChunkSize, file.size() - offset);
+                    char digest[10];
+                    snprintf(digest, sizeof(digest), offset == 0 ? "%08x" : ",%08x", (unsigned)Crc32::Update(Crc32::InitialValue, &file[offset], length));
+                    options += digest;
+                }
+            }
+
+            return options;
+        }
+
+        void Send(SimulatedLink& link, const std::vector<uint8_t>& data, uint64_t now)
+        {
+            Sent(link.SendToDevice(data.data(), data.size(), now), now);
+            PacketsSent++;
+        }
+
+        void SendHeader(SimulatedLink& link, uint64_t now)
+        {
+            // Standard packets until the bootloader agrees to extended frames, and no skip frames either
+            packetSize = PacketSize < 1024 ? PacketSize : 1024;
+            sparse = false;
+
+            const BatchFile& file = files[current];
+            char header[1024] = {};
+            int length = snprintf(header, sizeof(header), "%s", file.Name.c_str()) + 1;
+            snprintf(&header[length], sizeof(header) - length, "%u 0 %o %s", AnnounceSize ? (unsigned)file.Payload.size() : 0u, (unsigned)PacketCount(), BuildHeaderOptions().c_str());
+
+            Send(link, BuildPacket(HeaderSize == 1024 ? STX : SOH, 0, (const uint8_t*)header, HeaderSize, HeaderSize, 0), now);
+        }
+
+        /// @brief Sends the packet `nextPacket`, a skip frame if it is a run of the erased value.
+        void SendData(SimulatedLink& link, uint64_t now)
+        {
+            // The cable is pulled, the bootloader hears nothing anymore
+            if (stopped || (StopAfterPackets != 0 && dataPacketsSent == StopAfterPackets))
+            {
+                stopped = true;
+                return;
+            }
+            dataPacketsSent++;
+
+            bool skip;
+            size_t end = PacketEnd(&skip);
+            if (skip)
+            {
+                uint32_t run = (uint32_t)(end - packetOffset);
+                Send(link, BuildPacket(SKP, (uint8_t)nextPacket, (const uint8_t*)&run, sizeof(run), SKIP_FRAME_SIZE, 0), now);
+                return;
+            }
+
+            const std::vector<uint8_t>& payload = files[current].Payload;
+            uint8_t start = packetSize > 1024 ? SOF : packetSize == 1024 ? STX : SOH;
+            Send(link, BuildPacket(start, (uint8_t)nextPacket, &payload[packetOffset], end - packetOffset, packetSize, 0x1A), now);
+        }
+
+        void SendEot(SimulatedLink& link, uint64_t now)
+        {
+            if (stopped)
+            {
+                return;
+            }
+
+            uint8_t eot = EOT;
+            Sent(link.SendToDevice(&eot, 1, now), now);
+        }
+
+        void SendClosing(SimulatedLink& link, uint64_t now)
+        {
+            uint8_t data[128] = { 0x00, '0', ' ', '0', ' ', '0' };
+            Send(link, BuildPacket(SOH, 0, data, sizeof(data), 128, 0), now);
+        }
+
+        /// @brief  Continues the current file at the offset the bootloader answered the `resume` option or an EOT
+        ///         with.
+        bool Resume()
+        {
+            uint16_t crc = Crc16::ComputeBitwise(&resumeAnswer[1], 4);
+            if (resumeAnswer[0] != RESUME || resumeAnswer[5] != (uint8_t)(crc >> 8) || resumeAnswer[6] != (uint8_t)crc)
+            {
+                return false;
+            }
+
+            uint32_t offset;
+            memcpy(&offset, &resumeAnswer[1], sizeof(offset));
+            BatchFile& file = files[current];
+            if (offset > file.Data.size())
+            {
+                return false;
+            }
+
+            // Only the rest goes over the wire, compressed on its own
+            if (offset > 0)
+            {
+                std::vector<uint8_t> rest(file.Data.begin() + offset, file.Data.end());
+                file.Payload = Compress ? HeatshrinkEncoder().Encode(rest) : rest;
+            }
+
+            ResumedAt = offset;
+            return true;
+        }
+
+        /// @brief Sends the data packets of the payload from `nextPacket` on, all of them back to back in YModem-G.
+        void SendPayload(SimulatedLink& link, uint64_t now)
+        {
+            size_t size = files[current].Payload.size();
+
+            if (packetOffset >= size)
+            {
+                SendEot(link, now);
+                state = State::EotAck;
+            }
+            else if (streaming)
+            {
+                // Everything goes out back to back, the link's bandwidth paces it
+                for (; packetOffset < size; NextPacket())
+                {
+                    SendData(link, now);
+                }
+                SendEot(link, now);
+                state = State::EotAck;
+            }
+            else
+            {
+                SendData(link, now);
+                state = State::DataAck;
+            }
+        }
+
+        /// @brief Sends the last packet or EOT again.
+        void Retransmit(SimulatedLink& link, uint64_t now)
+        {
+            Retransmissions++;
+
+            switch (state)
+            {
+                case State::HeaderAck:
+                case State::Resume:
+                case State::Mode:
+                case State::Frame:
+                    SendHeader(link, now);
+                    state = State::HeaderAck;
+                    break;
+
+                case State::DataAck:
+                    SendData(link, now);
+                    break;
+
+                case State::EotAck:
+                case State::Rewind:
+                case State::SecondEotAck:
+                case State::CrcRequest:
+                    SendEot(link, now);
+                    state = State::EotAck;
+                    break;
+
+                case State::ClosingAck:
+                    SendClosing(link, now);
+                    break;
+
+                case State::Done:
+                case State::Failed:
+                    break;
+            }
+        }
+
+        void Fail(uint8_t received)
+        {
+            FailedOn = received;
+            state = State::Failed;
+        }
+
+    public:
+        /// @brief The payload size of data packets: 128, 1024 or the extended frame size to offer.
+        uint16_t PacketSize = 1024;
+
+        /// @brief  The payload size of header packets, 128 or 1024. A 128 byte header has to leave out the digests,
+        ///         the options that do not fit are cut off.
+        uint16_t HeaderSize = 1024;
+
+        /// @brief Whether to announce the size of the file in its header, YModem allows leaving it out.
+        bool AnnounceSize = true;
+
+        /// @brief Whether to offer YModem-G with the `stream` header option.
+        bool OfferStreaming = true;
+
+        /// @brief Whether to send the digests of the `delta` header option.
+        bool SendDigests = true;
+
+        /// @brief Whether to send the file compressed, announced with the `heatshrink` header option.
+        bool Compress = false;
+
+        /// @brief Whether to offer continuing an interrupted update with the `resume` header option.
+        bool OfferResume = false;
+
+        /// @brief  Whether to offer skip frames for runs of the erased value with the `sparse` header option. Only
+        ///         for files sent uncompressed.
+        bool OfferSparse = false;
+
+        /// @brief  Whether a skip run ends at the last byte of the erased value instead of a packet boundary, which the
+        ///         protocol allows. The packets after such a run are no longer aligned to sectors.
+        bool ExactSkipRuns = false;
+
+        /// @brief Stops sending after this many data packets, like a cable pulled mid-transfer. Never if 0.
+        uint32_t StopAfterPackets = 0;
+
+        /// @brief The offset the bootloader continued the last file at.
+        uint32_t ResumedAt = 0;
+
+        /// @brief The image version sent with the `version` header option of the image, none if 0.
+        uint32_t Version = 0;
+
+        uint32_t PacketsSent = 0;
+        uint32_t Retransmissions = 0;
+
+        /// @brief The times the bootloader had a file continue at an earlier offset after an EOT.
+        uint32_t Rewinds = 0;
+
+        /// @brief The payload bytes sent as skip frames, in runs of the erased value.
+        uint64_t BytesSkipped = 0;
+
+        /// @brief The byte that made the session fail.
+        uint8_t FailedOn = 0;
+
+        /// @brief  The replies the sender went on after, and the time from the last byte it had sent arriving at the
+        ///         bootloader to the reply having arrived here, in total and at most.
+        uint32_t Replies = 0;
+        uint64_t ReplyNanos = 0;
+        uint64_t MaxReplyNanos = 0;
+
+        YModemSender() = default;
+
+        YModemSender(const std::vector<uint8_t>& file, const char* name)
+        {
+            AddFile(file, name);
+        }
+
+        /// @brief Adds a file to the batch, sent after the ones added before in the same session.
+        /// @param address The address of a data file, 0 for the image.
+        void AddFile(const std::vector<uint8_t>& file, const char* name, uint32_t address = 0)
+        {
+            files.push_back({ file, name, address, {} });
+        }
+
+        bool IsDone() const
+        {
+            return state == State::Done;
+        }
+
+        /// @brief The amount of file bytes that went over the wire, for all files of the batch.
+        size_t PayloadSize() const
+        {
+            size_t size = 0;
+            for (const BatchFile& file : files)
+            {
+                size += file.Payload.size();
+            }
+
+            return size;
+        }
+
+        bool IsStreaming() const
+        {
+            return streaming;
+        }
+
+        void Start(SimulatedLink& link, uint64_t now) override
+        {
+            for (BatchFile& file : files)
+            {
+                file.Payload = Compress ? HeatshrinkEncoder().Encode(file.Data) : file.Data;
+            }
+
+            SendHeader(link, now);
+        }
+
+        void Receive(SimulatedLink& link, const uint8_t* data, uint16_t length, uint64_t now) override
+        {
+            replying = true;
+            for (uint16_t i = 0; i < length; i++)
+            {
+                uint8_t received = data[i];
+
+                // The answers to the `resume` and `frame` options are binary, they may contain any byte
+                if (state != State::Resume && state != State::Frame && state != State::Rewind && state != State::Done && state != State::Failed)
+                {
+                    if (received == NAK)
+                    {
+                        Retransmit(link, now);
+                        continue;
+                    }
+
+                    if (received == CA)
+                    {
+                        Fail(received);
+                        continue;
+                    }
+                }
+
+                switch (state)
+                {
+                    case State::HeaderAck:
+                        if (received == ACK)
+                        {
+                            resumeAnswer.clear();
+                            state = OfferResume ? State::Resume : State::Mode;
+                        }
+                        break;
+
+                    case State::Resume:
+                        resumeAnswer.push_back(received);
+                        if (resumeAnswer.size() == 7)
+                        {
+                            if (Resume())
+                            {
+                                state = State::Mode;
+                            }
+                            else
+                            {
+                                Fail(received);
+                            }
+                        }
+                        break;
+
+                    case State::Mode:
+                        if (received == FRAME)
+                        {
+                            state = State::Frame;
+                            break;
+                        }
+
+                        if (received == SPARSE)
+                        {
+                            sparse = true;
+                            break;
+                        }
+
+                        if (received != CRC16 && received != STREAM)
+                        {
+                            break;
+                        }
+
+                        streaming = received == STREAM;
+                        SendPayload(link, now);
+                        break;
+
+                    case State::Frame:
+                        packetSize = (uint16_t)(received * 1024);
+                        state = State::Mode;
+                        break;
+
+                    case State::DataAck:
+                        if (received != ACK)
+                        {
+                            break;
+                        }
+
+                        NextPacket();
+                        if (packetOffset < files[current].Payload.size())
+                        {
+                            SendData(link, now);
+                        }
+                        else
+                        {
+                            SendEot(link, now);
+                            state = State::EotAck;
+                        }
+                        break;
+
+                    case State::EotAck:
+                        if (received == ACK)
+                        {
+                            state = State::SecondEotAck;
+                        }
+                        else if (received == RESUME)
+                        {
+                            resumeAnswer.assign(1, received);
+                            state = State::Rewind;
+                        }
+                        break;
+
+                    case State::Rewind:
+                        resumeAnswer.push_back(received);
+                        if (resumeAnswer.size() == 7)
+                        {
+                            if (Resume() == false)
+                            {
+                                Fail(received);
+                                break;
+                            }
+
+                            // The packet numbers go on, the payload starts over at the offset
+                            Rewinds++;
+                            packetOffset = 0;
+                            SendPayload(link, now);
+                        }
+                        break;
+
+                    case State::SecondEotAck:
+                        if (received == ACK)
+                        {
+                            state = State::CrcRequest;
+                        }
+                        break;
+
+                    case State::CrcRequest:
+                        if (received != CRC16)
+                        {
+                            break;
+                        }
+
+                        // The next file's header takes the place of the closing packet
+                        if (current + 1 < files.size())
+                        {
+                            current++;
+                            nextPacket = 1;
+                            packetOffset = 0;
+                            SendHeader(link, now);
+                            state = State::HeaderAck;
+                            break;
+                        }
+
+                        SendClosing(link, now);
+                        state = State::ClosingAck;
+                        break;
+
+                    case State::ClosingAck:
+                        if (received == ACK)
+                        {
+                            state = State::Done;
+                        }
+                        break;
+
+                    case State::Done:
+                    case State::Failed:
+                        break;
+                }
+            }
+        }
+};
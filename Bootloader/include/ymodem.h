@@ -1,7 +1,15 @@
 #pragma once
-#include <Arduino.h>
+#include "Platform.h"
 #include "Utils.h"
 #include "Hardware.h"
+#include "Crc16.h"
+#include "FlashWriter.h"
+#include "HeatshrinkDecoder.h"
+#include "ImageDescriptor.h"
+#include "Transport.h"
+#include "Clock.h"
+#include "Profiler.h"
+#include "Trace.h"
 
 #define PACKET_SEQNO_INDEX      (1)
 #define PACKET_SEQNO_COMP_INDEX (2)
@@ -11,23 +19,46 @@
 #define PACKET_OVERHEAD         (PACKET_HEADER + PACKET_TRAILER)
 #define PACKET_SIZE             (128)
 #define PACKET_1K_SIZE          (1024)
+#define PACKET_MAX_FRAME_SIZE   (8192)  /* largest extended frame a build can take, see the `frame` header option */
+#define SKIP_FRAME_SIZE         (4)     /* payload of a skip frame, the length of the run it stands for */
 
 #define FILE_NAME_LENGTH        (256)
 #define FILE_SIZE_LENGTH        (16)
 
 #define SOH                     (0x01)  /* start of 128-byte data packet */
 #define STX                     (0x02)  /* start of 1024-byte data packet */
+#define SOF                     (0x03)  /* start of an extended data frame of the size negotiated for the file */
 #define EOT                     (0x04)  /* end of transmission */
+#define SKP                     (0x05)  /* start of a skip frame, a run of file data of the erased value, see the `sparse` header option */
 #define ACK                     (0x06)  /* acknowledge */
 #define NAK                     (0x15)  /* negative acknowledge */
 #define CA                      (0x18)  /* two of these in succession aborts transfer */
 #define CRC16                   (0x43)  /* 'C' == 0x43, request 16-bit CRC */
+#define STREAM                  (0x47)  /* 'G' == 0x47, request 16-bit CRC without per packet ACKs (YModem-G) */
+
+#define STATS                   (0x53)  /* 'S' == 0x53, query the statistics of the last session */
+#define STATS_VERSION           (2)
+#define INFO                    (0x49)  /* 'I' == 0x49, query the descriptor of the image in flash */
+#define INFO_VERSION            (2)
+#define TRACE                   (0x54)  /* 'T' == 0x54, query the trace of the last session */
+#define TRACE_VERSION           (1)
+#define RESUME                  (0x52)  /* 'R' == 0x52, answers the `resume` header option with the offset to continue at */
+#define FRAME                   (0x46)  /* 'F' == 0x46, answers the `frame` header option with the frame size in KB */
+#define SPARSE                  (0x45)  /* 'E' == 0x45, answers the `sparse` header option, skip frames are taken */
 
 #define ABORT1                  (0x41)  /* 'A' == 0x41, abort by user */
 #define ABORT2                  (0x61)  /* 'a' == 0x61, abort by user */
 
-#define NAK_TIMEOUT             (0x100000)
-#define MAX_ERRORS              (5)
+#define NAK_TIMEOUT             (5000)  /* ms to wait for the host to start a session */
+#define MAX_ERRORS              (5)     /* errors in a row before the transfer is cancelled */
+#define MAX_REWINDS             (2)     /* times a file continues at a sector that failed verification */
+
+#define BYTE_TIMEOUT            (5000)  /* ms to wait for a single byte */
+#define PACKET_TIMEOUT          (100)   /* ms of silence within a packet before it counts as incomplete */
+#define RETRY_TIMEOUT           (1000)  /* ms to wait for the next packet before asking for it again with a NAK */
+#define PURGE_TIMEOUT           (50)    /* ms of silence that end the rest of a broken packet */
+
+#define REPLY_QUEUE_SIZE        (16)    /* bytes of a reply collected for one write, the header's answer takes 12 */
 
 enum struct ReceiveByteResult : uint8_t {
     /// @brief Successfully received a byte.
@@ -68,252 +99,1673 @@ enum struct ReceiveFileResult : uint8_t {
     Failed,
 };
 
-enum struct FileNamePacketResult : uint8_t {
-    /// @brief The filename packet is valid and processed
-    Ok,
+enum struct FileNamePacketResult : uint8_t {
+    /// @brief The filename packet is valid and processed
+    Ok,
+
+    /// @brief The name of the file is empty
+    EmptyName,
+
+    /// @brief The file is too large, does not fit in the MCU's flash memory
+    TooLarge,
+
+    /// @brief The file is compressed with parameters the decoder does not support
+    Unsupported,
+
+    /// @brief The flash reported an error while invalidating the previous image's descriptor
+    FlashError,
+
+    /// @brief  The `addr` option does not name the image address or the start of a sector past the image, or the
+    ///         file does not fit there
+    BadAddress,
+};
+
+enum struct DataPacketResult : uint8_t {
+    /// @brief The data packet is valid and processed
+    Ok,
+
+    /// @brief The flash reported an error while programming
+    FlashError,
+
+    /// @brief The data runs past the end of the flash region of the file
+    TooLarge,
+};
+
+enum struct ClosingPacketResult : uint8_t {
+    /// @brief The closing packet is valid and processed
+    Ok,
+
+    /// @brief The closing packet is not an empty header packet
+    Malformed,
+};
+
+/// @brief  A received packet. The start byte, the sequence number and its complement and the CRC16 trailer land in
+///         their own fields, the payload in a buffer the receiver picks. That keeps the payload word aligned, and lets
+///         file data arrive right in the buffer it is programmed from.
+struct PacketFrame {
+    uint8_t Header[PACKET_HEADER];
+    uint8_t Trailer[PACKET_TRAILER];
+    uint8_t* Payload;
+};
+
+enum struct ParseEvent : uint8_t {
+    /// @brief Nothing complete yet, the parser takes more bytes.
+    None,
+
+    /// @brief A whole packet arrived with a matching sequence number complement and CRC.
+    Packet,
+
+    /// @brief The host ended the file with an EOT.
+    FileDone,
+
+    /// @brief The host cancelled with two CAs or an abort key.
+    Aborted,
+
+    /// @brief The byte in place of a start byte starts no packet this receiver takes.
+    Unknown,
+
+    /// @brief The sequence number complement or the CRC of a packet did not match.
+    Malformed,
+};
+
+/// @brief  Puts packets together from the bytes of the host however they are split up, it never waits for more. The
+///         bytes go in place through `Destination` and `Advance`, in the amounts the current field still takes, so
+///         the payload lands right in the buffer given to `Begin`. `Feed` copies from arbitrary chunks instead. The
+///         CRC is kept up while the payload arrives, no step takes longer than its chunk. Timeouts are the caller's,
+///         `IsIdle` tells which one applies.
+/// @tparam MaxPacketSize The largest payload taken, see `YModem`.
+template <uint16_t MaxPacketSize>
+class PacketParser {
+    private:
+        enum struct State : uint8_t {
+            /// @brief Waiting for the start byte.
+            Start,
+
+            /// @brief Waiting for the second CA of a cancel.
+            Cancel,
+
+            /// @brief Receiving the sequence number and its complement.
+            Header,
+
+            Payload,
+            Trailer,
+        };
+
+        PacketFrame* frame = nullptr;
+        State state = State::Start;
+
+        /// @brief The bytes of the current field received so far.
+        uint16_t received = 0;
+
+        uint16_t payloadSize = 0;
+        uint16_t crc = 0;
+
+        /// @brief The extended frame size and whether skip frames are taken, see `Begin`.
+        uint16_t frameSize = 0;
+        bool sparse = false;
+
+        /// @brief Where the byte after a CA goes.
+        uint8_t cancelByte = 0;
+
+        /// @brief Takes a start byte.
+        ParseEvent Start(uint8_t start)
+        {
+            switch (start)
+            {
+                case SOH:
+                    payloadSize = PACKET_SIZE;
+                    break;
+
+                // Too large for a 128 byte build, the rest of it is purged like garbage
+                case STX:
+                    if (MaxPacketSize < PACKET_1K_SIZE)
+                    {
+                        return ParseEvent::Unknown;
+                    }
+                    payloadSize = PACKET_1K_SIZE;
+                    break;
+
+                // Only after the header packet negotiated its size
+                case SOF:
+                    if (frameSize == 0)
+                    {
+                        return ParseEvent::Unknown;
+                    }
+                    payloadSize = frameSize;
+                    break;
+
+                // Only after the header packet agreed on them, numbered like data packets
+                case SKP:
+                    if (sparse == false)
+                    {
+                        return ParseEvent::Unknown;
+                    }
+                    payloadSize = SKIP_FRAME_SIZE;
+                    break;
+
+                case EOT:
+                    return ParseEvent::FileDone;
+
+                case CA:
+                    state = State::Cancel;
+                    return ParseEvent::None;
+
+                case ABORT1:
+                case ABORT2:
+                    return ParseEvent::Aborted;
+
+                default:
+                    return ParseEvent::Unknown;
+            }
+
+            state = State::Header;
+            received = 1;
+            crc = 0;
+            return ParseEvent::None;
+        }
+
+        /// @brief Checks a complete packet.
+        ParseEvent Check()
+        {
+            state = State::Start;
+
+            if (frame->Header[PACKET_SEQNO_INDEX] != (frame->Header[PACKET_SEQNO_COMP_INDEX] ^ 0xff))
+            {
+                return ParseEvent::Malformed;
+            }
+
+            // The trailer holds the CRC16 of the payload, high byte first
+            uint16_t receivedCrc = (uint16_t)((frame->Trailer[0] << 8) | frame->Trailer[1]);
+            return receivedCrc == crc ? ParseEvent::Packet : ParseEvent::Malformed;
+        }
+
+    public:
+        /// @brief Waits for the next packet.
+        /// @param packet Where the packet goes, its payload into `payload`.
+        /// @param payload The buffer for the payload, `MaxPacketSize` bytes.
+        /// @param negotiatedFrameSize The size of the extended frames taken with `SOF`, 0 if none.
+        /// @param takeSkipFrames Whether skip frames are taken.
+        void Begin(PacketFrame* packet, uint8_t* payload, uint16_t negotiatedFrameSize, bool takeSkipFrames)
+        {
+            frame = packet;
+            frame->Payload = payload;
+            frameSize = negotiatedFrameSize;
+            sparse = takeSkipFrames;
+            state = State::Start;
+        }
+
+        /// @brief Whether no packet has started since `Begin` or the last event.
+        bool IsIdle() const
+        {
+            return state == State::Start;
+        }
+
+        /// @brief Whether the last byte was the first CA of a cancel, which waits longer for the second one.
+        bool IsCancelling() const
+        {
+            return state == State::Cancel;
+        }
+
+        /// @brief The payload size of the packet being received, valid from its start byte on.
+        uint16_t GetPayloadSize() const
+        {
+            return payloadSize;
+        }
+
+        /// @brief Where the next bytes go.
+        /// @param room The amount of bytes the current field still takes, at least 1.
+        uint8_t* Destination(uint16_t* room)
+        {
+            switch (state)
+            {
+                case State::Start:
+                    *room = 1;
+                    return frame->Header;
+
+                case State::Cancel:
+                    *room = 1;
+                    return &cancelByte;
+
+                case State::Header:
+                    *room = PACKET_HEADER - received;
+                    return &frame->Header[received];
+
+                case State::Payload:
+                    *room = payloadSize - received;
+                    return &frame->Payload[received];
+
+                default:
+                    *room = PACKET_TRAILER - received;
+                    return &frame->Trailer[received];
+            }
+        }
+
+        /// @brief Takes bytes written to `Destination`.
+        /// @param count The amount of bytes, at most its room.
+        /// @return The event they complete, then the parser waits for the next start byte.
+        ParseEvent Advance(uint16_t count)
+        {
+            if (count == 0)
+            {
+                return ParseEvent::None;
+            }
+
+            switch (state)
+            {
+                case State::Start:
+                    return Start(frame->Header[0]);
+
+                case State::Cancel:
+                    state = State::Start;
+                    return cancelByte == CA ? ParseEvent::Aborted : ParseEvent::Unknown;
+
+                case State::Header:
+                    received += count;
+                    if (received == PACKET_HEADER)
+                    {
+                        state = State::Payload;
+                        received = 0;
+                    }
+                    return ParseEvent::None;
+
+                case State::Payload:
+                {
+                    PROFILE_PHASE(Crc);
+                    crc = Crc16::Compute(&frame->Payload[received], count, crc);
+                    received += count;
+                    if (received == payloadSize)
+                    {
+                        state = State::Trailer;
+                        received = 0;
+                    }
+                    return ParseEvent::None;
+                }
+
+                default:
+                    received += count;
+                    return received == PACKET_TRAILER ? Check() : ParseEvent::None;
+            }
+        }
+
+        /// @brief Copies bytes from a chunk of any size, up to the first event.
+        /// @param data The bytes.
+        /// @param length The amount of bytes.
+        /// @param event The event, `None` if all bytes were taken without one.
+        /// @return The amount of bytes taken, the rest belongs to what follows the event.
+        uint16_t Feed(const uint8_t* data, uint16_t length, ParseEvent* event)
+        {
+            uint16_t taken = 0;
+            *event = ParseEvent::None;
+
+            while (taken < length && *event == ParseEvent::None)
+            {
+                uint16_t room;
+                uint8_t* destination = Destination(&room);
+                if (room > length - taken)
+                {
+                    room = length - taken;
+                }
+
+                memcpy(destination, &data[taken], room);
+                taken += room;
+                *event = Advance(room);
+            }
+
+            return taken;
+        }
+};
+
+/// @brief  The receiving end of YModem and YModem-G, writing what it receives into the flash. Configured at compile
+///         time: the transport and flash backend are the concrete types, so with `final` classes every call into them
+///         is bound statically, and `MaxPacketSize` sizes all buffers. A build for 128 byte packets only takes 1K
+///         packets as broken ones, but needs about 2.7K less RAM. A build for more than 1K also takes extended
+///         frames of whole KB up to that size from hosts that ask for them with the `frame` header option.
+/// @tparam TTransport The byte stream to the host, a `Transport`.
+/// @tparam TFlash The flash backend, a `FlashBackend`.
+/// @tparam MaxPacketSize The largest payload taken: `PACKET_SIZE`, `PACKET_1K_SIZE` or a larger multiple of 1K up
+///         to `PACKET_MAX_FRAME_SIZE`.
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize = PACKET_1K_SIZE>
+class YModem {
+    static_assert(MaxPacketSize == PACKET_SIZE
+        || (MaxPacketSize % PACKET_1K_SIZE == 0 && MaxPacketSize <= PACKET_MAX_FRAME_SIZE),
+        "YModem packets carry 128 or 1024 bytes, extended frames whole KB up to PACKET_MAX_FRAME_SIZE");
+
+    private:
+        /// @brief The writer with buffers as large as the largest packet, a data packet is received right into one.
+        using PacketWriter = BasicFlashWriter<TFlash, MaxPacketSize>;
+
+        /// @brief  Every buffer a session needs, in one block sized by the template parameters. Nothing of it lives
+        ///         on the stack, so its size is the RAM the protocol takes apart from a few scalars.
+        struct Arena {
+            /// @brief Payloads that are not programmed as they are: the header packets and compressed data.
+            alignas(4) uint8_t Payload[MaxPacketSize];
+
+            /// @brief The name from the header packet, NUL terminated.
+            uint8_t FileName[FILE_NAME_LENGTH + 1];
+
+            /// @brief The digests of the `delta` header option, until the writer has taken its copy.
+            uint32_t Digests[FlashWriter::MaxDigests];
+
+            /// @brief Puts the packets together as their bytes arrive.
+            PacketParser<MaxPacketSize> Parser;
+
+            /// @brief Programs the received data in the background while the next packet arrives.
+            PacketWriter Writer;
+
+            /// @brief Expands compressed files, its window is the only RAM decompression takes.
+            HeatshrinkDecoder Decoder;
+        };
+
+        static Arena Memory;
+
+        /// @brief The byte stream to the host.
+        static TTransport* Link;
+
+        /// @brief The time source for timeouts.
+        static Clock* Time;
+
+        /// @brief The flash the received file is written to.
+        static TFlash* Flash;
+
+        /// @brief The absolute address the file is written to.
+        static uint32_t FileAddress;
+
+        /// @brief Whether the file is the image at `ImageDescriptor::ImageAddress`, the one the descriptor describes.
+        static bool BootImage;
+
+        /// @brief The descriptor in flash before a data file was written, see `RecordFile`.
+        static ImageRecord KeptRecord;
+
+        /// @brief Whether `KeptRecord` is complete.
+        static bool KeepRecord;
+
+        /// @brief Whether the host offered to continue an interrupted update with the `resume` header option.
+        static bool ResumeOffered;
+
+        /// @brief The offset into the image the session continues at, 0 if it starts from scratch.
+        static uint32_t ResumeOffset;
+
+        /// @brief The times the current file continued at a sector that failed verification, see `RewindToMismatch`.
+        static uint8_t Rewinds;
+
+        /// @brief The amount of image bytes queued for programming, including `ResumeOffset`.
+        static uint32_t ImageOffset;
+
+        /// @brief The offset of a sector start whose progress is still to be saved, 0 if none. See `CommitBuffer`.
+        static uint32_t CheckpointOffset;
+
+        /// @brief The checksum of the image up to `CheckpointOffset`.
+        static uint32_t CheckpointCrc;
+
+        /// @brief The size of the file announced in the file name packet, 0 if unknown.
+        static int32_t FileSize;
+
+        /// @brief The size of the image written to flash, differs from `FileSize` for compressed files.
+        static int32_t ImageSize;
+
+        /// @brief Whether the file is compressed and expanded by `Decoder` on the way to the flash.
+        static bool Compressed;
+
+        /// @brief The amount of decoded bytes in the writer's free buffer, it is only queued once full.
+        static uint16_t DecodedLength;
+
+        /// @brief The amount of file bytes that are still to be written.
+        static int32_t BytesRemaining;
+
+        /// @brief  The amount of flash from `FileAddress` on the file may fill: the image area, or up to the descriptor
+        ///         log for a data file. Bounds files without a size and skip runs.
+        static uint32_t RegionSize;
+
+        /// @brief  Whether the file is received in YModem-G mode: the host sends data packets without waiting for
+        ///         an ACK, so the round trip per packet disappears, and any error aborts the session.
+        static bool Streaming;
+
+        /// @brief The size of the extended frames negotiated for the file with the `frame` header option, 0 if none.
+        static uint16_t FrameSize;
+
+        /// @brief  Whether the host sends runs of data of the erased value as skip frames, agreed on for an uncompressed
+        ///         file with the `sparse` header option.
+        static bool Sparse;
+
+        /// @brief The file bytes that came as skip frames in the session, see `GetSkippedBytes`.
+        static uint32_t SkippedBytes;
+
+        /// @brief The sector statistics of the files of the session, see `GetFlashStats`.
+        static FlashWriterStats FlashStats;
+
+        /// @brief  The reply to the packet at hand, e.g. ACK and the mode for a header. `SendReply` hands it to the
+        ///         transport in one write, so it reaches the host in one USB transfer instead of one per byte.
+        static uint8_t ReplyQueue[REPLY_QUEUE_SIZE];
+        static uint8_t ReplyLength;
+
+        /// @brief The version the host gave the image, stored in its descriptor.
+        static uint32_t ImageVersion;
+
+        /// @brief The time the previous boot took to start the application, see `SetLastBootMicros`.
+        static uint32_t LastBootMicros;
+
+        /// @return The `Millis` time `timeout` milliseconds from now.
+        static uint32_t Deadline(uint32_t timeout)
+        {
+            return Time->Millis() + timeout;
+        }
+
+        /// @brief Whether a deadline has passed, also across the wrap of `Millis`.
+        static bool Expired(uint32_t deadline)
+        {
+            return (int32_t)(Time->Millis() - deadline) >= 0;
+        }
+
+        /// @brief  Tries to read a byte from the host. If not available, keeps the flash going until it arrives or
+        ///         the deadline passes. A byte that is already there is returned even past the deadline.
+        /// @param out The pointer to write the received byte.
+        /// @param deadline The `Millis` time to give up at.
+        /// @return The status of the receiving.
+        static ReceiveByteResult ReceiveByte(uint8_t* out, uint32_t deadline)
+        {
+            while (true)
+            {
+                Memory.Writer.Poll();
+
+                if (Link->Available())
+                {
+                    Link->Read(out, 1);
+                    return ReceiveByteResult::Ok;
+                }
+
+                if (Expired(deadline))
+                {
+                    return ReceiveByteResult::TimedOut;
+                }
+
+                if (Memory.Writer.IsWaiting())
+                {
+                    Time->Idle();
+                }
+            }
+        }
+
+        /// @brief  Discards whatever the host sends until the line has been quiet for `PURGE_TIMEOUT`, so the rest of
+        ///         a broken packet is not taken for the start of the next one.
+        static void Purge()
+        {
+            uint8_t discarded[64];
+            uint32_t deadline = Deadline(PURGE_TIMEOUT);
+
+            while (Expired(deadline) == false)
+            {
+                Memory.Writer.Poll();
+
+                uint32_t available = Link->Available();
+
+                if (available > 0)
+                {
+                    Link->Read(discarded, available < sizeof(discarded) ? (uint16_t)available : sizeof(discarded));
+                    deadline = Deadline(PURGE_TIMEOUT);
+                }
+                else if (Memory.Writer.IsWaiting())
+                {
+                    Time->Idle();
+                }
+            }
+        }
+
+        /// @brief Sends the queued reply to the host in a single write.
+        static void SendReply()
+        {
+            if (ReplyLength > 0)
+            {
+                PROFILE_PHASE(Ack);
+                Link->Write(ReplyQueue, ReplyLength);
+                ReplyLength = 0;
+            }
+        }
+
+        /// @brief Queues a byte of the reply, see `SendReply`.
+        /// @param data The byte to send.
+        static void SendByte(uint8_t data)
+        {
+            if (ReplyLength == sizeof(ReplyQueue))
+            {
+                SendReply();
+            }
+            ReplyQueue[ReplyLength++] = data;
+        }
+
+        /// @brief  Queues a block of bytes of the reply and adds it to a running CRC16. A block too large for the
+        ///         queue is written right away, after what has been queued before. The CRC is taken after sending
+        ///         the queue, which may update the statistics being sent.
+        static void SendChecked(const void* data, uint16_t length, uint16_t* crc)
+        {
+            if (ReplyLength + length > sizeof(ReplyQueue))
+            {
+                SendReply();
+            }
+
+            *crc = Crc16::Compute((const uint8_t*)data, length, *crc);
+            if (length > sizeof(ReplyQueue))
+            {
+                Link->Write((const uint8_t*)data, length);
+                return;
+            }
+
+            memcpy(&ReplyQueue[ReplyLength], data, length);
+            ReplyLength += (uint8_t)length;
+        }
+
+        /// @brief  Answers the `STATS` command with the statistics of the last session: 'S', the format version, the
+        ///         phase count, the histogram bucket count and the ticks per second, then the sector statistics, see
+        ///         `SendFlashStats`, and per `ProfilePhase` the count, min, max and total ticks and the buckets.
+        ///         Numbers are little-endian, the CRC16 of everything after the 'S' follows high byte first. Without
+        ///         `YMODEM_STATS` the phase count is 0, the sector statistics are always there.
+        static void SendStats()
+        {
+#if defined(YMODEM_STATS)
+            uint8_t phaseCount = (uint8_t)ProfilePhase::Count;
+            uint32_t ticksPerSecond = Profiler::TicksPerSecond();
+#else
+            uint8_t phaseCount = 0;
+            uint32_t ticksPerSecond = 0;
+#endif
+            uint16_t crc = 0;
+            uint8_t header[] = { STATS_VERSION, phaseCount, PhaseStats::BucketCount };
+
+            SendByte(STATS);
+            SendChecked(header, sizeof(header), &crc);
+            SendChecked(&ticksPerSecond, sizeof(ticksPerSecond), &crc);
+            SendFlashStats(&crc);
+
+#if defined(YMODEM_STATS)
+            for (const PhaseStats& stats : Profiler::Stats)
+            {
+                SendChecked(&stats.Count, sizeof(stats.Count), &crc);
+                SendChecked(&stats.Min, sizeof(stats.Min), &crc);
+                SendChecked(&stats.Max, sizeof(stats.Max), &crc);
+                SendChecked(&stats.Total, sizeof(stats.Total), &crc);
+                SendChecked(stats.Buckets, sizeof(stats.Buckets), &crc);
+            }
+#endif
+
+            SendByte((uint8_t)(crc >> 8));
+            SendByte((uint8_t)crc);
+            SendReply();
+            Link->Flush();
+        }
+
+        /// @brief  Sends the sector statistics of the session: the sectors erased, skipped as blank, left alone as
+        ///         unchanged, read back and found mismatched, a byte each, then the words left unchanged, the words of
+        ///         the erased value not programmed and the milliseconds of flash time saved.
+        /// @param crc The CRC16 to update.
+        static void SendFlashStats(uint16_t* crc)
+        {
+            uint8_t sectors[] = { FlashStats.SectorsErased, FlashStats.SectorsSkipped, FlashStats.SectorsUnchanged,
+                FlashStats.SectorsVerified, FlashStats.SectorsMismatched };
+
+            SendChecked(sectors, sizeof(sectors), crc);
+            SendChecked(&FlashStats.WordsUnchanged, sizeof(FlashStats.WordsUnchanged), crc);
+            SendChecked(&FlashStats.WordsErased, sizeof(FlashStats.WordsErased), crc);
+            SendChecked(&FlashStats.MillisSaved, sizeof(FlashStats.MillisSaved), crc);
+        }
+
+        /// @brief  Answers the `INFO` command with the descriptor of the image in flash: 'I', the format version, flags
+        ///         (bit 0: the descriptor is complete, bit 1: the image read back matches its CRC32), then the image
+        ///         size, CRC32 and version and the microseconds the previous boot took to start the application, 0 if
+        ///         not known. Numbers are little-endian, the CRC16 of everything after the 'I' follows high byte first.
+        ///         Lets the host confirm an upload without reading the image back over USB.
+        static void SendInfo()
+        {
+            ImageRecord record = {};
+            uint8_t flags = 0;
+
+            if (ImageDescriptor::FindLatest(Flash, &record))
+            {
+                flags |= 1;
+            }
+            else
+            {
+                record = {};
+            }
+
+            if (ImageDescriptor::Verify(Flash) == ImageCheckResult::Valid)
+            {
+                flags |= 2;
+            }
+
+            uint16_t crc = 0;
+            uint8_t header[] = { INFO_VERSION, flags };
+
+            SendByte(INFO);
+            SendChecked(header, sizeof(header), &crc);
+            SendChecked(&record.Size, sizeof(record.Size), &crc);
+            SendChecked(&record.Crc, sizeof(record.Crc), &crc);
+            SendChecked(&record.Version, sizeof(record.Version), &crc);
+            SendChecked(&LastBootMicros, sizeof(LastBootMicros), &crc);
+            SendByte((uint8_t)(crc >> 8));
+            SendByte((uint8_t)crc);
+            SendReply();
+            Link->Flush();
+        }
+
+        /// @brief  Answers the `TRACE` command with the trace of the last session: 'T', the format version, the amount
+        ///         of records dropped to make room and the length of the records, then the records oldest first, see
+        ///         `Trace`. Numbers are little-endian, the CRC16 of everything after the 'T' follows high byte first.
+        ///         Without `YMODEM_TRACE` the length is 0.
+        static void SendTrace()
+        {
+#if defined(YMODEM_TRACE)
+            // The answer itself stays out of the trace
+            Trace::Pause(true);
+            uint32_t dropped = Trace::Dropped;
+            uint32_t length = Trace::Length();
+#else
+            uint32_t dropped = 0;
+            uint32_t length = 0;
+#endif
+            uint16_t crc = 0;
+            uint8_t version = TRACE_VERSION;
+
+            SendByte(TRACE);
+            SendChecked(&version, sizeof(version), &crc);
+            SendChecked(&dropped, sizeof(dropped), &crc);
+            SendChecked(&length, sizeof(length), &crc);
+
+#if defined(YMODEM_TRACE)
+            uint8_t chunk[64];
+            for (uint32_t offset = 0; offset < length; offset += sizeof(chunk))
+            {
+                uint16_t size = length - offset < sizeof(chunk) ? (uint16_t)(length - offset) : (uint16_t)sizeof(chunk);
+                Trace::Copy(offset, chunk, size);
+                SendChecked(chunk, size, &crc);
+            }
+#endif
+
+            SendByte((uint8_t)(crc >> 8));
+            SendByte((uint8_t)crc);
+            SendReply();
+            Link->Flush();
+#if defined(YMODEM_TRACE)
+            Trace::Pause(false);
+#endif
+        }
+
+        /// @brief  Answers the `resume` header option: 'R' and the offset into the image the host has to continue at,
+        ///         0 to start over, little-endian and followed by its CRC16 high byte first.
+        static void SendResume()
+        {
+            uint16_t crc = 0;
+
+            SendByte(RESUME);
+            SendChecked(&ResumeOffset, sizeof(ResumeOffset), &crc);
+            SendByte((uint8_t)(crc >> 8));
+            SendByte((uint8_t)crc);
+        }
+
+        /// @brief Routines when the YModem communication is completely finished
+        static void FinishCommunication()
+        {
+            SendReply();
+            Memory.Writer.Stop();
+            Link->Flush();
+        }
+
+        /// @brief  Answers an accepted header packet: ACK, the answer to the `resume` option, the frame size if one
+        ///         was negotiated, whether skip frames are taken and the mode.
+        static void AcknowledgeHeader()
+        {
+            SendByte(ACK);
+            if (ResumeOffered)
+            {
+                SendResume();
+            }
+            if (FrameSize > 0)
+            {
+                SendByte(FRAME);
+                SendByte((uint8_t)(FrameSize / PACKET_1K_SIZE));
+            }
+            if (Sparse)
+            {
+                SendByte(SPARSE);
+            }
+            SendByte(Streaming ? STREAM : CRC16);
+        }
+
+        /// @brief  Asks the host to send the packet again after it arrived broken or not at all. The rest of it is
+        ///         purged first, so the retransmission starts on a quiet line. YModem-G has no retransmission, there
+        ///         as well as after `MAX_ERRORS` errors in a row the transfer is cancelled instead.
+        /// @param errors The errors in a row so far, counted up.
+        /// @return False if the transfer has been cancelled.
+        static bool RequestRetransmission(uint8_t* errors)
+        {
+            if (Streaming || ++*errors > MAX_ERRORS)
+            {
+                SendByte(CA);
+                SendByte(CA);
+                FinishCommunication();
+                return false;
+            }
+
+            Purge();
+            SendByte(NAK);
+            return true;
+        }
+
+        /// @brief  Receives a whole YModem packet. Feeds the bytes to `Memory.Parser` as they arrive and keeps the flash
+        ///         going meanwhile, a cooperative loop around the parser that returns at its first event.
+        /// @param packet The packet to fill.
+        /// @param payload The buffer to receive the payload into, `MaxPacketSize` bytes.
+        /// @param packetLength The pointer to store the length of the payload.
+        /// @param timeout The time in milliseconds to wait for the packet to start.
+        /// @return The receive status.
+        static ReceivePacketResult ReceivePacket(PacketFrame* packet, uint8_t* payload, int32_t* packetLength, uint32_t timeout)
+        {
+            PROFILE_PHASE(Receive);
+
+            PacketParser<MaxPacketSize>& parser = Memory.Parser;
+            parser.Begin(packet, payload, FrameSize, Sparse);
+            uint32_t deadline = Deadline(timeout);
+
+            while (true)
+            {
+                Memory.Writer.Poll();
+
+                // Whatever has arrived goes in, as much as the current field takes, so the payload lands in place
+                uint32_t available = Link->Available();
+                if (available > 0)
+                {
+                    uint16_t room;
+                    uint8_t* destination = parser.Destination(&room);
+                    if (available < room)
+                    {
+                        room = (uint16_t)available;
+                    }
+
+                    ParseEvent event = parser.Advance(Link->Read(destination, room));
+                    switch (event)
+                    {
+                        case ParseEvent::None:
+                            // Within a packet the line may only pause briefly, a cancel waits for its second CA
+                            deadline = Deadline(parser.IsCancelling() ? BYTE_TIMEOUT : PACKET_TIMEOUT);
+                            continue;
+
+                        case ParseEvent::Packet:
+                            *packetLength = parser.GetPayloadSize();
+                            return ReceivePacketResult::Ok;
+
+                        case ParseEvent::FileDone:
+                            return ReceivePacketResult::FileDone;
+
+                        case ParseEvent::Aborted:
+                            *packetLength = 0;
+                            return ReceivePacketResult::Aborted;
+
+                        case ParseEvent::Malformed:
+                            return ReceivePacketResult::Malformed;
+
+                        default:
+                            return ReceivePacketResult::Unknown;
+                    }
+                }
+
+                if (Expired(deadline))
+                {
+                    return parser.IsIdle() ? ReceivePacketResult::InitialByteFail
+                        : parser.IsCancelling() ? ReceivePacketResult::Unknown
+                        : ReceivePacketResult::Incomplete;
+                }
+
+                if (Memory.Writer.IsWaiting())
+                {
+                    Time->Idle();
+                }
+            }
+        }
+
+        /// @brief  Looks up an extension option in the metadata of a file name packet. Options follow the standard
+        ///         fields as space separated `key=value` tokens, stock senders do not send any.
+        /// @param metadata The metadata following the file name.
+        /// @param length The maximum length of the metadata, it ends earlier at a NUL character.
+        /// @param key The name of the option.
+        /// @return The start of the option's value, which ends at a space or NUL character. Null if not present.
+        static const uint8_t* FindHeaderOption(const uint8_t* metadata, int32_t length, const char* key)
+        {
+            int32_t keyLength = strlen(key);
+
+            for (int32_t i = 0; i < length && metadata[i] != '\0'; i++)
+            {
+                bool tokenStart = i == 0 || metadata[i - 1] == ' ';
+
+                if (tokenStart
+                    && i + keyLength < length
+                    && memcmp(&metadata[i], key, keyLength) == 0
+                    && metadata[i + keyLength] == '=')
+                {
+                    return &metadata[i + keyLength + 1];
+                }
+            }
+
+            return nullptr;
+        }
+
+        /// @brief Parses a comma separated list of hexadecimal numbers, as used by the `delta` header option.
+        /// @param text The text to parse, ends at a space or NUL character.
+        /// @param values The array to store the numbers in.
+        /// @param maxCount The capacity of `values`.
+        /// @return The amount of numbers parsed, 0 if the list is malformed.
+        static uint8_t ParseHexList(const uint8_t* text, uint32_t* values, uint8_t maxCount)
+        {
+            uint8_t count = 0;
+            uint8_t digits = 0;
+            uint32_t value = 0;
+
+            while (true)
+            {
+                uint8_t character = *text++;
+
+                if (ISVALIDHEX(character))
+                {
+                    if (++digits > 8)
+                    {
+                        return 0;
+                    }
+
+                    value = (value << 4) + CONVERTHEX(character);
+                    continue;
+                }
+
+                if (digits == 0 || count == maxCount)
+                {
+                    return 0;
+                }
+
+                values[count++] = value;
+                digits = 0;
+                value = 0;
+
+                if (character != ',')
+                {
+                    return count;
+                }
+            }
+        }
+
+        /// @brief  Checks the address a data file asked for with the `addr` option. Data files take whole sectors of
+        ///         their own past the end of the image, so the lazy erases of the writer can neither reach the
+        ///         bootloader nor the image. They may share the sector of the descriptor log, see `RecordFile`.
+        /// @param address The absolute address of the file.
+        /// @param size The size of the file in flash.
+        static bool IsDataRegion(uint32_t address, uint32_t size)
+        {
+            int32_t offset = (int32_t)(address - Hardware::STM32BaseAddress);
+            int8_t sector = Hardware::SectorOf(offset);
+
+            if (sector < 0 || Hardware::SectorOffsets[sector] != offset
+                || offset > Hardware::DescriptorLogOffset || size > (uint32_t)(Hardware::DescriptorLogOffset - offset))
+            {
+                return false;
+            }
+
+            // Without a complete descriptor there is no image to protect, only the bootloader
+            int32_t imageEnd = Hardware::FirmwareBinaryFileOffset;
+            ImageRecord record;
+            if (ImageDescriptor::FindLatest(Flash, &record))
+            {
+                imageEnd += record.Size;
+            }
+
+            return offset >= imageEnd;
+        }
+
+        /// @brief  Finds where an interrupted update of the same image stopped. The latest record has to be the
+        ///         progress of an image of the same size, and the flash up to its offset has to match the digests the
+        ///         host sent for the new image.
+        /// @param imageSize The size of the new image.
+        /// @param digests The digests of the new image from the `delta` header option.
+        /// @param digestCount The amount of digests.
+        /// @param crc The pointer to store the checksum of the image up to the offset.
+        /// @return The offset to continue at, 0 to start over.
+        static uint32_t FindResumeOffset(uint32_t imageSize, const uint32_t* digests, uint8_t digestCount, uint32_t* crc)
+        {
+            ProgressRecord progress;
+
+            if (ImageDescriptor::FindProgress(Flash, &progress) == false
+                || progress.Size != imageSize
+                || progress.Offset >= imageSize
+                || progress.Offset % FlashWriter::DigestChunkSize != 0
+                || progress.Offset / FlashWriter::DigestChunkSize > digestCount)
+            {
+                return 0;
+            }
+
+            for (uint32_t chunk = 0; chunk < progress.Offset / FlashWriter::DigestChunkSize; chunk++)
+            {
+                uint32_t address = ImageDescriptor::ImageAddress + chunk * FlashWriter::DigestChunkSize;
+                uint32_t digest = Crc32::InitialValue;
+
+                for (uint32_t i = 0; i < FlashWriter::DigestChunkSize; i += 4)
+                {
+                    digest = Crc32::UpdateWord(digest, Flash->ReadWord(address + i));
+                }
+
+                if (digest != digests[chunk])
+                {
+                    return 0;
+                }
+            }
+
+            *crc = progress.Crc;
+            return progress.Offset;
+        }
+
+        /// @brief  Process the packet content assuming it's a file name packet (first packet of an YModem transmission)
+        ///         Does not send responses!
+        /// @param payload The payload of the received packet
+        /// @param packetLength The length of the packet's payload
+        /// @return The result of the process
+        static FileNamePacketResult HandleFilenamePacket(const uint8_t* payload, int32_t packetLength)
+        {
+            if (payload[0] == 0)
+            {
+                return FileNamePacketResult::EmptyName;
+            }
+
+            /* Copy file name, it stops at the buffer and leaves room for its terminator within the packet */
+            int32_t fileNameLength = 0;
+            int32_t maxNameLength = packetLength - 1 < FILE_NAME_LENGTH ? packetLength - 1 : FILE_NAME_LENGTH;
+            while (fileNameLength < maxNameLength && payload[fileNameLength] != '\0')
+            {
+                Memory.FileName[fileNameLength] = payload[fileNameLength];
+                fileNameLength++;
+            }
+            Memory.FileName[fileNameLength] = '\0'; // Close file name
+
+            uint8_t fileSizeText[FILE_SIZE_LENGTH + 1];
+            uint8_t fileSizeTextLength = 0;
+            for (int i = 0; i < FILE_SIZE_LENGTH && fileNameLength + 1 + i < packetLength; i++)
+            {
+                uint8_t character = payload[fileNameLength + 1 + i];
+
+                if (character == ' ' || character == '\0')
+                {
+                    break;
+                }
+
+                fileSizeText[i] = character;
+                fileSizeTextLength = i + 1;
+            }
+            fileSizeText[fileSizeTextLength] = '\0';
+
+            int32_t fileSize = 0;
+            Utils::Str2Int(fileSizeText, &fileSize);
+
+            const uint8_t* metadata = &payload[fileNameLength + 1];
+            int32_t metadataLength = packetLength - fileNameLength - 1;
+
+            // A compressed file announces the decoder parameters and the size of the image it expands to, in hex
+            int32_t imageSize = fileSize;
+            const uint8_t* compressionOption = FindHeaderOption(metadata, metadataLength, "heatshrink");
+            Compressed = compressionOption != nullptr;
+            if (Compressed)
+            {
+                uint32_t parameters[3];
+                if (ParseHexList(compressionOption, parameters, 3) != 3
+                    || parameters[0] != HeatshrinkDecoder::WindowBits
+                    || parameters[1] != HeatshrinkDecoder::LookaheadBits)
+                {
+                    return FileNamePacketResult::Unsupported;
+                }
+
+                imageSize = (int32_t)parameters[2];
+            }
+
+            // Files are images unless the `addr` option, an absolute address in hex, puts them into a data region
+            uint32_t address = ImageDescriptor::ImageAddress;
+            const uint8_t* addressOption = FindHeaderOption(metadata, metadataLength, "addr");
+            if (addressOption != nullptr && ParseHexList(addressOption, &address, 1) != 1)
+            {
+                return FileNamePacketResult::BadAddress;
+            }
+            BootImage = address == ImageDescriptor::ImageAddress;
+
+            /* Test the size of the image to be sent */
+            /* Image size is greater than the flash available for it */
+            if (BootImage && (uint32_t)imageSize > (uint32_t)Hardware::MaxImageSize)
+            {
+                return FileNamePacketResult::TooLarge;
+            }
+
+            if (BootImage == false && IsDataRegion(address, (uint32_t)imageSize) == false)
+            {
+                return FileNamePacketResult::BadAddress;
+            }
+
+            // The version is optional, in hex like the other options
+            ImageVersion = 0;
+            const uint8_t* versionOption = FindHeaderOption(metadata, metadataLength, "version");
+            if (versionOption != nullptr)
+            {
+                ParseHexList(versionOption, &ImageVersion, 1);
+            }
+
+            if (BootImage)
+            {
+                // From here on the image changes, the boot path must not trust the old descriptor anymore
+                if (InvalidateDescriptor() == false)
+                {
+                    return FileNamePacketResult::FlashError;
+                }
+            }
+            else
+            {
+                KeepRecord = ImageDescriptor::FindLatest(Flash, &KeptRecord);
+            }
+
+            // Digests of the image in `FlashWriter::DigestChunkSize` chunks let the writer leave unchanged sectors alone
+            uint8_t digestCount = 0;
+            const uint8_t* deltaOption = FindHeaderOption(metadata, metadataLength, "delta");
+            if (deltaOption != nullptr && imageSize > 0)
+            {
+                digestCount = ParseHexList(deltaOption, Memory.Digests, FlashWriter::MaxDigests);
+            }
+
+            // A host that can continue an interrupted update of the same image skips what is in flash already
+            uint32_t resumeCrc = 0;
+            ResumeOffered = FindHeaderOption(metadata, metadataLength, "resume") != nullptr;
+            ResumeOffset = 0;
+            Rewinds = 0;
+            if (ResumeOffered && BootImage)
+            {
+                ResumeOffset = FindResumeOffset((uint32_t)imageSize, Memory.Digests, digestCount, &resumeCrc);
+            }
+
+            // No up front erase, the writer erases each sector when the first data enters it
+            FileAddress = address;
+            ImageSize = imageSize;
+            RegionSize = BootImage ? Hardware::MaxImageSize : Hardware::DescriptorLogOffset - (address - Hardware::STM32BaseAddress);
+            Memory.Writer.Begin(Flash, address + ResumeOffset);
+
+            // The prefix has to read back as it was when its progress was saved
+            if (ResumeOffset > 0 && Memory.Writer.Resume(address) != resumeCrc)
+            {
+                ResumeOffset = 0;
+                Memory.Writer.Begin(Flash, address);
+            }
+
+            // The host compresses only the rest of the file, so its size on the wire is not known here
+            FileSize = ResumeOffset > 0 && Compressed ? 0 : fileSize - (int32_t)ResumeOffset;
+            BytesRemaining = FileSize;
+            ImageOffset = ResumeOffset;
+            CheckpointOffset = 0;
+            Memory.Decoder.Begin(imageSize - (int32_t)ResumeOffset);
+
+            // Records, e.g. the progress of this update, do not cost an erase of a sector the image finds blank. A full
+            // descriptor log has to be erased though, it must not survive as part of an unchanged sector either.
+            Memory.Writer.PreserveArea(ImageDescriptor::LogAddress, Hardware::DescriptorLogSize);
+            if (BootImage && ImageDescriptor::FreeSlot(Flash) == ImageDescriptor::SlotCount)
+            {
+                Memory.Writer.RequireErase(ImageDescriptor::LogSector());
+            }
+            DecodedLength = 0;
+
+            uint8_t skippedDigests = (uint8_t)(ResumeOffset / FlashWriter::DigestChunkSize);
+            if (digestCount > skippedDigests)
+            {
+                Memory.Writer.SetReference(&Memory.Digests[skippedDigests], digestCount - skippedDigests, imageSize - ResumeOffset);
+            }
+
+            // Hosts that can stream announce it, stock senders only understand 'C' and get plain YModem
+            Streaming = FindHeaderOption(metadata, metadataLength, "stream") != nullptr;
+
+            // Hosts that can send extended frames announce the largest, in hex. The frames are the largest power of
+            // two up to that and the buffers of this build, so they keep ending at sector starts. Less than 2K is
+            // left to the standard packets.
+            FrameSize = 0;
+            uint32_t frameLimit;
+            const uint8_t* frameOption = FindHeaderOption(metadata, metadataLength, "frame");
+            if (frameOption != nullptr && ParseHexList(frameOption, &frameLimit, 1) == 1)
+            {
+                uint32_t frameSize = PACKET_1K_SIZE;
+                while (frameSize * 2 <= frameLimit && frameSize * 2 <= MaxPacketSize)
+                {
+                    frameSize *= 2;
+                }
+                FrameSize = frameSize > PACKET_1K_SIZE ? (uint16_t)frameSize : 0;
+            }
+
+            // Erased flash reads as the erased value already, hosts that know it leave runs of it out of the file.
+            // A compressed file has them compressed away instead.
+            Sparse = Compressed == false && FindHeaderOption(metadata, metadataLength, "sparse") != nullptr;
+
+            return FileNamePacketResult::Ok;
+        }
+
+        /// @brief  Handles a data packet by queueing its payload for programming. Only waits for the flash when the
+        ///         writer is a full buffer behind, otherwise the packet is programmed while the next one arrives.
+        ///         Does not send responses!
+        /// @param packet The received packet
+        /// @param packetLength The length of the packet's payload
+        /// @return The result of the process
+        static DataPacketResult HandleDataPacket(const PacketFrame& packet, int32_t packetLength)
+        {
+            // A skip frame stands for the run of the erased value it gives the length of
+            bool skip = packet.Header[0] == SKP;
+            if (skip)
+            {
+                uint32_t runLength;
+                memcpy(&runLength, packet.Payload, sizeof(runLength));
+                packetLength = runLength < (uint32_t)INT32_MAX ? (int32_t)runLength : INT32_MAX;
+            }
+
+            // The last packet is padded, do not program past the announced end of the file
+            if (FileSize > 0)
+            {
+                if (packetLength > BytesRemaining)
+                {
+                    packetLength = BytesRemaining;
+                }
+
+                BytesRemaining -= packetLength;
+            }
+
+            // Nor past the end of its region, which is all that bounds a file without a size. Only the padding of the
+            // last packet may reach beyond it, data that starts there or a skip run that ends there is refused. The
+            // decoder of a compressed file stops at the image size, which was checked against the region already.
+            uint32_t room = RegionSize - ImageOffset;
+            if (Compressed == false && (uint32_t)packetLength > room)
+            {
+                if (room == 0 || skip)
+                {
+                    return DataPacketResult::TooLarge;
+                }
+
+                packetLength = (int32_t)room;
+            }
+
+            if (packetLength == 0)
+            {
+                return DataPacketResult::Ok;
+            }
+
+            if (skip)
+            {
+                return FillErased((uint32_t)packetLength);
+            }
+
+            if (Compressed)
+            {
+                return DecodeData(packet.Payload, (uint16_t)packetLength);
+            }
+
+            // Usually the payload was received right into the writer's free buffer and only has to be queued
+            if (packet.Payload != Memory.Writer.GetFreeBuffer())
+            {
+                if (WaitForFreeBuffer() == false)
+                {
+                    return DataPacketResult::FlashError;
+                }
+
+                memcpy(Memory.Writer.GetFreeBuffer(), packet.Payload, packetLength);
+            }
+
+            if (CommitBuffer((uint16_t)packetLength) == false)
+            {
+                return DataPacketResult::FlashError;
+            }
+
+            return DataPacketResult::Ok;
+        }
+
+        /// @brief  Queues a run of the erased value for a skip frame, a buffer at a time. The writer does not program
+        ///         words of the erased value, so the run costs neither the wire nor programming, only its checksum.
+        /// @param length The length of the run.
+        /// @return The result of the process
+        static DataPacketResult FillErased(uint32_t length)
+        {
+            SkippedBytes += length;
 
-    /// @brief The name of the file is empty
-    EmptyName,
+            while (length > 0)
+            {
+                if (WaitForFreeBuffer() == false)
+                {
+                    return DataPacketResult::FlashError;
+                }
 
-    /// @brief The file is too large, does not fit in the MCU's flash memory
-    TooLarge,
-};
+                uint16_t chunk = length < PacketWriter::BufferSize ? (uint16_t)length : PacketWriter::BufferSize;
+                memset(Memory.Writer.GetFreeBuffer(), 0xFF, chunk);
+                if (CommitBuffer(chunk) == false)
+                {
+                    return DataPacketResult::FlashError;
+                }
 
-enum struct DataPacketResult : uint8_t {
-    /// @brief The data packet is valid and processed
-    Ok,
-};
+                length -= chunk;
+            }
 
-enum struct ClosingPacketResult : uint8_t {
-    /// @brief The closing packet is valid and processed
-    Ok,
-};
+            return DataPacketResult::Ok;
+        }
 
-class YModem {
-    private:
-        static uint8_t FileName[128];
+        /// @brief  Queues the writer's free buffer like `FlashWriter::Commit`, and saves the progress of an image at
+        ///         sector starts. The progress of a sector start is only saved once the first buffer after it has
+        ///         been programmed: the sector has been prepared then, so an erase of the log sharing it can not
+        ///         take the record along anymore.
+        /// @param length The length of the data in the buffer.
+        /// @return False if the flash reported an error.
+        static bool CommitBuffer(uint16_t length)
+        {
+            if (BootImage)
+            {
+                if (CheckpointOffset != 0 && ImageOffset >= CheckpointOffset + PacketWriter::BufferSize)
+                {
+                    if (WaitForDrain() == false || SaveProgress(CheckpointOffset, CheckpointCrc) == false)
+                    {
+                        return false;
+                    }
 
-        /// @brief  Tries to read a byte from the serial USB. If not available, waits 30 seconds before
-        ///         returning a timeout error.
-        /// @param out The pointer to write the received byte.
-        /// @return The status of the receiving.
-        static ReceiveByteResult ReceiveByte(uint8_t* out) {
-            uint32_t start = millis();
-            while (millis() < start + 5000) {
-                if (SerialUSB.available())
+                    CheckpointOffset = 0;
+                }
+
+                int32_t offset = (int32_t)(FileAddress - Hardware::STM32BaseAddress + ImageOffset);
+                int8_t sector = Hardware::SectorOf(offset);
+                // Also the sector the session resumes at, in case preparing it erases the log
+                if (ImageOffset > 0 && sector >= 0 && Hardware::SectorOffsets[sector] == offset)
                 {
-                    *out = (uint8_t)SerialUSB.read();
-                    return ReceiveByteResult::Ok;
+                    CheckpointOffset = ImageOffset;
+                    CheckpointCrc = Memory.Writer.GetCrc();
                 }
             }
 
-            return ReceiveByteResult::TimedOut;
+            if (Memory.Writer.Commit(length) == false)
+            {
+                return false;
+            }
+
+            ImageOffset += length;
+            return true;
         }
 
-        /// @brief Sends a single byte to the host.
-        /// @param data The byte to send.
-        static void SendByte(uint8_t data)
+        /// @brief  Appends the progress of the image to the log, with the writer idle and the flash unlocked. The last
+        ///         slot is kept for the descriptor, the log is only erased along with the image.
+        /// @return False if the flash reported an error.
+        static bool SaveProgress(uint32_t offset, uint32_t crc)
         {
-            SerialUSB.write(data);
+            ProgressRecord latest;
+            if (ImageDescriptor::FindProgress(Flash, &latest) && latest.Size == (uint32_t)ImageSize && latest.Offset == offset)
+            {
+                return true;
+            }
+
+            uint8_t slot = ImageDescriptor::FreeSlot(Flash);
+            if (slot >= ImageDescriptor::SlotCount - 1)
+            {
+                return true;
+            }
+
+            ProgressRecord record = ImageDescriptor::MakeProgress((uint32_t)ImageSize, offset, crc);
+            return ProgramRecord(slot, &record);
         }
 
-        /// @brief Routines when the YModem communication is completely finished
-        static void FinishCommunication()
+        /// @brief Programs a record into a blank slot of the log, the flash has to be unlocked.
+        /// @return False if the flash reported an error.
+        static bool ProgramRecord(uint8_t slot, const void* record)
         {
-            SerialUSB.flush();
+            uint32_t address = ImageDescriptor::SlotAddress(slot);
+            const uint32_t* words = (const uint32_t*)record;
+
+            for (uint8_t i = 0; i < sizeof(ImageRecord) / 4; i++)
+            {
+                Flash->BeginProgramWord(address + i * 4, words[i]);
+                if (WaitForFlash() == false)
+                {
+                    return false;
+                }
+            }
+
+            return true;
         }
 
-        /// @brief Receives a whole YModen packet.
-        /// @param outputBuffer The buffer to write the packet to.
-        /// @param packetLength The pointer to store the length of the packet.
-        /// @return The receive status.
-        static ReceivePacketResult ReceivePacket(uint8_t* outputBuffer, int32_t* packetLength)
+        /// @brief  Answers the EOT of a file whose flash did not read back as programmed: the sector that failed is
+        ///         programmed again, the host continues at its start. The answer is the one to the `resume` option,
+        ///         'R' and the offset, which the host then sends the rest of the file from like a resumed update.
+        /// @return False if the host did not offer `resume`, or the file has been rewound `MAX_REWINDS` times.
+        static bool RewindToMismatch()
         {
-            uint16_t packetSize = 0;
-            uint8_t receivedByte = 0;
+            uint32_t address = Memory.Writer.GetMismatchAddress();
+            int32_t flashOffset = (int32_t)(address - Hardware::STM32BaseAddress);
+            int8_t sector = Hardware::SectorOf(flashOffset);
 
-            // Get and analyze Packet Header
-            auto result = ReceiveByte(&receivedByte);
-
-            if (result != ReceiveByteResult::Ok)
+            // A file that starts within a sector can not have that sector erased again
+            if (ResumeOffered == false || Rewinds >= MAX_REWINDS || sector < 0 || Hardware::SectorOffsets[sector] != flashOffset)
             {
-                return ReceivePacketResult::InitialByteFail;
+                return false;
             }
 
-            switch (receivedByte)
+            Rewinds++;
+            Memory.Writer.Rewind(address);
+            Memory.Writer.Resume(FileAddress);
+
+            // A compressed file is compressed again from the offset on, its size on the wire is not known here
+            ResumeOffset = address - FileAddress;
+            FileSize = Compressed ? 0 : ImageSize - (int32_t)ResumeOffset;
+            BytesRemaining = FileSize;
+            ImageOffset = ResumeOffset;
+            CheckpointOffset = 0;
+            DecodedLength = 0;
+            Memory.Decoder.Begin(ImageSize - (int32_t)ResumeOffset);
+            TRACE_STATE(Rewind, ResumeOffset);
+
+            SendResume();
+            return true;
+        }
+
+        /// @brief Keeps the writer going until everything queued has been programmed.
+        /// @return False if the flash reported an error.
+        static bool WaitForDrain()
+        {
+            while (Memory.Writer.IsDrained() == false)
             {
-                case SOH:
-                    packetSize = PACKET_SIZE;
-                    break;
+                if (Memory.Writer.Poll() != FlashWriterResult::Ok)
+                {
+                    return false;
+                }
 
-                case STX:
-                    packetSize = PACKET_1K_SIZE;
-                    break;
+                if (Memory.Writer.IsWaiting())
+                {
+                    Time->Idle();
+                }
+            }
 
-                // Reached the end of transmission
-                case EOT:
-                    return ReceivePacketResult::FileDone;
+            return true;
+        }
 
-                case CA:
-                    if ((ReceiveByte(&receivedByte) == ReceiveByteResult::Ok) && (receivedByte == CA))
-                    {
-                        *packetLength = 0;
-                        return ReceivePacketResult::Aborted;
-                    }
-                    else
-                    {
-                        // Was expecting second CA
-                        return ReceivePacketResult::Unknown;
-                    }
-                case ABORT1:
-                case ABORT2:
-                    return ReceivePacketResult::Aborted;
+        /// @brief Keeps the writer going until it has a free buffer.
+        /// @return False if the flash reported an error.
+        static bool WaitForFreeBuffer()
+        {
+            while (Memory.Writer.HasFreeBuffer() == false)
+            {
+                if (Memory.Writer.Poll() != FlashWriterResult::Ok)
+                {
+                    return false;
+                }
 
-                default:
-                    return ReceivePacketResult::Unknown;
+                if (Memory.Writer.IsWaiting())
+                {
+                    Time->Idle();
+                }
             }
 
-            // Receive Packet Data
-            outputBuffer[0] = receivedByte;
-            Utils::Int2Str(&tst[0], packetSize);
-            for (uint16_t i = 1; i < (packetSize + PACKET_OVERHEAD); i++)
+            return true;
+        }
+
+        /// @brief Waits for the flash operation in progress.
+        /// @return False if the flash reported an error.
+        static bool WaitForFlash()
+        {
+            FlashStatus status;
+            while ((status = Flash->GetStatus()) == FlashStatus::Busy)
             {
-                if (ReceiveByte(&outputBuffer[i]) != ReceiveByteResult::Ok)
-                {
-                    return ReceivePacketResult::Incomplete;
-                }
+                Time->Idle();
             }
 
-            if (outputBuffer[PACKET_SEQNO_INDEX] != ((outputBuffer[PACKET_SEQNO_COMP_INDEX] ^ 0xff) & 0xff))
+            return status == FlashStatus::Ready;
+        }
+
+        /// @brief  Clears the magic of the latest descriptor. Programming only clears bits, so this needs no erase and
+        ///         the record stays in its slot, where it keeps older records from counting again.
+        /// @return False if the flash reported an error.
+        static bool InvalidateDescriptor()
+        {
+            ImageRecord record;
+            uint8_t slot;
+
+            if (ImageDescriptor::FindLatest(Flash, &record, &slot) == false)
             {
-                return ReceivePacketResult::Malformed;
+                return true;
             }
 
-            *packetLength = packetSize;
-            return ReceivePacketResult::Ok;
+            Flash->ClearError();
+            Flash->Unlock();
+            Flash->BeginProgramWord(ImageDescriptor::SlotAddress(slot), 0);
+            bool written = WaitForFlash();
+            Flash->Lock();
+
+            return written;
         }
 
-        /// @brief  Process the packet content assuming it's a file name packet (first packet of an YModem transmission)
-        ///         Does not send responses!
-        /// @param packetBuffer The buffer containing the received packet
-        /// @return The result of the process
-        static FileNamePacketResult HandleFilenamePacket(uint8_t* packetBuffer)
+        /// @brief  Records a file that has been programmed completely. An image gets its descriptor, with the CRC32
+        ///         the writer computed while the data passed through. A data file leaves the descriptor alone, unless
+        ///         the writer had to erase the sector of the log for it: then the record it found is put back.
+        /// @return False if the flash reported an error.
+        static bool RecordFile()
         {
-            if (packetBuffer[PACKET_HEADER] == 0)
+            // An image sent without a size is as large as what was written of it, the padding of its last packet too
+            if (BootImage)
             {
-                return FileNamePacketResult::EmptyName;
+                uint32_t size = ImageSize > 0 ? (uint32_t)ImageSize : ImageOffset;
+                return AppendRecord(ImageDescriptor::Make(size, Memory.Writer.GetCrc(), ImageVersion));
             }
 
-            /* Copy file name */
-            int fileNameLength;
-            for (int i = 0; i < FILE_NAME_LENGTH; i++)
+            ImageRecord record;
+            if (KeepRecord == false || ImageDescriptor::FindLatest(Flash, &record))
             {
-                uint8_t character = packetBuffer[PACKET_HEADER + i];
+                return true;
+            }
+
+            return AppendRecord(KeptRecord);
+        }
+
+        /// @brief  Appends a record to the descriptor log. A full log is erased first, unless the file reaches into
+        ///         its sector: then the writer has erased it already.
+        /// @return False if the flash reported an error.
+        static bool AppendRecord(const ImageRecord& record)
+        {
+            uint8_t slot = ImageDescriptor::FreeSlot(Flash);
+            bool written = true;
+
+            Flash->ClearError();
+            Flash->Unlock();
 
-                if (character == '\0')
+            if (slot == ImageDescriptor::SlotCount)
+            {
+                uint8_t sector = ImageDescriptor::LogSector();
+                if (FileAddress + ImageSize > (uint32_t)(Hardware::STM32BaseAddress + Hardware::SectorOffsets[sector]))
                 {
-                    break;
+                    Flash->Lock();
+                    return false;
                 }
 
-                FileName[i] = character;
-                fileNameLength = i;
+                Flash->BeginEraseSector(sector);
+                written = WaitForFlash();
+                FlashStats.SectorsErased++;
+                slot = 0;
             }
-            fileNameLength++;
-            FileName[fileNameLength] = '\0'; // Close file name
 
-            uint8_t fileSizeText[16];
-            uint8_t fileSizeTextLength = 0;
-            for (int i = 0; i < FILE_SIZE_LENGTH; i++)
+            written = written && ProgramRecord(slot, &record);
+
+            Flash->Lock();
+            return written && ImageDescriptor::IsComplete(ImageDescriptor::ReadSlot(Flash, slot));
+        }
+
+        /// @brief  Expands compressed file data straight into the writer's free buffer. A buffer is only queued once
+        ///         full, so it usually collects the output of several packets, while a packet of padding can fill
+        ///         several buffers.
+        /// @param data The compressed data.
+        /// @param length The length of the compressed data.
+        /// @return The result of the process
+        static DataPacketResult DecodeData(const uint8_t* data, uint16_t length)
+        {
+            while (Memory.Decoder.IsDone() == false)
             {
-                uint8_t character = packetBuffer[fileNameLength + 1 + i];
+                if (WaitForFreeBuffer() == false)
+                {
+                    return DataPacketResult::FlashError;
+                }
 
-                if (character == ' ')
+                uint16_t produced;
+                uint16_t used;
                 {
-                    break;
+                    PROFILE_PHASE(Decompress);
+                    used = Memory.Decoder.Decode(data, length, Memory.Writer.GetFreeBuffer() + DecodedLength, PacketWriter::BufferSize - DecodedLength, &produced);
                 }
 
-                fileSizeText[i] = character;
-                fileSizeTextLength = i;
-            }
-            fileSizeText[fileSizeTextLength + 1] = '\0';
+                data += used;
+                length -= used;
+                DecodedLength += produced;
 
-            int32_t fileSize = 0;
-            Utils::Str2Int(fileSizeText, &fileSize);
+                if (DecodedLength < PacketWriter::BufferSize && Memory.Decoder.IsDone() == false)
+                {
+                    // The input is used up, the next packet continues filling this buffer
+                    break;
+                }
 
-            /* Test the size of the image to be sent */
-            /* Image size is greater than Flash size */
-            if (fileSize > (Hardware::FlashSize))
-            {
-                return FileNamePacketResult::TooLarge;
+                if (CommitBuffer(DecodedLength) == false)
+                {
+                    return DataPacketResult::FlashError;
+                }
+                DecodedLength = 0;
             }
-            
-            /* erase user application area */
-            // TODO
-            // flash_err = FLASH_If_Erase(APPLICATION_ADDRESS);
-            // if (flash_err != 0)
-            // {
-            //     /* End session */
-            //     SendByte(CA);
-            //     SendByte(CA);
-            //     return -3;
-            // }
 
-            return FileNamePacketResult::Ok;
+            return DataPacketResult::Ok;
         }
 
-        /// @brief WIP, Handles a data packet
+        /// @brief  Process the packet received after the end of transmission. Its CRC16 has already been validated
+        ///         by `ReceivePacket`, it must be an empty header packet (sequence 0, no file name).
+        /// @param packet The received packet
         /// @return The result of the process
-        static DataPacketResult HandleDataPacket()
+        static ClosingPacketResult HandleCRC16ClosingPacket(const PacketFrame& packet)
         {
-            // memcpy(buf_ptr, packet_data + PACKET_HEADER, packet_length);
-            // ramsource = (uint32_t)buf;
+            if (packet.Header[PACKET_SEQNO_INDEX] != 0 || packet.Payload[0] != 0)
+            {
+                return ClosingPacketResult::Malformed;
+            }
 
-            return DataPacketResult::Ok;
-            
-            /* Write received data in Flash */
-            // TODO
-            // if (FLASH_If_Write(&flashdestination, (uint32_t*) ramsource, (uint16_t) packet_length/4)  == 0)
-            // {
-            //     Send_Byte(ACK);
-            // }
-            // else /* An error occurred while writing to Flash memory */
-            // {
-            //     /* End session */
-            //     Send_Byte(CA);
-            //     Send_Byte(CA);
-            //     return -2;
-            // }
-        }
-
-        static ClosingPacketResult HandleCRC16ClosingPacket(uint8_t* packetBuffer)
-        {
-            // TODO: Validate CRC16
             return ClosingPacketResult::Ok;
         }
 
     public:
         /// @brief Initializes the required hardwares for the YModem protocol
-        static void Init() {
-            SerialUSB.begin();
+        /// @param link The byte stream to the host.
+        /// @param clock The time source for timeouts.
+        /// @param flash The flash received files are written to.
+        static void Init(TTransport* link, Clock* clock, TFlash* flash) {
+            Link = link;
+            Time = clock;
+            Flash = flash;
+            Link->Begin();
+        }
+
+        /// @return The RAM all buffers of a session take, see `Arena`.
+        static constexpr size_t ArenaSize()
+        {
+            return sizeof(Arena);
+        }
+
+        /// @brief  The sector statistics of the files of the last session: how many sectors were erased, skipped as
+        ///         blank or left alone as unchanged, and the flash time that saved.
+        static const FlashWriterStats& GetFlashStats()
+        {
+            return FlashStats;
+        }
+
+        /// @brief The file bytes of the last session that came as skip frames instead of data packets.
+        static uint32_t GetSkippedBytes()
+        {
+            return SkippedBytes;
+        }
+
+        /// @brief  Sets the time the previous boot took from the start of the core to the application, for the `INFO`
+        ///         answer. The target keeps it in a backup register across the reset into the upload window.
+        /// @param micros The time in microseconds, 0 if not known.
+        static void SetLastBootMicros(uint32_t micros)
+        {
+            LastBootMicros = micros;
+        }
+
+        /// @brief  Answers queries of the host after a session, for the statistics, the image descriptor or the trace,
+        ///         until it has been quiet for `timeout` milliseconds.
+        static void ServeCommands(uint32_t timeout)
+        {
+            uint8_t command;
+
+            while (ReceiveByte(&command, Deadline(timeout)) == ReceiveByteResult::Ok)
+            {
+                if (command == STATS)
+                {
+                    SendStats();
+                }
+                else if (command == INFO)
+                {
+                    SendInfo();
+                }
+                else if (command == TRACE)
+                {
+                    SendTrace();
+                }
+            }
         }
 
-        /// @brief Attempts to receive a firmware from a host.
-        /// @param outputBuffer The pointer to a memory where the received file should be stored.
-        /// @param fileSize Pointer to where the received file's size should be written
-        static ReceiveFileResult ReceiveFile(uint8_t* outputBuffer, int32_t* fileSize)
+        /// @brief  Attempts to receive a batch of files from a host: the image and data files, each announced by its
+        ///         own header packet, until the empty header packet ends the session.
+        /// @param fileSize Pointer to where the size of the last received file should be written
+        static ReceiveFileResult ReceiveFile(int32_t* fileSize)
         {
-            uint8_t packetBuffer[PACKET_1K_SIZE + PACKET_OVERHEAD];
+            TRACE_CLEAR();
+            TRACE_STATE(Session, MaxPacketSize);
+            ReceiveFileResult result = ReceiveSession(fileSize);
+            TRACE_STATE(End, result);
+            return result;
+        }
+
+    private:
+        /// @brief The session of `ReceiveFile`, traced as a whole around it.
+        static ReceiveFileResult ReceiveSession(int32_t* fileSize)
+        {
+            PacketFrame packet;
             int32_t packetLength;
             // The amount of packets we successfully received
             int32_t packetsReceived = 0;
-            volatile uint32_t /*flashdestination,*/ ramsource, flash_err;
+            // The packets in a row that arrived broken or not at all
+            uint8_t errors = 0;
             uint8_t fileClosed = false;
+            // Whether the file continues at a sector that failed verification and no data has arrived since
+            bool rewound = false;
+            Streaming = false;
+            FrameSize = 0;
+            Sparse = false;
+            SkippedBytes = 0;
+            FlashStats = {};
+            PROFILE_RESET();
 
             while (true)
             {
-                auto packetResult = ReceivePacket(&packetBuffer[0], &packetLength);
+                // The reply to the previous packet goes out before anything can hold it up, e.g. a busy flash
+                SendReply();
+
+                // The host may take a while to start the session, once running packets follow each other closely
+                // and a missing one is asked for again
+                bool started = packetsReceived > 0 || fileClosed;
+                uint32_t timeout = started == false ? NAK_TIMEOUT : Streaming ? BYTE_TIMEOUT : RETRY_TIMEOUT;
+                uint8_t* payload = Memory.Payload;
+
+                // File data goes straight into the buffer it is programmed from, so wait until the writer has one
+                if (packetsReceived > 0 && fileClosed == false && Compressed == false)
+                {
+                    if (WaitForFreeBuffer() == false)
+                    {
+                        SendByte(CA);
+                        SendByte(CA);
+                        FinishCommunication();
+                        return ReceiveFileResult::Failed;
+                    }
+
+                    payload = Memory.Writer.GetFreeBuffer();
+                }
+
+                auto packetResult = ReceivePacket(&packet, payload, &packetLength, timeout);
+                if (packetResult != ReceivePacketResult::Ok && packetResult != ReceivePacketResult::FileDone)
+                {
+                    TRACE_STATE(PacketError, packetResult);
+                }
 
-                if (packetResult == ReceivePacketResult::InitialByteFail)
+                if (packetResult == ReceivePacketResult::InitialByteFail && started == false)
                 {
                     SendByte(CA);
                     SendByte(CA);
@@ -321,14 +1773,17 @@ class YModem {
                     return ReceiveFileResult::Failed;
                 }
 
-                // If the packet was corrupted
-                if (packetResult == ReceivePacketResult::Unknown
+                // If the packet or our answer to the previous one got lost, or the packet was corrupted
+                if (packetResult == ReceivePacketResult::InitialByteFail
+                    || packetResult == ReceivePacketResult::Unknown
                     || packetResult == ReceivePacketResult::Malformed
                     || packetResult == ReceivePacketResult::Incomplete)
                 {
-                    SendByte(ACK);
-                    FinishCommunication();
-                    return ReceiveFileResult::Failed;
+                    if (RequestRetransmission(&errors) == false)
+                    {
+                        return ReceiveFileResult::Failed;
+                    }
+                    continue;
                 }
 
                 // If the host aborted the packet
@@ -343,6 +1798,66 @@ class YModem {
                 // Special Packet for finishing the file data transfer
                 if (packetResult == ReceivePacketResult::FileDone)
                 {
+                    // The host repeats the EOT when our answer got lost
+                    if (fileClosed)
+                    {
+                        errors = 0;
+                        SendByte(ACK);
+                        SendByte(ACK);
+                        SendByte(CRC16);
+                        continue;
+                    }
+
+                    // Our answer to the EOT that rewound the file got lost
+                    if (rewound)
+                    {
+                        errors = 0;
+                        SendResume();
+                        continue;
+                    }
+
+                    // Before the whole file arrived it is the start byte of a packet garbled on the way. A compressed
+                    // file has to expand to the whole image
+                    if (packetsReceived == 0 || (Compressed ? Memory.Decoder.IsDone() == false : BytesRemaining > 0))
+                    {
+                        if (RequestRetransmission(&errors) == false)
+                        {
+                            return ReceiveFileResult::Failed;
+                        }
+                        continue;
+                    }
+
+                    // Everything has to be in flash before acknowledging the end of the file
+                    while (Memory.Writer.IsDrained() == false)
+                    {
+                        Memory.Writer.Poll();
+
+                        if (Memory.Writer.IsWaiting())
+                        {
+                            Time->Idle();
+                        }
+                    }
+
+                    // Sectors that did not read back as programmed are sent again, the file is not recorded before
+                    auto finishResult = Memory.Writer.Finish();
+                    TRACE_STATE(Eot, finishResult);
+                    if (finishResult == FlashWriterResult::Mismatch && RewindToMismatch())
+                    {
+                        errors = 0;
+                        rewound = true;
+                        continue;
+                    }
+                    FlashStats.Add(Memory.Writer.GetStats());
+
+                    if (finishResult != FlashWriterResult::Ok || RecordFile() == false)
+                    {
+                        SendByte(CA);
+                        SendByte(CA);
+                        FinishCommunication();
+                        return ReceiveFileResult::Failed;
+                    }
+
+                    *fileSize = ImageSize;
                     SendByte(ACK);
                     SendByte(ACK);
                     SendByte(CRC16);
@@ -359,19 +1874,47 @@ class YModem {
                     return ReceiveFileResult::Failed;
                 }
 
-                // Check if the received packet's index matches what we are expecting
+                // In a batch the header packet of the next file takes the place of the closing packet
+                if (fileClosed && packet.Header[PACKET_SEQNO_INDEX] == 0 && packet.Payload[0] != 0)
+                {
+                    fileClosed = false;
+                    packetsReceived = 0;
+                }
+
+                // The host sends a packet again when our ACK got lost, it only needs the answer again
+                if (fileClosed == false && Streaming == false && packetsReceived > 0
+                    && packet.Header[PACKET_SEQNO_INDEX] == (uint8_t)(packetsReceived - 1))
+                {
+                    errors = 0;
+                    if (packetsReceived == 1)
+                    {
+                        AcknowledgeHeader();
+                    }
+                    else
+                    {
+                        SendByte(ACK);
+                    }
+                    continue;
+                }
+
+                // Check if the received packet's index matches what we are expecting, any other one means packets
+                // have been skipped and the file cannot be put together anymore
                 if (fileClosed == false // Only check for non-closing packets. The closing packet is special
-                    && (packetBuffer[PACKET_SEQNO_INDEX] & 0xff) != (packetsReceived & 0xff))
+                    && (packet.Header[PACKET_SEQNO_INDEX] & 0xff) != (packetsReceived & 0xff))
                 {
-                    SendByte(NAK);
+                    SendByte(CA);
+                    SendByte(CA);
                     FinishCommunication();
                     return ReceiveFileResult::Failed;
                 }
 
+                errors = 0;
+
                 // First packet, should contain the file name
                 if (packetsReceived == 0)
                 {
-                    auto fileNameResult = HandleFilenamePacket(packetBuffer);
+                    auto fileNameResult = HandleFilenamePacket(packet.Payload, packetLength);
+                    TRACE_STATE(Header, fileNameResult);
 
                     if (fileNameResult == FileNamePacketResult::EmptyName)
                     {
@@ -379,7 +1922,10 @@ class YModem {
                         FinishCommunication();
                         return ReceiveFileResult::Failed;
                     }
-                    else if (fileNameResult == FileNamePacketResult::TooLarge)
+                    else if (fileNameResult == FileNamePacketResult::TooLarge
+                        || fileNameResult == FileNamePacketResult::Unsupported
+                        || fileNameResult == FileNamePacketResult::FlashError
+                        || fileNameResult == FileNamePacketResult::BadAddress)
                     {
                         SendByte(CA);
                         SendByte(CA);
@@ -387,8 +1933,7 @@ class YModem {
                     else if (fileNameResult == FileNamePacketResult::Ok)
                     {
                         packetsReceived++;
-                        SendByte(ACK);
-                        SendByte(CRC16);
+                        AcknowledgeHeader();
                     }
                     else
                     {
@@ -399,7 +1944,7 @@ class YModem {
                 }
                 else if (fileClosed)
                 {
-                    auto result = HandleCRC16ClosingPacket(packetBuffer);
+                    auto result = HandleCRC16ClosingPacket(packet);
 
                     if (result == ClosingPacketResult::Ok)
                     {
@@ -417,12 +1962,17 @@ class YModem {
                 }
                 else // Regular Data Packets
                 {
-                    auto dataPacketResult = HandleDataPacket();
+                    auto dataPacketResult = HandleDataPacket(packet, packetLength);
 
                     if (dataPacketResult == DataPacketResult::Ok)
                     {
-                        SendByte(ACK);
+                        // In streaming mode the host does not wait, USB flow control holds it back instead
+                        if (Streaming == false)
+                        {
+                            SendByte(ACK);
+                        }
                         packetsReceived++;
+                        rewound = false;
                     }
                     else
                     {
@@ -441,4 +1991,89 @@ class YModem {
         }
 };
 
-uint8_t YModem::FileName[128];
\ No newline at end of file
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+typename YModem<TTransport, TFlash, MaxPacketSize>::Arena YModem<TTransport, TFlash, MaxPacketSize>::Memory;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+TTransport* YModem<TTransport, TFlash, MaxPacketSize>::Link = nullptr;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+Clock* YModem<TTransport, TFlash, MaxPacketSize>::Time = nullptr;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+TFlash* YModem<TTransport, TFlash, MaxPacketSize>::Flash = nullptr;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::FileAddress = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::BootImage = true;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+ImageRecord YModem<TTransport, TFlash, MaxPacketSize>::KeptRecord = {};
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::KeepRecord = false;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::ResumeOffered = false;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::ResumeOffset = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint8_t YModem<TTransport, TFlash, MaxPacketSize>::Rewinds = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::ImageOffset = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::CheckpointOffset = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::CheckpointCrc = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+int32_t YModem<TTransport, TFlash, MaxPacketSize>::FileSize = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+int32_t YModem<TTransport, TFlash, MaxPacketSize>::ImageSize = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::Compressed = false;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint16_t YModem<TTransport, TFlash, MaxPacketSize>::DecodedLength = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+int32_t YModem<TTransport, TFlash, MaxPacketSize>::BytesRemaining = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::RegionSize = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::Streaming = false;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint16_t YModem<TTransport, TFlash, MaxPacketSize>::FrameSize = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+bool YModem<TTransport, TFlash, MaxPacketSize>::Sparse = false;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::SkippedBytes = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+FlashWriterStats YModem<TTransport, TFlash, MaxPacketSize>::FlashStats = {};
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint8_t YModem<TTransport, TFlash, MaxPacketSize>::ReplyQueue[REPLY_QUEUE_SIZE];
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint8_t YModem<TTransport, TFlash, MaxPacketSize>::ReplyLength = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::ImageVersion = 0;
+
+template <typename TTransport, typename TFlash, uint16_t MaxPacketSize>
+uint32_t YModem<TTransport, TFlash, MaxPacketSize>::LastBootMicros = 0;
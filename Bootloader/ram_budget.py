@@ -0,0 +1,36 @@
+# PlatformIO post script: prints the RAM budget of every firmware build, the static RAM in total and the largest
+# objects in it. The session buffers of the YModem engine are the `YModem<...>::Memory` arena.
+Import("env")
+
+import subprocess
+
+
+def print_ram_budget(source, target, env):
+    elf = str(target[0])
+    size_tool = env.subst("$SIZETOOL")
+    nm_tool = size_tool[:-len("size")] + "nm"
+    ram_size = int(env.BoardConfig().get("upload.maximum_ram_size", 64 * 1024))
+
+    sections = {}
+    for line in subprocess.check_output([size_tool, "-A", elf], universal_newlines=True).splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sections[fields[0]] = int(fields[1])
+
+    data = sections.get(".data", 0)
+    bss = sections.get(".bss", 0)
+    reserve = sections.get("._user_heap_stack", 0)
+
+    objects = []
+    for line in subprocess.check_output([nm_tool, "-S", "-C", "--size-sort", elf], universal_newlines=True).splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4 and fields[2] in "bBdD":
+            objects.append((int(fields[1], 16), fields[3]))
+
+    print("RAM budget: %d of %d bytes static (data %d, bss %d), %d reserved for heap and stack"
+        % (data + bss, ram_size, data, bss, reserve))
+    for size, name in sorted(objects, reverse=True)[:8]:
+        print("  %6d  %s" % (size, name))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", print_ram_budget)
@@ -0,0 +1,1649 @@
+// Native benchmark of the bootloader's transfer path: `pio run -e native -t exec`. The behaviour is tested by the
+// suites in test/, `pio test -e native`; the benchmark only checks its runs worked and exits with 1 if one did not.
+//
+// The protocol code runs unchanged against a simulated USB link and flash on a virtual clock. Transfer rates are in
+// virtual time and repeatable, the per packet costs are host CPU time split by `Profiler` (built with
+// `YMODEM_STATS`), useful to compare changes to the hot path but not the target's absolute numbers.
+//
+// With `--replay <trace> [<image>]` it replays a trace saved by the uploader's --trace instead, into flash holding
+// the image the target had before the session, see `ReplayFile`.
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "SpscRing.h"
+#include "ymodem.h"
+#include "host/InfoQuery.h"
+#include "host/Session.h"
+#include "host/StatsQuery.h"
+#include "host/TestImages.h"
+
+/// @brief  The checks that failed, the benchmark exits with an error if there are any. The tests of the behaviour are
+///         the `pio test -e native` suites, these checks only make sure the numbers are of working code.
+static uint32_t Failures;
+
+/// @brief Counts a failed check.
+/// @return The text of the check column.
+static const char* Check(bool ok)
+{
+    Failures += ok ? 0 : 1;
+    return ok ? "ok" : "FAILED";
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// @brief Runs `work` long enough for a stable measurement.
+/// @return The host time of a single run in nanoseconds.
+template <typename Work>
+static double Measure(Work work)
+{
+    uint32_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    do
+    {
+        for (uint32_t i = 0; i < 1000; i++)
+        {
+            work();
+        }
+        iterations += 1000;
+    } while (SecondsSince(start) < 0.2);
+
+    return SecondsSince(start) * 1e9 / iterations;
+}
+
+static volatile uint32_t Sink;
+
+static void BenchmarkCrc()
+{
+    printf("\nCRC16 kernels (host CPU)\n");
+    printf("%-10s %8s %14s %10s\n", "kernel", "payload", "ns/packet", "MB/s");
+
+    std::vector<uint8_t> data = RandomImage(1024, 1);
+    for (uint16_t size : { 128, 1024 })
+    {
+        struct Kernel {
+            const char* Name;
+            uint16_t (*Compute)(const uint8_t*, uint32_t, uint16_t);
+        };
+
+        for (Kernel kernel : { Kernel { "bitwise", Crc16::ComputeBitwise }, Kernel { "table", Crc16::ComputeTable }, Kernel { "sliced", Crc16::ComputeSliced } })
+        {
+            if (kernel.Compute((const uint8_t*)"123456789", 9, 0) != 0x31C3 ||
+                kernel.Compute(data.data(), size, 0) != Crc16::ComputeBitwise(data.data(), size, 0))
+            {
+                printf("%s: MISMATCH\n", kernel.Name);
+                Failures++;
+                continue;
+            }
+
+            double nanos = Measure([&] { Sink = kernel.Compute(data.data(), size, 0); });
+            printf("%-10s %8u %14.1f %10.1f\n", kernel.Name, size, nanos, size / nanos * 1e3);
+        }
+    }
+}
+
+/// @brief Transport over a buffer that is completely received already, isolates the cost of reading.
+class BufferTransport final : public Transport {
+    private:
+        std::vector<uint8_t> data;
+        size_t position = 0;
+
+    public:
+        BufferTransport(const std::vector<uint8_t>& data)
+            : data(data)
+        {
+        }
+
+        void Rewind()
+        {
+            position = 0;
+        }
+
+        void Begin() override
+        {
+        }
+
+        void End() override
+        {
+        }
+
+        uint32_t Available() override
+        {
+            return (uint32_t)(data.size() - position);
+        }
+
+        uint16_t Read(uint8_t* out, uint16_t length) override
+        {
+            memcpy(out, &data[position], length);
+            position += length;
+            return length;
+        }
+
+        void Write(const uint8_t*, uint16_t) override
+        {
+        }
+
+        void Flush() override
+        {
+        }
+};
+
+/// @brief  A session as the host sends it in plain YModem, all in one buffer: the header, `image` in packets of
+///         `packetSize`, the EOT and the closing packet. The replies of the receiver are not waited for.
+static std::vector<uint8_t> BufferedSession(const std::vector<uint8_t>& image, uint16_t packetSize)
+{
+    std::vector<uint8_t> session;
+    auto add = [&](uint8_t sequence, const uint8_t* data, uint16_t length, uint16_t size) {
+        session.insert(session.end(), { (uint8_t)(size == PACKET_SIZE ? SOH : STX), sequence, (uint8_t)~sequence });
+        size_t payload = session.size();
+        session.insert(session.end(), data, data + length);
+        session.resize(payload + size, 0x1A);
+        uint16_t crc = Crc16::Compute(&session[payload], size);
+        session.insert(session.end(), { (uint8_t)(crc >> 8), (uint8_t)crc });
+    };
+
+    uint8_t header[PACKET_SIZE] = {};
+    int length = snprintf((char*)header, sizeof(header), "firmware.bin") + 1;
+    snprintf((char*)&header[length], sizeof(header) - length, "%u", (unsigned)image.size());
+    add(0, header, PACKET_SIZE, PACKET_SIZE);
+
+    uint8_t sequence = 1;
+    for (size_t offset = 0; offset < image.size(); offset += packetSize)
+    {
+        add(sequence++, &image[offset], (uint16_t)std::min((size_t)packetSize, image.size() - offset), packetSize);
+    }
+
+    session.push_back(EOT);
+    uint8_t closing[PACKET_SIZE] = {};
+    add(0, closing, PACKET_SIZE, PACKET_SIZE);
+    return session;
+}
+
+/// @brief  Receiving packet bodies the way it was done before, a byte per call with a timeout check each, against
+///         the shipped `YModem::ReceivePacket`, which drains what is buffered into the field at hand. The latter
+///         runs whole sessions from a buffer and is the `Receive` time of `Profiler`, which leaves out the CRC and
+///         the flash. Both in host CPU time.
+static void BenchmarkReceive()
+{
+    using BufferReceiver = YModem<BufferTransport, SimulatedFlash>;
+
+    printf("\nReceiving packets (host CPU)\n");
+    printf("%-10s %8s %14s %14s %6s\n", "strategy", "payload", "ns/packet", "B/s", "check");
+
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 2);
+    for (uint16_t packetSize : { PACKET_SIZE, PACKET_1K_SIZE })
+    {
+        const uint16_t length = packetSize + PACKET_OVERHEAD - 1;
+        BufferTransport buffer(RandomImage(length, 2));
+        VirtualClock virtualClock;
+        std::vector<uint8_t> packet(length);
+
+        // Called through the interfaces like on the target, keeps the compiler from inlining the loop away
+        Transport* volatile linkPointer = &buffer;
+        Clock* volatile clockPointer = &virtualClock;
+        Transport& link = *linkPointer;
+        Clock& clock = *clockPointer;
+
+        double perByte = Measure([&] {
+            buffer.Rewind();
+            for (uint16_t i = 0; i < length; i++)
+            {
+                uint32_t start = clock.Millis();
+                while (clock.Millis() - start < BYTE_TIMEOUT && link.Available() == 0)
+                {
+                }
+                link.Read(&packet[i], 1);
+            }
+        });
+        printf("%-10s %8u %14.1f %14.0f %6s\n", "per byte", packetSize, perByte, packetSize / perByte * 1e9, "");
+
+        // The best of a few sessions, the first ones warm up the caches
+        BufferTransport session(BufferedSession(image, packetSize));
+        double best = 0;
+        bool ok = true;
+        for (uint8_t run = 0; run < 10; run++)
+        {
+            SimulatedFlash flash(virtualClock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+            session.Rewind();
+            BufferReceiver::Init(&session, &virtualClock, &flash);
+
+            int32_t fileSize = 0;
+            ok = ok && BufferReceiver::ReceiveFile(&fileSize) == ReceiveFileResult::Ok
+                && memcmp(flash.At(ImageDescriptor::ImageAddress), image.data(), image.size()) == 0;
+
+            double nanos = (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Receive] / Profiler::Stats[(uint8_t)ProfilePhase::Receive].Count;
+            best = run == 0 || nanos < best ? nanos : best;
+        }
+        printf("%-10s %8u %14.1f %14.0f %6s\n", "YModem", packetSize, best, packetSize / best * 1e9, Check(ok));
+    }
+}
+
+/// @brief  Feeds a stream of every kind of packet and event to `PacketParser`, split up the way the USB endpoint
+///         hands it over, into random fragments and into single bytes, and checks it always finds the same packets
+///         and events. The cost is host CPU time per byte, including the CRC kept up along the way.
+static void BenchmarkParser()
+{
+    using Parser = PacketParser<PACKET_MAX_FRAME_SIZE>;
+    const uint16_t frameSize = 4096;
+
+    // A header, data packets of every size, skip frames, a garbled packet, a stray byte, an EOT and a cancel
+    std::vector<uint8_t> stream;
+    std::vector<ParseEvent> expected;
+    std::vector<size_t> payloads;
+    std::vector<uint8_t> data = RandomImage(frameSize, 26);
+    auto add = [&](uint8_t start, uint8_t sequence, uint16_t size, bool garbled) {
+        stream.insert(stream.end(), { start, sequence, (uint8_t)~sequence });
+        payloads.push_back(stream.size());
+        stream.insert(stream.end(), data.begin(), data.begin() + size);
+        uint16_t crc = Crc16::ComputeBitwise(data.data(), size, 0) ^ (garbled ? 1 : 0);
+        stream.insert(stream.end(), { (uint8_t)(crc >> 8), (uint8_t)crc });
+        expected.push_back(garbled ? ParseEvent::Malformed : ParseEvent::Packet);
+    };
+
+    add(SOH, 0, PACKET_SIZE, false);
+    for (uint8_t sequence = 1; sequence <= 96; sequence++)
+    {
+        add(sequence % 16 == 0 ? SKP : sequence % 8 == 0 ? SOF : sequence % 5 == 0 ? SOH : STX, sequence,
+            sequence % 16 == 0 ? SKIP_FRAME_SIZE : sequence % 8 == 0 ? frameSize : sequence % 5 == 0 ? PACKET_SIZE : PACKET_1K_SIZE,
+            sequence == 50);
+
+        if (sequence == 70)
+        {
+            stream.push_back(0x7E);
+            expected.push_back(ParseEvent::Unknown);
+        }
+    }
+    stream.push_back(EOT);
+    expected.push_back(ParseEvent::FileDone);
+    stream.insert(stream.end(), { CA, CA });
+    expected.push_back(ParseEvent::Aborted);
+
+    printf("\nPacket parser on fragmented input (%.1f KB stream, %u packets and events, host CPU)\n", stream.size() / 1024.0, (unsigned)expected.size());
+    printf("%-22s %10s %10s %6s\n", "fragments", "ns/byte", "MB/s", "check");
+
+    struct Case {
+        const char* Name;
+        uint16_t MinLength;
+        uint16_t MaxLength;
+    };
+
+    const Case cases[] = {
+        { "4K", 4096, 4096 },
+        { "64 B, USB packets", 64, 64 },
+        { "random 1-1100 B", 1, 1100 },
+        { "random 1-64 B", 1, 64 },
+        { "single bytes", 1, 1 },
+    };
+
+    for (const Case& test : cases)
+    {
+        // The same fragments for every run, drawn up front
+        std::mt19937 random(27);
+        std::vector<uint16_t> fragments;
+        for (size_t total = 0; total < stream.size();)
+        {
+            uint16_t length = (uint16_t)(test.MinLength + random() % (test.MaxLength - test.MinLength + 1));
+            fragments.push_back(length);
+            total += length;
+        }
+
+        Parser parser;
+        PacketFrame frame;
+        alignas(4) static uint8_t buffers[2][PACKET_MAX_FRAME_SIZE];
+        size_t events;
+        bool ok = true;
+
+        auto run = [&](bool check) {
+            size_t position = 0;
+            events = 0;
+            parser.Begin(&frame, buffers[0], frameSize, true);
+
+            for (uint16_t fragment : fragments)
+            {
+                uint16_t length = (uint16_t)std::min((size_t)fragment, stream.size() - position);
+                const uint8_t* chunk = &stream[position];
+                position += length;
+
+                // The rest of a fragment after an event belongs to the next packet
+                while (length > 0)
+                {
+                    ParseEvent event;
+                    uint16_t taken = parser.Feed(chunk, length, &event);
+                    chunk += taken;
+                    length -= taken;
+
+                    if (event == ParseEvent::None)
+                    {
+                        continue;
+                    }
+
+                    if (check)
+                    {
+                        ok = ok && events < expected.size() && event == expected[events];
+                        if (ok && event == ParseEvent::Packet)
+                        {
+                            size_t packet = std::count(expected.begin(), expected.begin() + events, ParseEvent::Packet)
+                                + std::count(expected.begin(), expected.begin() + events, ParseEvent::Malformed);
+                            ok = memcmp(frame.Payload, &stream[payloads[packet]], parser.GetPayloadSize()) == 0
+                                && frame.Header[PACKET_SEQNO_INDEX] == stream[payloads[packet] - 2];
+                        }
+                    }
+
+                    events++;
+                    parser.Begin(&frame, buffers[events & 1], frameSize, true);
+                }
+            }
+        };
+
+        run(true);
+        ok = ok && events == expected.size();
+
+        double nanos = Measure([&] { run(false); Sink = (uint32_t)events; });
+        printf("%-22s %10.2f %10.1f %6s\n", test.Name, nanos / stream.size(), stream.size() / nanos * 1e3, Check(ok));
+    }
+}
+
+/// @brief  Receiving a data packet and handing its payload to the flash writer: the old layout received the whole
+///         packet into one buffer, leaving the payload 3 bytes past a word boundary, and `Submit` copied it into the
+///         writer's buffer. Now header and trailer go into their own fields and the payload straight into the buffer.
+static void BenchmarkPacketLayout()
+{
+    printf("\nHanding a 1K data packet to the flash writer (host CPU)\n");
+    printf("%-10s %14s %10s\n", "layout", "ns/packet", "copied");
+
+    const uint16_t length = PACKET_1K_SIZE + PACKET_OVERHEAD - 1;
+    BufferTransport buffer(RandomImage(length, 3));
+    uint8_t packet[PACKET_1K_SIZE + PACKET_OVERHEAD];
+    alignas(4) uint8_t writerBuffer[FlashWriter::BufferSize];
+    PacketFrame frame;
+
+    Transport* volatile linkPointer = &buffer;
+    Transport& link = *linkPointer;
+
+    double copied = Measure([&] {
+        buffer.Rewind();
+        link.Read(&packet[1], length);
+        memcpy(writerBuffer, &packet[PACKET_HEADER], PACKET_1K_SIZE);
+        Sink = writerBuffer[0];
+    });
+
+    double direct = Measure([&] {
+        buffer.Rewind();
+        link.Read(&frame.Header[1], PACKET_HEADER - 1);
+        link.Read(writerBuffer, PACKET_1K_SIZE);
+        link.Read(frame.Trailer, PACKET_TRAILER);
+        Sink = writerBuffer[0];
+    });
+
+    printf("%-10s %14.1f %10d\n", "one buffer", copied, PACKET_1K_SIZE);
+    printf("%-10s %14.1f %10d\n", "zero copy", direct, 0);
+}
+
+/// @brief  Hammers the receive ring from a second thread standing in for the USB interrupt: it pushes 64 byte packets
+///         whenever there is room for one, like the endpoint is re-armed, while the consumer pops reads of varying
+///         size and checks every byte arrives once and in order.
+static void BenchmarkRing()
+{
+    printf("\nReceive ring, producer thread as the USB interrupt (host CPU)\n");
+    printf("%-10s %10s %10s %10s %10s %6s\n", "ring", "MB", "MB/s", "full", "reads", "check");
+
+    const uint32_t packetSize = 64;
+    const uint64_t total = 64ull * 1024 * 1024;
+    static SpscRing<4096> ring;
+
+    std::atomic<uint64_t> stalls { 0 };
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        uint8_t packet[packetSize];
+        uint32_t seed = 7;
+        uint64_t pushed = 0;
+        uint64_t full = 0;
+
+        while (pushed < total)
+        {
+            for (uint8_t& value : packet)
+            {
+                seed = seed * 1103515245 + 12345;
+                value = (uint8_t)(seed >> 16);
+            }
+
+            if (ring.Free() < packetSize)
+            {
+                // Held off like the host by NAKs, lets the consumer run on a single core
+                full++;
+                while (ring.Free() < packetSize)
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            pushed += ring.Push(packet, packetSize);
+        }
+
+        stalls = full;
+    });
+
+    uint8_t buffer[PACKET_1K_SIZE + PACKET_OVERHEAD];
+    uint32_t seed = 7;
+    uint32_t lengthSeed = 11;
+    uint64_t popped = 0;
+    uint64_t reads = 0;
+    bool ok = true;
+
+    while (popped < total)
+    {
+        lengthSeed = lengthSeed * 1103515245 + 12345;
+        uint32_t length = 1 + (lengthSeed >> 8) % sizeof(buffer);
+
+        uint32_t read = ring.Pop(buffer, length);
+        for (uint32_t i = 0; i < read; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            ok &= buffer[i] == (uint8_t)(seed >> 16);
+        }
+
+        if (read == 0)
+        {
+            std::this_thread::yield();
+        }
+
+        popped += read;
+        reads++;
+    }
+
+    producer.join();
+    double seconds = SecondsSince(start);
+    ok &= ring.Available() == 0;
+
+    printf("%-10s %10.0f %10.1f %10llu %10llu %6s\n", "4K",
+        total / 1048576.0,
+        total / 1048576.0 / seconds,
+        (unsigned long long)stalls,
+        (unsigned long long)reads,
+        Check(ok));
+}
+
+struct Scenario {
+    const char* Name;
+    uint32_t ImageSize = 200 * 1024;
+    uint16_t PacketSize = 1024;
+    bool Streaming = true;
+    uint64_t LatencyNanos = 1000000;
+    bool Compress = false;
+
+    /// @brief The image to send, a random one of `ImageSize` bytes if null.
+    const std::vector<uint8_t>* Image = nullptr;
+
+    /// @brief  What the flash holds before the session: an unrelated image, the same image, the same image with one
+    ///         digest chunk changed, or nothing.
+    enum struct Previous : uint8_t { Other, Same, OneChunkChanged, Blank } Flash = Previous::Other;
+
+    /// @brief Whether the descriptor log is full of records of earlier updates.
+    bool FullLog = false;
+
+    /// @brief The image version the sender announces, none if 0.
+    uint32_t Version = 0;
+
+    /// @brief The payload size of the header packet, and whether it carries the digests of the `delta` option.
+    uint16_t HeaderSize = 1024;
+    bool Digests = true;
+};
+
+static void PrintTransferHeader(const char* title)
+{
+    printf("\n%s\n", title);
+    printf("%-22s %9s %9s %9s %8s %8s %6s %6s %6s %8s | %9s %9s %9s %9s %9s\n",
+        "scenario", "time ms", "KB/s", "packets/s", "wire KB", "flash %", "erased", "blank", "same", "saved ms",
+        "receive", "crc", "flash", "decomp", "protocol");
+}
+
+/// @tparam TReceiver The build of the bootloader to run.
+/// @param printStats Whether to query and print the session statistics afterwards.
+/// @return The virtual duration of the session in seconds, 0 if it failed.
+template <typename TReceiver = Receiver>
+static double RunTransfer(const Scenario& scenario, bool printStats = false)
+{
+    const uint32_t imageAddress = Hardware::STM32BaseAddress + Hardware::FirmwareBinaryFileOffset;
+    std::vector<uint8_t> image = scenario.Image != nullptr ? *scenario.Image : RandomImage(scenario.ImageSize, 3);
+
+    VirtualClock clock;
+    SimulatedLink link(clock);
+    SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+    link.LatencyNanos = scenario.LatencyNanos;
+
+    std::vector<uint8_t> previous;
+    switch (scenario.Flash)
+    {
+        case Scenario::Previous::Other:
+            previous = RandomImage(image.size(), 4);
+            break;
+
+        case Scenario::Previous::Same:
+            previous = image;
+            break;
+
+        case Scenario::Previous::OneChunkChanged:
+            previous = image;
+            previous[previous.size() / 2] ^= 0x01;
+            break;
+
+        case Scenario::Previous::Blank:
+            break;
+    }
+    memcpy(flash.At(imageAddress), previous.data(), previous.size());
+    if (scenario.FullLog)
+    {
+        FillDescriptorLog(flash);
+    }
+
+    YModemSender sender(image, "firmware.bin");
+    sender.PacketSize = scenario.PacketSize;
+    sender.OfferStreaming = scenario.Streaming;
+    sender.Compress = scenario.Compress;
+    sender.Version = scenario.Version;
+    sender.HeaderSize = scenario.HeaderSize;
+    sender.SendDigests = scenario.Digests;
+
+    TReceiver::Init(&link, &clock, &flash);
+    link.Connect(&sender);
+
+    int32_t fileSize = 0;
+    auto result = TReceiver::ReceiveFile(&fileSize);
+    Profiler::Switch(ProfilePhase::Protocol);
+
+    // Let the last ACK reach the sender
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    bool verified = result == ReceiveFileResult::Ok
+        && sender.IsDone()
+        && fileSize == (int32_t)image.size()
+        && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+        && ImageDescriptor::Verify(&flash) == ImageCheckResult::Valid;
+    if (verified == false)
+    {
+        printf("%-22s FAILED (result %u, sender failed on 0x%02X)\n", scenario.Name, (unsigned)result, sender.FailedOn);
+        Failures++;
+        return 0;
+    }
+
+    // The sector statistics as the bootloader reports them with the `STATS` command
+    double seconds = clock.Nanos() / 1e9;
+    uint32_t packets = sender.PacketsSent;
+    const FlashWriterStats& stats = TReceiver::GetFlashStats();
+    printf("%-22s %9.1f %9.1f %9.1f %8.1f %8.1f %6u %6u %6u %8u | %9.0f %9.0f %9.0f %9.0f %9.0f\n",
+        scenario.Name,
+        seconds * 1e3,
+        image.size() / 1024.0 / seconds,
+        packets / seconds,
+        sender.PayloadSize() / 1024.0,
+        flash.BusyNanos / 1e7 / seconds,
+        stats.SectorsErased,
+        stats.SectorsSkipped,
+        stats.SectorsUnchanged,
+        stats.MillisSaved,
+        (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Receive] / packets,
+        (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Crc] / packets,
+        (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Flash] / packets,
+        (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Decompress] / packets,
+        (double)Profiler::Exclusive[(uint8_t)ProfilePhase::Protocol] / packets);
+
+    if (printStats)
+    {
+        // The uploader's check after an upload: the descriptor has the CRC32 of the image it sent
+        InfoQuery info;
+        link.Connect(&info);
+        TReceiver::ServeCommands(100);
+
+        uint32_t imageCrc = Crc32::Update(Crc32::InitialValue, image.data(), image.size());
+        bool confirmed = info.Decode() && info.HasDescriptor && info.Verified
+            && info.Size == image.size() && info.Crc == imageCrc && info.Version == scenario.Version;
+        printf("\nImage descriptor: %u bytes, CRC32 %08X, version %X, %s\n", info.Size, info.Crc, info.Version,
+            confirmed ? "matches the image sent" : "MISMATCH");
+        Failures += confirmed ? 0 : 1;
+
+        // Through the command like the uploader gets them, on the host ticks are CPU nanoseconds
+        StatsQuery query;
+        link.Connect(&query);
+        TReceiver::ServeCommands(100);
+
+        if (query.Decode() == false)
+        {
+            printf("Statistics query FAILED\n");
+            Failures++;
+        }
+        else
+        {
+            printf("\nStatistics of the session (host CPU time, flash operations in real time)\n");
+            query.Print();
+        }
+    }
+
+    return seconds;
+}
+
+/// @brief  An image and a data file, in one batch or in a session each. Every extra session also costs the USB
+///         re-enumeration and the port opening on the host, which the simulation leaves out. The data file goes
+///         into the last sector, which it shares with the descriptor log, so the image has to keep its descriptor.
+static void BenchmarkBatch()
+{
+    printf("\nBatch sessions (96K image and 16K data file replacing a 200K image, 1K packets, YModem-G, 1ms latency)\n");
+    printf("%-22s %9s %9s %6s %10s %6s\n", "scenario", "time ms", "sessions", "erased", "descriptor", "check");
+
+    static const char* const results[] = { "valid", "missing", "mismatch" };
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    const uint32_t dataAddress = Hardware::STM32BaseAddress + Hardware::SectorOffsets[Hardware::SectorCount - 1];
+    std::vector<uint8_t> image = RandomImage(96 * 1024, 7);
+    std::vector<uint8_t> data = RandomImage(16 * 1024, 8);
+    std::vector<uint8_t> previous = RandomImage(200 * 1024, 9);
+
+    struct Case {
+        const char* Name;
+        uint32_t DataAddress;
+        bool Batch;
+
+        /// @brief Whether the bootloader takes the data file, it has to refuse addresses within the image.
+        bool Accepted;
+    };
+
+    const Case cases[] = {
+        { "one session", dataAddress, true, true },
+        { "one session each", dataAddress, false, true },
+        { "data over the image", imageAddress + 0x8000, true, false },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+
+        memcpy(flash.At(imageAddress), previous.data(), previous.size());
+        ImageRecord record = ImageDescriptor::Make(previous.size(), Crc32::Update(Crc32::InitialValue, previous.data(), previous.size()), 1);
+        memcpy(flash.At(ImageDescriptor::SlotAddress(0)), &record, sizeof(record));
+
+        uint8_t sessions = 0;
+        uint32_t erased = 0;
+        bool ok;
+        if (test.Batch)
+        {
+            YModemSender sender(image, "firmware.bin");
+            sender.AddFile(data, "config.bin", test.DataAddress);
+            ok = (RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok) == test.Accepted && sender.IsDone() == test.Accepted;
+            erased = Receiver::GetFlashStats().SectorsErased;
+            sessions = 1;
+        }
+        else
+        {
+            YModemSender imageSender(image, "firmware.bin");
+            YModemSender dataSender;
+            dataSender.AddFile(data, "config.bin", test.DataAddress);
+            ok = RunSession(clock, link, flash, imageSender) == ReceiveFileResult::Ok;
+            erased = Receiver::GetFlashStats().SectorsErased;
+            ok = ok && RunSession(clock, link, flash, dataSender) == ReceiveFileResult::Ok;
+            erased += Receiver::GetFlashStats().SectorsErased;
+            sessions = 2;
+        }
+
+        ImageCheckResult descriptor = ImageDescriptor::Verify(&flash);
+        bool dataWritten = memcmp(flash.At(test.DataAddress), data.data(), data.size()) == 0;
+        ok = ok
+            && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+            && descriptor == ImageCheckResult::Valid
+            && dataWritten == test.Accepted;
+
+        printf("%-22s %9.1f %9u %6u %10s %6s\n", test.Name, clock.Nanos() / 1e6, sessions, erased,
+            results[(uint8_t)descriptor], Check(ok));
+    }
+}
+
+/// @brief  An update that breaks off after three quarters of its packets, followed by a second session for the same image that
+///         either starts over or resumes from the progress the first one saved. Only the second session is timed.
+static void BenchmarkResume()
+{
+    printf("\nResuming an interrupted update (200K image replacing another, cut after 3/4 of the packets, 1K packets, YModem-G)\n");
+    printf("%-22s %9s %9s %9s %6s %6s\n", "second session", "time ms", "wire KB", "resumed", "erased", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> random = RandomImage(200 * 1024, 10);
+    std::vector<uint8_t> firmware = FirmwareImage(200 * 1024, 11);
+    std::vector<uint8_t> other = RandomImage(200 * 1024, 12);
+
+    struct Case {
+        const char* Name;
+        const std::vector<uint8_t>* Image;
+        bool Compress;
+        bool Resume;
+
+        /// @brief The image the second session sends, a different one than the interrupted session must not resume.
+        const std::vector<uint8_t>* Second;
+    };
+
+    const Case cases[] = {
+        { "start over", &random, false, false, &random },
+        { "resume", &random, false, true, &random },
+        { "resume, packed", &firmware, true, true, &firmware },
+        { "other image", &random, false, true, &other },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        std::vector<uint8_t> previous = RandomImage(200 * 1024, 13);
+        memcpy(flash.At(imageAddress), previous.data(), previous.size());
+
+        YModemSender interrupted(*test.Image, "firmware.bin");
+        interrupted.Compress = test.Compress;
+        interrupted.OfferResume = true;
+        interrupted.StopAfterPackets = test.Compress ? 75 : 150;
+        bool ok = RunSession(clock, link, flash, interrupted) == ReceiveFileResult::Failed
+            && ImageDescriptor::Check(&flash) == ImageCheckResult::Missing;
+
+        const std::vector<uint8_t>& image = *test.Second;
+        YModemSender sender(image, "firmware.bin");
+        sender.Compress = test.Compress;
+        sender.OfferResume = test.Resume;
+        uint64_t start = clock.Nanos();
+        ok = ok
+            && RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok
+            && sender.IsDone()
+            && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+            && ImageDescriptor::Verify(&flash) == ImageCheckResult::Valid;
+
+        printf("%-22s %9.1f %9.1f %8uK %6u %6s\n", test.Name, (clock.Nanos() - start) / 1e6, sender.PayloadSize() / 1024.0,
+            sender.ResumedAt / 1024, Receiver::GetFlashStats().SectorsErased, Check(ok));
+    }
+}
+
+/// @brief  Goodput of a session over a link that loses, garbles and holds up bytes in both directions. Plain YModem
+///         asks for every broken or missing packet again and gives up after `MAX_ERRORS` errors in a row, YModem-G
+///         can only cancel. Either way no broken image may end up with a descriptor.
+static void BenchmarkFaults()
+{
+    printf("\nLink faults (64K image into blank flash, 1K packets, 1ms latency, faults in both directions)\n");
+    printf("%-22s %9s %9s %8s %8s %8s %10s %6s\n", "faults", "time ms", "KB/s", "resent", "dropped", "flipped", "outcome", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 14);
+
+    struct Case {
+        const char* Name;
+        double DropRate;
+        double FlipRate;
+        double DelayRate;
+        bool Streaming;
+    };
+
+    const Case cases[] = {
+        { "none", 0, 0, 0, false },
+        { "drop 1e-4", 1e-4, 0, 0, false },
+        { "drop 3e-4", 3e-4, 0, 0, false },
+        { "drop 1e-3", 1e-3, 0, 0, false },
+        { "flip 1e-4", 0, 1e-4, 0, false },
+        { "flip 3e-4", 0, 3e-4, 0, false },
+        { "flip 1e-3", 0, 1e-3, 0, false },
+        { "delay 20ms, 5%", 0, 0, 0.05, false },
+        { "all 1e-4, delay 1%", 1e-4, 1e-4, 0.01, false },
+        { "G, none", 0, 0, 0, true },
+        { "G, flip 1e-4", 0, 1e-4, 0, true },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        link.LatencyNanos = 1000000;
+
+        LinkFaults faults;
+        faults.DropRate = test.DropRate;
+        faults.FlipRate = test.FlipRate;
+        faults.DelayRate = test.DelayRate;
+        faults.DelayNanos = 20000000;
+        faults.Seed = 15;
+        link.SetFaults(faults);
+
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = test.Streaming;
+        sender.SendDigests = false;
+        bool done = RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok;
+
+        // A cancelled session must not leave a descriptor behind, a finished one has to have written the image
+        ImageCheckResult descriptor = ImageDescriptor::Verify(&flash);
+        bool ok = done
+            ? memcmp(flash.At(imageAddress), image.data(), image.size()) == 0 && descriptor == ImageCheckResult::Valid
+            : descriptor == ImageCheckResult::Missing;
+
+        double seconds = clock.Nanos() / 1e9;
+        printf("%-22s %9.1f %9.1f %8u %8llu %8llu %10s %6s\n", test.Name, seconds * 1e3, done ? image.size() / 1024.0 / seconds : 0.0,
+            sender.Retransmissions, (unsigned long long)link.BytesDropped, (unsigned long long)link.BitsFlipped,
+            done ? "done" : "cancelled", Check(ok));
+    }
+}
+
+/// @brief  Every programmed sector is read back, here with a flash word that does not take its data. With `resume`
+///         offered the host sends the file again from the start of that sector, without it or if the word keeps
+///         failing the session is cancelled. Either way no broken image may end up with a descriptor.
+static void BenchmarkVerify()
+{
+    printf("\nPost-write verification (200K image replacing another, 1K packets, 1ms latency, verify in host CPU us)\n");
+    printf("%-22s %9s %9s %9s %9s %8s %10s %6s\n", "scenario", "time ms", "verify us", "verified", "failed", "rewinds", "outcome", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> random = RandomImage(200 * 1024, 16);
+    std::vector<uint8_t> firmware = FirmwareImage(200 * 1024, 17);
+
+    struct Case {
+        const char* Name;
+        bool Streaming;
+        bool Compress;
+        bool Resume;
+
+        /// @brief The times the weak word fails to program, see `SimulatedFlash::WeakWrites`.
+        uint32_t WeakWrites;
+        bool Done;
+    };
+
+    const Case cases[] = {
+        { "sound, YModem", false, false, true, 0, true },
+        { "sound, G", true, false, true, 0, true },
+        { "weak word, YModem", false, false, true, 1, true },
+        { "weak word, G", true, false, true, 1, true },
+        { "weak word, G, packed", true, true, true, 1, true },
+        { "weak word, no resume", true, false, false, 1, false },
+        { "word stays weak", true, false, true, 100, false },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        link.LatencyNanos = 1000000;
+
+        std::vector<uint8_t> previous = RandomImage(200 * 1024, 18);
+        memcpy(flash.At(imageAddress), previous.data(), previous.size());
+
+        // A word in the 64K sector, 32K into the image
+        flash.WeakAddress = imageAddress + 40 * 1024 + 0x124;
+        flash.WeakWrites = test.WeakWrites;
+
+        const std::vector<uint8_t>& image = test.Compress ? firmware : random;
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = test.Streaming;
+        sender.Compress = test.Compress;
+        sender.OfferResume = test.Resume;
+        bool done = RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok;
+
+        ImageCheckResult descriptor = ImageDescriptor::Verify(&flash);
+        bool ok = done == test.Done
+            && (test.WeakWrites == 0 || flash.WeakWrites < test.WeakWrites)
+            && (done
+                ? memcmp(flash.At(imageAddress), image.data(), image.size()) == 0 && descriptor == ImageCheckResult::Valid
+                : descriptor == ImageCheckResult::Missing);
+
+        const FlashWriterStats& stats = Receiver::GetFlashStats();
+        printf("%-22s %9.1f %9.0f %9u %9u %8u %10s %6s\n", test.Name, clock.Nanos() / 1e6,
+            Profiler::Exclusive[(uint8_t)ProfilePhase::Verify] / 1e3, stats.SectorsVerified, stats.SectorsMismatched,
+            sender.Rewinds, done ? "done" : "cancelled", Check(ok));
+    }
+}
+
+/// @brief  How long the host waits for the reply to each packet, and in how many writes it comes. Every write of the
+///         device is a USB IN transfer of its own, which the host only polls for once per frame on a busy bus: the
+///         "1ms per write" cases charge each write that on top of its bytes. The header's reply is ACK and the mode,
+///         an EOT's ACK, ACK and the request for the next header, each sent as one write. In YModem-G the EOT waits
+///         behind the packets the flash has not taken yet, its reply takes as long as that backlog.
+static void BenchmarkReplies()
+{
+    printf("\nReply latency (64K image into blank flash, 1K packets, 1ms latency, reply from packet arrived to reply received)\n");
+    printf("%-22s %9s %8s %8s %10s %11s %10s %6s\n", "scenario", "time ms", "writes", "replies", "writes/rep", "mean rep us", "max rep us", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 18);
+
+    struct Case {
+        const char* Name;
+        bool Streaming;
+        uint64_t WriteOverheadNanos;
+        double FlipRate;
+    };
+
+    const Case cases[] = {
+        { "YModem", false, 0, 0 },
+        { "YModem, 1ms per write", false, 1000000, 0 },
+        { "YModem, flip 1e-4", false, 0, 1e-4 },
+        { "G", true, 0, 0 },
+        { "G, 1ms per write", true, 1000000, 0 },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        link.LatencyNanos = 1000000;
+        link.WriteOverheadNanos = test.WriteOverheadNanos;
+
+        LinkFaults faults;
+        faults.FlipRate = test.FlipRate;
+        faults.Seed = 19;
+        link.SetFaults(faults);
+
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = test.Streaming;
+        sender.SendDigests = false;
+        bool ok = RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok
+            && sender.IsDone()
+            && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+            && ImageDescriptor::Verify(&flash) == ImageCheckResult::Valid;
+
+        uint32_t replies = sender.Replies > 0 ? sender.Replies : 1;
+        printf("%-22s %9.1f %8u %8u %10.2f %11.0f %10.0f %6s\n", test.Name, clock.Nanos() / 1e6, link.WritesToHost,
+            sender.Replies, (double)link.WritesToHost / replies, sender.ReplyNanos / 1e3 / replies, sender.MaxReplyNanos / 1e3,
+            Check(ok));
+    }
+}
+
+/// @brief  Images with long runs of the erased value, e.g. sections placed at fixed addresses with nothing between
+///         them. With `sparse` offered the host sends each run as one skip frame instead of its packets, and the
+///         writer does not program erased words into the sectors it erased, in either mode.
+static void BenchmarkSparse()
+{
+    printf("\nSparse images (200K image replacing another or into blank flash, 1K packets, 1ms latency)\n");
+    printf("%-22s %9s %9s %9s %9s %9s %6s\n", "scenario", "time ms", "wire KB", "sent KB", "skipped K", "erased K", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+
+    // Code at the start, a table at 96K and a block of constants at the end, erased flash between them
+    std::vector<uint8_t> sections = RandomImage(200 * 1024, 20);
+    std::fill(sections.begin() + 24 * 1024, sections.begin() + 96 * 1024, 0xFF);
+    std::fill(sections.begin() + 112 * 1024, sections.begin() + 184 * 1024 + 100, 0xFF);
+    std::vector<uint8_t> firmware = FirmwareImage(200 * 1024, 21);
+    std::vector<uint8_t> random = RandomImage(200 * 1024, 22);
+
+    struct Case {
+        const char* Name;
+        const std::vector<uint8_t>* Image;
+        bool Streaming;
+        bool Sparse;
+        bool Blank;
+    };
+
+    // Replacing an image the erases take longer than the transfer in YModem-G, into blank flash they do not
+    const Case cases[] = {
+        { "sections, YModem", &sections, false, false, false },
+        { "sections, YModem, sp", &sections, false, true, false },
+        { "sections, G", &sections, true, false, false },
+        { "sections, G, sparse", &sections, true, true, false },
+        { "sections, G, blank", &sections, true, false, true },
+        { "sections, G, blank, sp", &sections, true, true, true },
+        { "firmware, G, blank", &firmware, true, false, true },
+        { "firmware, G, blank, sp", &firmware, true, true, true },
+        { "random, G, sparse", &random, true, true, false },
+    };
+
+    for (const Case& test : cases)
+    {
+        VirtualClock clock;
+        SimulatedLink link(clock);
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        link.LatencyNanos = 1000000;
+
+        if (test.Blank == false)
+        {
+            std::vector<uint8_t> previous = RandomImage(200 * 1024, 23);
+            memcpy(flash.At(imageAddress), previous.data(), previous.size());
+        }
+
+        const std::vector<uint8_t>& image = *test.Image;
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = test.Streaming;
+        sender.OfferSparse = test.Sparse;
+        bool ok = RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok
+            && sender.IsDone()
+            && sender.BytesSkipped == Receiver::GetSkippedBytes()
+            && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+            && ImageDescriptor::Verify(&flash) == ImageCheckResult::Valid;
+
+        printf("%-22s %9.1f %9.1f %9.1f %9.1f %9.1f %6s\n", test.Name, clock.Nanos() / 1e6, link.BytesToDevice / 1024.0,
+            (image.size() - sender.BytesSkipped) / 1024.0, sender.BytesSkipped / 1024.0,
+            Receiver::GetFlashStats().WordsErased * 4 / 1024.0, Check(ok));
+    }
+}
+
+/// @brief  Ways of feeding the flash. The x8 and x16 parallelisms need two and four operations per word, and
+///         longer erases. Every operation the writer starts from its main loop waits a round trip through that loop,
+///         which runs from flash and stalls while the flash is busy; the RAM-resident bursts of the target start the
+///         next word of a run right away, holding the CPU meanwhile. The round trip is taken as 2us here.
+static void BenchmarkFlashEngine()
+{
+    printf("\nFlash programming strategies (200K image, 1K packets, YModem-G, 1ms latency, 2us per main loop round trip)\n");
+    printf("%-22s %9s %10s %9s %12s %9s %6s\n", "strategy", "held us", "blank ms", "KB/s", "replacing ms", "KB/s", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 24);
+    std::vector<uint8_t> previous = RandomImage(200 * 1024, 25);
+
+    struct Case {
+        const char* Name;
+        uint8_t Parallelism;
+        uint16_t BurstWords;
+    };
+
+    const Case cases[] = {
+        { "x8, word per poll", 8, 1 },
+        { "x16, word per poll", 16, 1 },
+        { "x32, word per poll", 32, 1 },
+        { "x32, bursts of 4", 32, 4 },
+        { "x32, bursts of 16", 32, 16 },
+        { "x32, bursts of 64", 32, 64 },
+    };
+
+    for (const Case& test : cases)
+    {
+        double millis[2];
+        bool ok = true;
+
+        for (bool replacing : { false, true })
+        {
+            VirtualClock clock;
+            SimulatedLink link(clock);
+            SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+            link.LatencyNanos = 1000000;
+            flash.Parallelism = test.Parallelism;
+            flash.BurstWords = test.BurstWords;
+            flash.PollLatencyNanos = 2000;
+
+            if (replacing)
+            {
+                memcpy(flash.At(imageAddress), previous.data(), previous.size());
+            }
+
+            YModemSender sender(image, "firmware.bin");
+            ok = ok
+                && RunSession(clock, link, flash, sender) == ReceiveFileResult::Ok
+                && sender.IsDone()
+                && memcmp(flash.At(imageAddress), image.data(), image.size()) == 0
+                && ImageDescriptor::Verify(&flash) == ImageCheckResult::Valid;
+            millis[replacing] = clock.Nanos() / 1e6;
+        }
+
+        // The CPU waits for all words of a burst but the last one
+        uint32_t held = (test.BurstWords - 1) * (32 / test.Parallelism) * Hardware::WordProgramMicros;
+        printf("%-22s %9u %10.1f %9.1f %12.1f %9.1f %6s\n", test.Name, held, millis[0], image.size() / 1.024 / millis[0],
+            millis[1], image.size() / 1.024 / millis[1], Check(ok));
+    }
+}
+
+#if defined(YMODEM_TRACE)
+/// @brief  Sessions of the traced build, each read back with the `TRACE` command and replayed twice into the flash it
+///         started from. The replay has to send the same bytes and take the same decisions at the same times as the
+///         traced session, and the two replays have to be identical.
+static void BenchmarkTrace()
+{
+    printf("\nTrace capture and replay (64K image replacing another, 1K packets, 1ms latency, overhead in host CPU time)\n");
+    printf("%-22s %9s %9s %8s %7s %9s %8s %8s %8s %6s\n",
+        "scenario", "time ms", "trace KB", "records", "states", "overhead", "replay", "dev us", "repeat", "check");
+
+    const uint32_t imageAddress = ImageDescriptor::ImageAddress;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 19);
+    std::vector<uint8_t> previous = RandomImage(64 * 1024, 20);
+
+    struct Case {
+        const char* Name;
+        bool Streaming;
+        double FlipRate;
+
+        /// @brief The times a weak word in the second sector of the image fails to program, see `SimulatedFlash::WeakWrites`.
+        uint32_t WeakWrites;
+    };
+
+    const Case cases[] = {
+        { "YModem", false, 0, 0 },
+        { "G", true, 0, 0 },
+        { "flip 3e-4, YModem", false, 3e-4, 0 },
+        { "weak word, G", true, 0, 1 },
+    };
+
+    for (const Case& test : cases)
+    {
+        auto prepare = [&](SimulatedFlash& flash) {
+            memcpy(flash.At(imageAddress), previous.data(), previous.size());
+            flash.WeakAddress = imageAddress + 20 * 1024 + 0x124;
+            flash.WeakWrites = test.WeakWrites;
+        };
+
+        // The fastest of a few runs of the same session, with and without recording
+        double plainSeconds = 1e9;
+        double tracedSeconds = 1e9;
+        double sessionNanos = 0;
+        TraceQuery query;
+        bool done = false;
+        for (uint8_t run = 0; run < 6; run++)
+        {
+            bool recording = run % 2 == 1;
+
+            VirtualClock clock;
+            SimulatedLink link(clock);
+            TracedTransport<SimulatedLink> traced(link);
+            SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+            prepare(flash);
+            link.LatencyNanos = 1000000;
+
+            LinkFaults faults;
+            faults.FlipRate = test.FlipRate;
+            faults.Seed = 21;
+            link.SetFaults(faults);
+
+            YModemSender sender(image, "firmware.bin");
+            sender.OfferStreaming = test.Streaming;
+            sender.OfferResume = true;
+            sender.SendDigests = false;
+
+            if (recording)
+            {
+                Trace::Start(&clock);
+            }
+            TracedReceiver<>::Init(&traced, &clock, &flash);
+            link.Connect(&sender);
+
+            int32_t fileSize = 0;
+            auto start = std::chrono::steady_clock::now();
+            done = TracedReceiver<>::ReceiveFile(&fileSize) == ReceiveFileResult::Ok;
+            double seconds = SecondsSince(start);
+            sessionNanos = clock.Nanos();
+
+            while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+            {
+                clock.Idle();
+            }
+
+            if (recording)
+            {
+                tracedSeconds = std::min(tracedSeconds, seconds);
+                query = TraceQuery();
+                link.SetFaults(LinkFaults());
+                link.Connect(&query);
+                TracedReceiver<>::ServeCommands(100);
+                Trace::Stop();
+                while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+                {
+                    clock.Idle();
+                }
+            }
+            else
+            {
+                plainSeconds = std::min(plainSeconds, seconds);
+            }
+        }
+
+        bool decoded = query.Decode() && query.Log.IsComplete();
+        TraceLog replay = ReplayTrace<PACKET_1K_SIZE>(query.Log, 1000000, prepare);
+        TraceLog repeat = ReplayTrace<PACKET_1K_SIZE>(query.Log, 1000000, prepare);
+        TraceComparison replayed = TraceComparison::Compare(query.Log, replay);
+        TraceComparison repeated = TraceComparison::Compare(replay, repeat);
+
+        size_t states = 0;
+        for (const TraceRecord& record : query.Log.Records)
+        {
+            states += record.Kind == TraceKind::State ? 1 : 0;
+        }
+
+        bool ok = done && decoded && replayed.Matches() && repeated.Matches() && repeated.MaxDeviationMicros == 0;
+        printf("%-22s %9.1f %9.1f %8zu %7zu %8.1f%% %8s %8llu %8s %6s\n", test.Name, sessionNanos / 1e6,
+            (query.Answer.size() > 12 ? query.Answer.size() - 12 : 0) / 1024.0, query.Log.Records.size(), states,
+            (tracedSeconds / plainSeconds - 1) * 100, replayed.Matches() ? "same" : "DIFFERS",
+            (unsigned long long)replayed.MaxDeviationMicros, repeated.Matches() ? "same" : "DIFFERS", Check(ok));
+    }
+}
+
+/// @brief  Replays a trace saved by the uploader's --trace on the build it was taken with, into blank flash or flash
+///         holding a given image, and prints where the replay takes other decisions than the device did.
+/// @return The exit code, 0 if the replay matches the trace.
+static int ReplayFile(const char* tracePath, const char* imagePath)
+{
+    std::vector<uint8_t> answer;
+    std::vector<uint8_t> previous;
+    for (auto file : { std::make_pair(tracePath, &answer), std::make_pair(imagePath, &previous) })
+    {
+        if (file.first == nullptr)
+        {
+            continue;
+        }
+
+        FILE* input = fopen(file.first, "rb");
+        if (input == nullptr)
+        {
+            printf("Can not open %s\n", file.first);
+            return 1;
+        }
+
+        uint8_t chunk[4096];
+        size_t length;
+        while ((length = fread(chunk, 1, sizeof(chunk), input)) > 0)
+        {
+            file.second->insert(file.second->end(), chunk, chunk + length);
+        }
+        fclose(input);
+    }
+
+    TraceLog log;
+    if (log.Decode(answer) == false)
+    {
+        printf("%s is not a trace or corrupted\n", tracePath);
+        return 1;
+    }
+
+    printf("Trace of %zu records, %llu bytes in, %llu bytes out\n", log.Records.size(),
+        (unsigned long long)log.Bytes(TraceKind::In), (unsigned long long)log.Bytes(TraceKind::Out));
+    log.PrintStates();
+    if (log.IsComplete() == false)
+    {
+        printf("The trace does not hold a whole session (%u records dropped), a larger YMODEM_TRACE_SIZE keeps more\n", log.Dropped);
+        return 1;
+    }
+
+    previous.resize(std::min(previous.size(), (size_t)Hardware::MaxImageSize));
+    auto prepare = [&](SimulatedFlash& flash) {
+        memcpy(flash.At(ImageDescriptor::ImageAddress), previous.data(), previous.size());
+    };
+
+    // The session starts with the largest packet of the build that took the trace. The target's link is taken to
+    // have the latency of a USB full speed frame
+    uint64_t latencyNanos = 1000000;
+    uint32_t maxPacketSize = log.Records.front().Value();
+    TraceLog replay = maxPacketSize <= PACKET_SIZE ? ReplayTrace<PACKET_SIZE>(log, latencyNanos, prepare)
+        : maxPacketSize <= PACKET_1K_SIZE ? ReplayTrace<PACKET_1K_SIZE>(log, latencyNanos, prepare)
+        : ReplayTrace<PACKET_MAX_FRAME_SIZE>(log, latencyNanos, prepare);
+    TraceComparison comparison = TraceComparison::Compare(log, replay);
+
+    printf("\nReplay on the %u byte build, %s flash: output %s, decisions %s, timing within %llu us\n",
+        maxPacketSize <= PACKET_SIZE ? PACKET_SIZE : maxPacketSize <= PACKET_1K_SIZE ? PACKET_1K_SIZE : PACKET_MAX_FRAME_SIZE,
+        previous.empty() ? "blank" : "prepared", comparison.OutputMatches ? "matches" : "DIFFERS",
+        comparison.StatesMatch ? "match" : "DIFFER", (unsigned long long)comparison.MaxDeviationMicros);
+
+    if (comparison.OutputMatches == false)
+    {
+        printf("First different byte sent: %llu\n", (unsigned long long)comparison.FirstDifference);
+    }
+    if (comparison.StatesMatch == false)
+    {
+        printf("\nDecisions of the replay\n");
+        replay.PrintStates();
+    }
+
+    return comparison.Matches() ? 0 : 1;
+}
+#endif
+
+/// @brief  The boot decision, which only reads the descriptor log, against reading the whole image back to check it
+///         like the `INFO` command does.
+static void BenchmarkBoot()
+{
+    printf("\nBoot decision (host CPU)\n");
+    printf("%-22s %9s %10s %10s %10s %10s\n", "flash", "image", "check", "us", "read back", "us");
+
+    static const char* const results[] = { "valid", "missing", "mismatch" };
+    VirtualClock clock;
+
+    struct Case {
+        const char* Name;
+        uint32_t Size;
+        bool Descriptor;
+        bool FullLog;
+
+        /// @brief An update has started and invalidated the descriptor.
+        bool Invalidated;
+
+        /// @brief The image has been changed behind the bootloader's back.
+        bool Damaged;
+    };
+
+    for (Case test : {
+        Case { "no descriptor", 200 * 1024, false, false, false, false },
+        Case { "16K image", 16 * 1024, true, false, false, false },
+        Case { "200K image", 200 * 1024, true, false, false, false },
+        Case { "200K, full log", 200 * 1024, true, true, false, false },
+        Case { "200K, interrupted", 200 * 1024, true, false, true, false },
+        Case { "200K, damaged", 200 * 1024, true, false, false, true },
+        Case { "largest image", (uint32_t)Hardware::MaxImageSize, true, false, false, false } })
+    {
+        SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+        std::vector<uint8_t> image = RandomImage(test.Size, 8);
+        memcpy(flash.At(ImageDescriptor::ImageAddress), image.data(), image.size());
+
+        uint8_t slot = 0;
+        if (test.FullLog)
+        {
+            FillDescriptorLog(flash);
+            slot = ImageDescriptor::SlotCount - 1;
+        }
+
+        if (test.Descriptor)
+        {
+            ImageRecord record = ImageDescriptor::Make(test.Size, Crc32::Update(Crc32::InitialValue, image.data(), test.Size), 1);
+            if (test.Invalidated)
+            {
+                record.Magic = 0;
+            }
+            memcpy(flash.At(ImageDescriptor::SlotAddress(slot)), &record, sizeof(record));
+        }
+
+        if (test.Damaged)
+        {
+            flash.At(ImageDescriptor::ImageAddress)[test.Size / 3] ^= 0x5A;
+        }
+
+        auto time = [&](ImageCheckResult (*decide)(SimulatedFlash*), ImageCheckResult* result) {
+            uint32_t runs = 0;
+            auto start = std::chrono::steady_clock::now();
+            do
+            {
+                *result = decide(&flash);
+                runs++;
+            } while (SecondsSince(start) < 0.1);
+
+            return SecondsSince(start) * 1e6 / runs;
+        };
+
+        ImageCheckResult checked;
+        ImageCheckResult verified;
+        double checkMicros = time(ImageDescriptor::Check<SimulatedFlash>, &checked);
+        double verifyMicros = time(ImageDescriptor::Verify<SimulatedFlash>, &verified);
+
+        printf("%-22s %9u %10s %10.2f %10s %10.1f\n", test.Name, test.Size,
+            results[(uint8_t)checked], checkMicros, results[(uint8_t)verified], verifyMicros);
+    }
+}
+
+static void BenchmarkCodec(const char* name, const std::vector<uint8_t>& image)
+{
+    std::vector<uint8_t> compressed;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t runs = 0;
+    do
+    {
+        compressed = HeatshrinkEncoder().Encode(image);
+        runs++;
+    } while (SecondsSince(start) < 0.2);
+    double encodeSeconds = SecondsSince(start) / runs;
+
+    // Decoded the way the bootloader does it, 1K packets into 1K writer buffers
+    static HeatshrinkDecoder decoder;
+    std::vector<uint8_t> decoded(image.size());
+    double decodeNanos = Measure([&] {
+        decoder.Begin(image.size());
+        size_t input = 0;
+        size_t output = 0;
+        while (decoder.IsDone() == false)
+        {
+            uint16_t length = (uint16_t)std::min((size_t)PACKET_1K_SIZE, compressed.size() - input);
+            uint16_t capacity = (uint16_t)std::min((size_t)FlashWriter::BufferSize, decoded.size() - output);
+            uint16_t produced;
+            input += decoder.Decode(&compressed[input], length, &decoded[output], capacity, &produced);
+            output += produced;
+        }
+    });
+
+    printf("%-22s %9u %9u %8.1f %12.1f %12.1f %6s\n",
+        name,
+        (unsigned)image.size(),
+        (unsigned)compressed.size(),
+        100.0 * compressed.size() / image.size(),
+        image.size() / encodeSeconds / 1e6,
+        image.size() / decodeNanos * 1e3,
+        Check(decoded == image));
+}
+
+int main(int argc, char** argv)
+{
+#if defined(YMODEM_TRACE)
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+    {
+        return ReplayFile(argv[2], argc > 3 ? argv[3] : nullptr);
+    }
+#endif
+
+    VirtualClock clock;
+    SimulatedLink link(clock);
+
+    printf("YModem bootloader benchmark\n");
+    printf("Link: %u B/s in %u byte USB packets. Flash: %uus per word, typical sector erase times.\n",
+        link.BytesPerSecond, link.UsbPacketSize, Hardware::WordProgramMicros);
+    printf("Transfers run in virtual time, the last four columns are host CPU ns per packet.\n");
+    printf("Session buffers: %u bytes in the 1K build, %u bytes in the 128 byte build, %u bytes in the 8K build.\n",
+        (unsigned)Receiver::ArenaSize(), (unsigned)SmallReceiver::ArenaSize(), (unsigned)FrameReceiver::ArenaSize());
+
+    BenchmarkCrc();
+    BenchmarkReceive();
+    BenchmarkParser();
+    BenchmarkPacketLayout();
+    BenchmarkRing();
+
+    PrintTransferHeader("Packet size and mode (200K image replacing another, 1ms latency)");
+    {
+        Scenario scenario;
+        scenario.Name = "128 B, YModem";
+        scenario.PacketSize = 128;
+        scenario.Streaming = false;
+        RunTransfer(scenario);
+
+        scenario.Name = "128 B, YModem-G";
+        scenario.Streaming = true;
+        RunTransfer(scenario);
+
+        scenario.Name = "1K, YModem";
+        scenario.PacketSize = 1024;
+        scenario.Streaming = false;
+        RunTransfer(scenario);
+
+        scenario.Name = "1K, YModem-G";
+        scenario.Streaming = true;
+        RunTransfer(scenario);
+    }
+
+    PrintTransferHeader("Build for 128 byte packets only (200K image replacing another, 128 B packets and header, no digests)");
+    for (bool small : { false, true })
+    {
+        for (bool streaming : { false, true })
+        {
+            Scenario scenario;
+            scenario.Name = small ? (streaming ? "128 B build, G" : "128 B build, YModem") : (streaming ? "1K build, G" : "1K build, YModem");
+            scenario.PacketSize = 128;
+            scenario.HeaderSize = 128;
+            scenario.Digests = false;
+            scenario.Streaming = streaming;
+            small ? RunTransfer<SmallReceiver>(scenario) : RunTransfer(scenario);
+        }
+    }
+
+    PrintTransferHeader("Extended frames (200K image into blank flash, 8K build)");
+    for (uint64_t latency : { 1000000, 4000000 })
+    {
+        for (bool streaming : { false, true })
+        {
+            for (uint16_t size : { 128, 1024, 4096, 8192 })
+            {
+                char name[40];
+                snprintf(name, sizeof(name), "%.0fms, %s, %u B", latency / 1e6, streaming ? "G" : "YModem", size);
+
+                Scenario scenario;
+                scenario.Name = name;
+                scenario.PacketSize = size;
+                scenario.Streaming = streaming;
+                scenario.LatencyNanos = latency;
+                scenario.Flash = Scenario::Previous::Blank;
+                RunTransfer<FrameReceiver>(scenario);
+            }
+        }
+    }
+    {
+        // A build without extended frames does not answer the `frame` option, the sender falls back to 1K
+        Scenario scenario;
+        scenario.Name = "8K to the 1K build";
+        scenario.PacketSize = 8192;
+        scenario.Streaming = false;
+        scenario.Flash = Scenario::Previous::Blank;
+        RunTransfer(scenario);
+    }
+
+    {
+        Scenario scenario;
+        scenario.Name = "1K, YModem, stats";
+        scenario.Streaming = false;
+        scenario.Version = 0x10200;
+        PrintTransferHeader("Statistics of one session");
+        RunTransfer(scenario, true);
+    }
+
+    PrintTransferHeader("Link latency (200K image, 1K packets)");
+    for (uint64_t latency : { 125000, 1000000, 4000000 })
+    {
+        for (bool streaming : { false, true })
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%.3fms, %s", latency / 1e6, streaming ? "YModem-G" : "YModem");
+
+            Scenario scenario;
+            scenario.Name = name;
+            scenario.Streaming = streaming;
+            scenario.LatencyNanos = latency;
+            RunTransfer(scenario);
+        }
+    }
+
+    PrintTransferHeader("Image size (1K packets, YModem-G)");
+    for (uint32_t size : { 16 * 1024, 64 * 1024, 200 * 1024 })
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%uK", size / 1024);
+
+        Scenario scenario;
+        scenario.Name = name;
+        scenario.ImageSize = size;
+        RunTransfer(scenario);
+    }
+
+    PrintTransferHeader("Flash contents before the update (200K image, 1K packets, YModem-G)");
+    {
+        Scenario scenario;
+        scenario.Name = "other image";
+        RunTransfer(scenario);
+
+        scenario.Name = "blank";
+        scenario.Flash = Scenario::Previous::Blank;
+        RunTransfer(scenario);
+
+        scenario.Name = "same image";
+        scenario.Flash = Scenario::Previous::Same;
+        RunTransfer(scenario);
+
+        scenario.Name = "one chunk changed";
+        scenario.Flash = Scenario::Previous::OneChunkChanged;
+        RunTransfer(scenario);
+
+        scenario.Name = "same, log full";
+        scenario.Flash = Scenario::Previous::Same;
+        scenario.FullLog = true;
+        RunTransfer(scenario);
+
+        scenario.Name = "64K same, log full";
+        scenario.ImageSize = 64 * 1024;
+        RunTransfer(scenario);
+    }
+
+    BenchmarkBatch();
+    BenchmarkResume();
+    BenchmarkFaults();
+    BenchmarkVerify();
+    BenchmarkReplies();
+    BenchmarkSparse();
+    BenchmarkFlashEngine();
+#if defined(YMODEM_TRACE)
+    BenchmarkTrace();
+#endif
+    BenchmarkBoot();
+
+    std::vector<uint8_t> firmware = FirmwareImage(200 * 1024, 5);
+    std::vector<uint8_t> random = RandomImage(200 * 1024, 6);
+    std::vector<uint8_t> file;
+    if (argc > 1)
+    {
+        FILE* input = fopen(argv[1], "rb");
+        if (input != nullptr)
+        {
+            uint8_t chunk[4096];
+            size_t length;
+            while ((length = fread(chunk, 1, sizeof(chunk), input)) > 0 && file.size() < (size_t)Hardware::MaxImageSize)
+            {
+                file.insert(file.end(), chunk, chunk + length);
+            }
+            fclose(input);
+            file.resize(std::min(file.size(), (size_t)Hardware::MaxImageSize));
+        }
+    }
+
+    printf("\nHeatshrink W%u L%u (host CPU, pass a firmware file to include it)\n", HeatshrinkDecoder::WindowBits, HeatshrinkDecoder::LookaheadBits);
+    printf("%-22s %9s %9s %8s %12s %12s %6s\n", "image", "bytes", "packed", "ratio %", "encode MB/s", "decode MB/s", "check");
+    BenchmarkCodec("firmware-like", firmware);
+    BenchmarkCodec("random", random);
+    if (file.empty() == false)
+    {
+        BenchmarkCodec(argv[1], file);
+    }
+
+    PrintTransferHeader("Compression (200K firmware-like image replacing another, 1K packets)");
+    for (uint64_t latency : { 1000000, 4000000 })
+    {
+        for (bool streaming : { false, true })
+        {
+            for (bool compress : { false, true })
+            {
+                char name[40];
+                snprintf(name, sizeof(name), "%.0fms, %s%s", latency / 1e6, streaming ? "G" : "YModem", compress ? ", packed" : "");
+
+                Scenario scenario;
+                scenario.Name = name;
+                scenario.Image = &firmware;
+                scenario.Streaming = streaming;
+                scenario.LatencyNanos = latency;
+                scenario.Compress = compress;
+                RunTransfer(scenario);
+            }
+        }
+    }
+
+    {
+        Scenario scenario;
+        scenario.Name = "blank, G, packed";
+        scenario.Image = &firmware;
+        scenario.Flash = Scenario::Previous::Blank;
+        scenario.Compress = true;
+        RunTransfer(scenario);
+
+        scenario.Name = "blank, G";
+        scenario.Compress = false;
+        RunTransfer(scenario);
+    }
+
+    if (Failures > 0)
+    {
+        printf("\n%u checks FAILED\n", Failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,30 +1,112 @@
 #include <Arduino.h>
+#include <backup.h>
 #include "ymodem.h"
+#include "ImageDescriptor.h"
+#include "Stm32Flash.h"
+#include "UsbTransport.h"
+#include "ArduinoClock.h"
 
-uint8_t inputFile[128];
+// Backup registers survive a reset as long as the board stays powered
+// The application writes UploadRequestMagic to UploadRequestRegister and resets to get into the upload window
+static const uint32_t UploadRequestRegister = 0;
+static const uint32_t UploadRequestMagic = 0x55504C44; // "UPLD"
+// The microseconds from the start of the core to the handoff, for the application to read. The next boot into the
+// upload window reports it in the INFO answer, the uploader prints it after an upload.
+static const uint32_t BootTimeRegister = 1;
 
-void setup() {
-  SerialUSB.begin();
-  int32_t fileSize = 0;
-  YModem::ReceiveFile(&inputFile[0], &fileSize);
+// How long a power up with a valid image listens for a host before it starts the application, enough for the
+// uploader to find the port once it enumerates. Every such boot takes this much longer to reach the application.
+// The application's upload request extends it.
+static const uint32_t HostDetectMillis = 2000;
+static const uint32_t RequestedWindowMillis = 30000;
+
+// The largest packet taken, a build with -D YMODEM_MAX_PACKET=128 only takes 128 byte packets and needs less RAM,
+// one with 4096 or 8192 also takes extended frames up to that size from hosts that offer them
+#ifndef YMODEM_MAX_PACKET
+#define YMODEM_MAX_PACKET PACKET_1K_SIZE
+#endif
+
+UsbTransport transport;
+ArduinoClock systemClock;
+Stm32Flash flash;
+
+// A build with -D YMODEM_TRACE records every session, readable with the uploader's --trace
+#if defined(YMODEM_TRACE)
+TracedTransport<UsbTransport> tracedTransport(transport);
+using Bootloader = YModem<TracedTransport<UsbTransport>, Stm32Flash, YMODEM_MAX_PACKET>;
+#else
+using Bootloader = YModem<UsbTransport, Stm32Flash, YMODEM_MAX_PACKET>;
+#endif
+
+bool transportStarted = false;
+
+static bool UploadRequested() {
+  enableBackupDomain();
+  bool requested = getBackupRegister(UploadRequestRegister) == UploadRequestMagic;
+
+  // Only for this boot, the next reset goes straight to the application again
+  if (requested)
+  {
+    setBackupRegister(UploadRequestRegister, 0);
+  }
+
+  return requested;
+}
 
+// Waits for the first byte of a host, a header packet or a command, without taking it
+static bool HostDetected(uint32_t timeout) {
+  uint32_t start = millis();
+
+  while (millis() - start < timeout)
+  {
+    if (transport.Available() > 0)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Hands the MCU over in the state the application expects after a reset: USB, clocks and peripherals
+// back to their defaults, no interrupt enabled or pending, and the vector table of the application
+static void StartApplication() {
   // First 32bit is the stack pointer address
   // Second 4 bytes are the reset handler (which is also the entry point)
-  volatile uint32_t* stackAddressPointer = (volatile uint32_t*)(Hardware::STM32BaseAddress + Hardware::FirmwareCodeOffset);
-  volatile uint32_t* entryPointPointer = (volatile uint32_t*)(Hardware::STM32BaseAddress + Hardware::FirmwareCodeOffset + 0x4);
+  const uint32_t vectorTable = Hardware::STM32BaseAddress + Hardware::FirmwareCodeOffset;
+  uint32_t stackAddress = *(volatile uint32_t*)vectorTable;
+  uint32_t entryPoint = *(volatile uint32_t*)(vectorTable + 4);
 
-  volatile uint32_t stackAddress = *stackAddressPointer;
-  volatile uint32_t entryPoint = *entryPointPointer;
+  if (transportStarted)
+  {
+    transport.End();
+  }
 
-  SerialUSB.end();
-  delay(1000);
+  setBackupRegister(BootTimeRegister, micros());
 
-  void (*FirmwareEntryPoint)(void) = (void (*)(void))entryPoint;
+  // Both still need SysTick for their timeouts
+  HAL_RCC_DeInit();
+  HAL_DeInit();
+
+  __disable_irq();
+  SysTick->CTRL = 0;
+  SysTick->LOAD = 0;
+  SysTick->VAL = 0;
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    NVIC->ICER[i] = 0xFFFFFFFF;
+    NVIC->ICPR[i] = 0xFFFFFFFF;
+  }
+
+  SCB->VTOR = vectorTable;
+  __DSB();
+  __ISB();
 
   __set_MSP(stackAddress);
-	SysTick->CTRL = 0;
-	SysTick->LOAD = 0;
-	SysTick->VAL = 0;
+  __enable_irq();
+
+  void (*FirmwareEntryPoint)(void) = (void (*)(void))entryPoint;
 
   while (1)
   {
@@ -32,6 +114,42 @@ void setup() {
   }
 }
 
+void setup() {
+  uint32_t window = UploadRequested() ? RequestedWindowMillis : HostDetectMillis;
+  Bootloader::SetLastBootMicros(getBackupRegister(BootTimeRegister));
+
+#if defined(YMODEM_TRACE)
+  Trace::Start(&systemClock);
+  Bootloader::Init(&tracedTransport, &systemClock, &flash);
+#else
+  Bootloader::Init(&transport, &systemClock, &flash);
+#endif
+  transportStarted = true;
+
+  // With a valid image only a host that shows up within the window gets the upload window, without one it stays open.
+  // The decision trusts the descriptor log, not the image contents: Check only reads the log, so an image damaged
+  // after its descriptor was written still starts. Verify would catch that, by reading the whole image back at every boot.
+  if (ImageDescriptor::Check(&flash) == ImageCheckResult::Valid && HostDetected(window) == false)
+  {
+    StartApplication();
+  }
+
+  while (true)
+  {
+    int32_t fileSize = 0;
+    Bootloader::ReceiveFile(&fileSize);
+
+    // Gives the host a moment to query the statistics of the session
+    Bootloader::ServeCommands(1000);
+
+    // Only leaves the upload window for an image that made it into the flash completely, as recorded in the log
+    if (ImageDescriptor::Check(&flash) == ImageCheckResult::Valid)
+    {
+      StartApplication();
+    }
+  }
+}
+
 void loop() {
 }
 
@@ -42,4 +160,4 @@ void loop() {
         "usb_manufacturer": "Klipper",
         "usb_product": "stm32f401xc"
     }
-*/
\ No newline at end of file
+*/
@@ -0,0 +1,90 @@
+// The host's heatshrink encoder against the bootloader's decoder, with input and output cut up like in a session.
+
+#include <algorithm>
+#include <unity.h>
+#include "HeatshrinkDecoder.h"
+#include "host/HeatshrinkEncoder.h"
+#include "host/TestImages.h"
+
+/// @brief Decodes `compressed` in pieces of at most `inputLength` bytes into buffers of at most `outputLength`.
+static std::vector<uint8_t> Decode(const std::vector<uint8_t>& compressed, size_t size, uint16_t inputLength, uint16_t outputLength)
+{
+    static HeatshrinkDecoder decoder;
+    std::vector<uint8_t> decoded(size);
+    size_t input = 0;
+    size_t output = 0;
+
+    decoder.Begin((int32_t)size);
+    while (decoder.IsDone() == false && (input < compressed.size() || output < size))
+    {
+        uint16_t length = (uint16_t)std::min((size_t)inputLength, compressed.size() - input);
+        uint16_t capacity = (uint16_t)std::min((size_t)outputLength, size - output);
+        uint16_t produced;
+        uint16_t used = decoder.Decode(&compressed[input], length, &decoded[output], capacity, &produced);
+        TEST_ASSERT_TRUE(used > 0 || produced > 0);
+
+        input += used;
+        output += produced;
+    }
+
+    TEST_ASSERT_TRUE(decoder.IsDone());
+    TEST_ASSERT_EQUAL_UINT32(size, output);
+    return decoded;
+}
+
+static void CheckRoundTrip(const std::vector<uint8_t>& image)
+{
+    std::vector<uint8_t> compressed = HeatshrinkEncoder().Encode(image);
+
+    // 1K packets into the writer's 1K buffers, and the worst cases of both
+    TEST_ASSERT_TRUE(Decode(compressed, image.size(), 1024, 1024) == image);
+    TEST_ASSERT_TRUE(Decode(compressed, image.size(), 1, 1024) == image);
+    TEST_ASSERT_TRUE(Decode(compressed, image.size(), 1024, 1) == image);
+    TEST_ASSERT_TRUE(Decode(compressed, image.size(), 128, 100) == image);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void TestFirmware()
+{
+    std::vector<uint8_t> image = FirmwareImage(64 * 1024, 5);
+    CheckRoundTrip(image);
+    TEST_ASSERT_LESS_THAN_UINT32(image.size() * 3 / 4, HeatshrinkEncoder().Encode(image).size());
+}
+
+/// @brief Incompressible data grows by at most one bit per byte.
+static void TestRandom()
+{
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 6);
+    CheckRoundTrip(image);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(image.size() * 9 / 8 + 1, HeatshrinkEncoder().Encode(image).size());
+}
+
+static void TestErasedRuns()
+{
+    CheckRoundTrip(std::vector<uint8_t>(64 * 1024, 0xFF));
+}
+
+static void TestShortImages()
+{
+    for (uint32_t size : { 1, 2, 3, 17, 1023, 1025 })
+    {
+        CheckRoundTrip(RandomImage(size, size));
+    }
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestFirmware);
+    RUN_TEST(TestRandom);
+    RUN_TEST(TestErasedRuns);
+    RUN_TEST(TestShortImages);
+    return UNITY_END();
+}
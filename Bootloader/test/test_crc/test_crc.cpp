@@ -0,0 +1,115 @@
+// The CRC kernels against fixed values, not just against each other: the CRC16 values come from `Crc16Ccitt.cs`
+// of the uploader, the CRC32 values from a plain bitwise CRC-32/MPEG-2.
+
+#include <vector>
+#include <unity.h>
+#include "Crc16.h"
+#include "Crc32.h"
+
+/// @brief A length and the CRC16 of that many bytes of `Pattern`.
+struct Vector {
+    uint32_t Length;
+    uint16_t Crc;
+};
+
+/// @brief Lengths around the 4 byte steps of the sliced kernel and the packet sizes.
+static const Vector Vectors[] = {
+    { 0, 0x0000 }, { 1, 0x70E7 }, { 2, 0xDD33 }, { 7, 0xD0CA }, { 8, 0xFC53 }, { 9, 0x6363 }, { 15, 0x0267 },
+    { 16, 0x0D37 }, { 17, 0x7955 }, { 128, 0x63E1 }, { 1024, 0xF009 }, { 1029, 0x2B7A }, { 4096, 0x76D0 },
+};
+
+struct Kernel {
+    const char* Name;
+    uint16_t (*Compute)(const uint8_t*, uint32_t, uint16_t);
+};
+
+static const Kernel Kernels[] = {
+    { "bitwise", Crc16::ComputeBitwise }, { "table", Crc16::ComputeTable }, { "sliced", Crc16::ComputeSliced }, { "default", Crc16::Compute },
+};
+
+/// @brief The bytes the vectors were computed over, `i * 31 + 7`.
+static std::vector<uint8_t> Pattern(uint32_t length)
+{
+    std::vector<uint8_t> data(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        data[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    return data;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// @brief The XMODEM check value, CRC-16/CCITT with initial value 0.
+static void TestCrc16CheckValue()
+{
+    const char* check = "123456789";
+    for (const Kernel& kernel : Kernels)
+    {
+        TEST_ASSERT_EQUAL_HEX16_MESSAGE(0x31C3, kernel.Compute((const uint8_t*)check, 9, 0), kernel.Name);
+    }
+}
+
+static void TestCrc16Vectors()
+{
+    std::vector<uint8_t> data = Pattern(4096);
+    for (const Kernel& kernel : Kernels)
+    {
+        for (const Vector& vector : Vectors)
+        {
+            TEST_ASSERT_EQUAL_HEX16_MESSAGE(vector.Crc, kernel.Compute(data.data(), vector.Length, 0), kernel.Name);
+        }
+    }
+}
+
+/// @brief A checksum carried over from a previous block continues it, at any offset and alignment.
+static void TestCrc16Continued()
+{
+    std::vector<uint8_t> data = Pattern(1029);
+    for (const Kernel& kernel : Kernels)
+    {
+        for (uint32_t split : { 1, 3, 4, 5, 512, 1027 })
+        {
+            uint16_t crc = kernel.Compute(data.data(), split, 0);
+            TEST_ASSERT_EQUAL_HEX16_MESSAGE(0x2B7A, kernel.Compute(data.data() + split, 1029 - split, crc), kernel.Name);
+        }
+    }
+}
+
+/// @brief Words are read little-endian and processed most significant byte first, so "12345678" is checked as
+///        "43218765", and a trailing partial word is padded with 0xFF in front of the bytes.
+static void TestCrc32WordOrder()
+{
+    TEST_ASSERT_EQUAL_HEX32(0xFEFC54F9, Crc32::Update(Crc32::InitialValue, (const uint8_t*)"12345678", 8));
+    TEST_ASSERT_EQUAL_HEX32(0x9AA837F8, Crc32::Update(Crc32::InitialValue, (const uint8_t*)"12345", 5));
+}
+
+/// @brief The running checksum matches the one computed in one go.
+static void TestRunningCrc32()
+{
+    std::vector<uint8_t> data = Pattern(4096);
+    RunningCrc32 crc;
+    crc.Begin();
+    crc.Add(data.data(), 1024);
+    crc.Add(data.data() + 1024, 3069);
+
+    TEST_ASSERT_EQUAL_HEX32(Crc32::Update(Crc32::InitialValue, data.data(), 4093), crc.Value());
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestCrc16CheckValue);
+    RUN_TEST(TestCrc16Vectors);
+    RUN_TEST(TestCrc16Continued);
+    RUN_TEST(TestCrc32WordOrder);
+    RUN_TEST(TestRunningCrc32);
+    return UNITY_END();
+}
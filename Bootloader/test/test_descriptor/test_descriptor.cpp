@@ -0,0 +1,140 @@
+// The descriptor log and the boot decision. `Check` only reads the log: it trusts a record of a complete image, also
+// when the image has been changed since. `Verify` reads the image back.
+
+#include <unity.h>
+#include "ImageDescriptor.h"
+#include "host/Session.h"
+#include "host/TestImages.h"
+
+static VirtualClock Clock;
+
+/// @brief Flash holding an image of `size` bytes and, in `slot`, a record of it.
+struct Described {
+    SimulatedFlash Flash { Clock, Hardware::STM32BaseAddress, Hardware::FlashSize };
+    std::vector<uint8_t> Image;
+    ImageRecord Record;
+
+    Described(uint32_t size, uint8_t slot = 0)
+        : Image(RandomImage(size, 8))
+    {
+        memcpy(Flash.At(ImageDescriptor::ImageAddress), Image.data(), Image.size());
+        Record = ImageDescriptor::Make(size, Crc32::Update(Crc32::InitialValue, Image.data(), size), 1);
+        Write(slot);
+    }
+
+    void Write(uint8_t slot)
+    {
+        memcpy(Flash.At(ImageDescriptor::SlotAddress(slot)), &Record, sizeof(Record));
+    }
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void TestNoDescriptor()
+{
+    SimulatedFlash flash(Clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 8);
+    memcpy(flash.At(ImageDescriptor::ImageAddress), image.data(), image.size());
+
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Check(&flash));
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&flash));
+}
+
+static void TestValidImages()
+{
+    for (uint32_t size : { 16 * 1024, 200 * 1024 + 3, (int)Hardware::MaxImageSize })
+    {
+        Described described(size);
+        TEST_ASSERT_EQUAL(ImageCheckResult::Valid, ImageDescriptor::Check(&described.Flash));
+        TEST_ASSERT_EQUAL(ImageCheckResult::Valid, ImageDescriptor::Verify(&described.Flash));
+    }
+}
+
+/// @brief The latest record counts, the ones of earlier updates before it are ignored.
+static void TestFullLog()
+{
+    Described described(200 * 1024);
+    FillDescriptorLog(described.Flash);
+    described.Write(ImageDescriptor::SlotCount - 1);
+
+    TEST_ASSERT_EQUAL(ImageDescriptor::SlotCount, ImageDescriptor::FreeSlot(&described.Flash));
+    TEST_ASSERT_EQUAL(ImageCheckResult::Valid, ImageDescriptor::Verify(&described.Flash));
+
+    ImageRecord latest;
+    uint8_t slot;
+    TEST_ASSERT_TRUE(ImageDescriptor::FindLatest(&described.Flash, &latest, &slot));
+    TEST_ASSERT_EQUAL_UINT8(ImageDescriptor::SlotCount - 1, slot);
+    TEST_ASSERT_EQUAL_UINT32(200 * 1024, latest.Size);
+}
+
+/// @brief  An update that started invalidates the record, the image is not booted until a new one is complete. So is a
+///         record cut short by a reset.
+static void TestInterruptedUpdate()
+{
+    Described described(200 * 1024);
+    described.Record.Magic = 0;
+    described.Write(0);
+
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Check(&described.Flash));
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&described.Flash));
+
+    Described cut(200 * 1024);
+    cut.Record.Check = 0xFFFFFFFF;
+    cut.Write(0);
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Check(&cut.Flash));
+}
+
+/// @brief The boot decision trusts the log: only reading the image back finds it damaged.
+static void TestDamagedImage()
+{
+    Described described(200 * 1024);
+    described.Flash.At(ImageDescriptor::ImageAddress)[200 * 1024 / 3] ^= 0x5A;
+
+    TEST_ASSERT_EQUAL(ImageCheckResult::Valid, ImageDescriptor::Check(&described.Flash));
+    TEST_ASSERT_EQUAL(ImageCheckResult::Mismatch, ImageDescriptor::Verify(&described.Flash));
+}
+
+/// @brief A record of an image larger than the flash for it, or of none, is not booted.
+static void TestImpossibleSizes()
+{
+    for (uint32_t size : { 0u, (uint32_t)Hardware::MaxImageSize + 4 })
+    {
+        Described described(16 * 1024);
+        described.Record = ImageDescriptor::Make(size, described.Record.Crc, 1);
+        described.Write(0);
+
+        TEST_ASSERT_EQUAL(ImageCheckResult::Mismatch, ImageDescriptor::Check(&described.Flash));
+        TEST_ASSERT_EQUAL(ImageCheckResult::Mismatch, ImageDescriptor::Verify(&described.Flash));
+    }
+}
+
+/// @brief A trailing partial word is taken as padded with the erased value.
+static void TestPartialWordCrc()
+{
+    Described described(1001);
+    described.Flash.At(ImageDescriptor::ImageAddress)[1001] = 0x00;
+
+    std::vector<uint8_t> padded = described.Image;
+    padded.resize(1004, 0xFF);
+    TEST_ASSERT_EQUAL_HEX32(Crc32::Update(Crc32::InitialValue, padded.data(), padded.size()),
+        ImageDescriptor::ComputeCrc(&described.Flash, ImageDescriptor::ImageAddress, 1001));
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestNoDescriptor);
+    RUN_TEST(TestValidImages);
+    RUN_TEST(TestFullLog);
+    RUN_TEST(TestInterruptedUpdate);
+    RUN_TEST(TestDamagedImage);
+    RUN_TEST(TestImpossibleSizes);
+    RUN_TEST(TestPartialWordCrc);
+    return UNITY_END();
+}
@@ -0,0 +1,197 @@
+// `PacketParser` on a stream of every kind of packet and event, whole and split up the way USB hands it over.
+
+#include <algorithm>
+#include <random>
+#include <unity.h>
+#include "ymodem.h"
+#include "host/TestImages.h"
+
+using Parser = PacketParser<PACKET_MAX_FRAME_SIZE>;
+
+static const uint16_t FrameSize = 4096;
+
+/// @brief A stream of packets and events, and what the parser has to find in it.
+struct Stream {
+    std::vector<uint8_t> Bytes;
+    std::vector<ParseEvent> Expected;
+
+    /// @brief The offset of the payload of each packet, including the malformed ones.
+    std::vector<size_t> Payloads;
+
+    std::vector<uint8_t> Data = RandomImage(FrameSize, 26);
+
+    void Add(uint8_t start, uint8_t sequence, uint16_t size, bool garbled = false)
+    {
+        Bytes.insert(Bytes.end(), { start, sequence, (uint8_t)~sequence });
+        Payloads.push_back(Bytes.size());
+        Bytes.insert(Bytes.end(), Data.begin(), Data.begin() + size);
+        uint16_t crc = Crc16::ComputeBitwise(Data.data(), size, 0) ^ (garbled ? 1 : 0);
+        Bytes.insert(Bytes.end(), { (uint8_t)(crc >> 8), (uint8_t)crc });
+        Expected.push_back(garbled ? ParseEvent::Malformed : ParseEvent::Packet);
+    }
+
+    void AddByte(uint8_t value, ParseEvent event)
+    {
+        Bytes.push_back(value);
+        Expected.push_back(event);
+    }
+};
+
+/// @brief A header, data packets of every size, skip frames, a garbled packet, a stray byte, an EOT and a cancel.
+static Stream EveryKind()
+{
+    Stream stream;
+    stream.Add(SOH, 0, PACKET_SIZE);
+    for (uint8_t sequence = 1; sequence <= 96; sequence++)
+    {
+        stream.Add(sequence % 16 == 0 ? SKP : sequence % 8 == 0 ? SOF : sequence % 5 == 0 ? SOH : STX, sequence,
+            sequence % 16 == 0 ? SKIP_FRAME_SIZE : sequence % 8 == 0 ? FrameSize : sequence % 5 == 0 ? PACKET_SIZE : PACKET_1K_SIZE,
+            sequence == 50);
+
+        if (sequence == 70)
+        {
+            stream.AddByte(0x7E, ParseEvent::Unknown);
+        }
+    }
+    stream.AddByte(EOT, ParseEvent::FileDone);
+    stream.Bytes.push_back(CA);
+    stream.AddByte(CA, ParseEvent::Aborted);
+
+    return stream;
+}
+
+/// @brief Feeds `stream` in fragments of `minLength` to `maxLength` bytes and checks every event and packet.
+static void CheckFragmented(const Stream& stream, uint16_t minLength, uint16_t maxLength)
+{
+    static Parser parser;
+    PacketFrame frame;
+    alignas(4) static uint8_t buffers[2][PACKET_MAX_FRAME_SIZE];
+    std::mt19937 random(27);
+
+    size_t events = 0;
+    size_t packets = 0;
+    parser.Begin(&frame, buffers[0], FrameSize, true);
+
+    for (size_t position = 0; position < stream.Bytes.size();)
+    {
+        uint16_t length = (uint16_t)(minLength + random() % (maxLength - minLength + 1));
+        length = (uint16_t)std::min((size_t)length, stream.Bytes.size() - position);
+        const uint8_t* chunk = &stream.Bytes[position];
+        position += length;
+
+        // The rest of a fragment after an event belongs to the next packet
+        while (length > 0)
+        {
+            ParseEvent event;
+            uint16_t taken = parser.Feed(chunk, length, &event);
+            chunk += taken;
+            length -= taken;
+
+            if (event == ParseEvent::None)
+            {
+                continue;
+            }
+
+            TEST_ASSERT_LESS_THAN_UINT32(stream.Expected.size(), events);
+            TEST_ASSERT_EQUAL(stream.Expected[events], event);
+            if (event == ParseEvent::Packet || event == ParseEvent::Malformed)
+            {
+                size_t payload = stream.Payloads[packets++];
+                TEST_ASSERT_EQUAL_HEX8(stream.Bytes[payload - 2], frame.Header[PACKET_SEQNO_INDEX]);
+                if (event == ParseEvent::Packet)
+                {
+                    TEST_ASSERT_EQUAL_MEMORY(&stream.Bytes[payload], frame.Payload, parser.GetPayloadSize());
+                }
+            }
+
+            events++;
+            parser.Begin(&frame, buffers[events & 1], FrameSize, true);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(stream.Expected.size(), events);
+    TEST_ASSERT_TRUE(parser.IsIdle());
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void TestWholeFrames()
+{
+    CheckFragmented(EveryKind(), 4096, 4096);
+}
+
+static void TestUsbPackets()
+{
+    CheckFragmented(EveryKind(), 64, 64);
+}
+
+static void TestRandomFragments()
+{
+    CheckFragmented(EveryKind(), 1, 1100);
+    CheckFragmented(EveryKind(), 1, 64);
+}
+
+static void TestSingleBytes()
+{
+    CheckFragmented(EveryKind(), 1, 1);
+}
+
+/// @brief A wrong sequence number complement makes the packet malformed even with a matching CRC.
+static void TestSequenceComplement()
+{
+    Stream stream;
+    stream.Add(STX, 3, PACKET_1K_SIZE);
+    stream.Bytes[2] ^= 0x10;
+    stream.Expected[0] = ParseEvent::Malformed;
+
+    CheckFragmented(stream, 1, 200);
+}
+
+/// @brief Extended frames and skip frames are only taken once the header packet agreed on them.
+static void TestFramesNeedAgreement()
+{
+    static Parser parser;
+    PacketFrame frame;
+    alignas(4) static uint8_t buffer[PACKET_MAX_FRAME_SIZE];
+
+    for (uint8_t start : { SOF, SKP })
+    {
+        parser.Begin(&frame, buffer, 0, false);
+        ParseEvent event;
+        TEST_ASSERT_EQUAL_UINT16(1, parser.Feed(&start, 1, &event));
+        TEST_ASSERT_EQUAL(ParseEvent::Unknown, event);
+    }
+}
+
+/// @brief The 128 byte build does not take 1K packets.
+static void TestSmallBuildRefusesStx()
+{
+    static PacketParser<PACKET_SIZE> parser;
+    PacketFrame frame;
+    alignas(4) static uint8_t buffer[PACKET_SIZE];
+    uint8_t start = STX;
+
+    parser.Begin(&frame, buffer, 0, false);
+    ParseEvent event;
+    parser.Feed(&start, 1, &event);
+    TEST_ASSERT_EQUAL(ParseEvent::Unknown, event);
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestWholeFrames);
+    RUN_TEST(TestUsbPackets);
+    RUN_TEST(TestRandomFragments);
+    RUN_TEST(TestSingleBytes);
+    RUN_TEST(TestSequenceComplement);
+    RUN_TEST(TestFramesNeedAgreement);
+    RUN_TEST(TestSmallBuildRefusesStx);
+    return UNITY_END();
+}
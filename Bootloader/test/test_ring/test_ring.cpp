@@ -0,0 +1,117 @@
+// `SpscRing`, alone and with a second thread standing in for the USB interrupt.
+
+#include <thread>
+#include <unity.h>
+#include "SpscRing.h"
+
+/// @brief The bytes pushed and checked by the tests, a pseudo random sequence.
+struct Sequence {
+    uint32_t Seed;
+
+    uint8_t Next()
+    {
+        Seed = Seed * 1103515245 + 12345;
+        return (uint8_t)(Seed >> 16);
+    }
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// @brief  Pushes and pops of odd sizes wrap around the end of the buffer many times. A push takes what fits and
+///         drops the rest, a pop what is there.
+static void TestWrapAround()
+{
+    static SpscRing<64> ring;
+    Sequence pushed { 1 };
+    Sequence popped { 1 };
+    uint8_t buffer[64];
+
+    for (uint32_t round = 0; round < 1000; round++)
+    {
+        uint32_t length = 1 + round * 7 % 40;
+        uint32_t free = ring.Free();
+        Sequence next = pushed;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            buffer[i] = next.Next();
+        }
+
+        uint32_t added = ring.Push(buffer, length);
+        TEST_ASSERT_EQUAL_UINT32(length < free ? length : free, added);
+        for (uint32_t i = 0; i < added; i++)
+        {
+            pushed.Next();
+        }
+        TEST_ASSERT_EQUAL_UINT32(64, ring.Free() + ring.Available());
+
+        uint32_t read = ring.Pop(buffer, 1 + round * 5 % 48);
+        for (uint32_t i = 0; i < read; i++)
+        {
+            TEST_ASSERT_EQUAL_HEX8(popped.Next(), buffer[i]);
+        }
+    }
+}
+
+/// @brief A producer thread pushes 64 byte packets whenever there is room, the consumer checks every byte arrives once and in order.
+static void TestProducerThread()
+{
+    const uint32_t packetSize = 64;
+    const uint64_t total = 4ull * 1024 * 1024;
+    static SpscRing<4096> ring;
+
+    std::thread producer([&] {
+        Sequence sequence { 7 };
+        uint8_t packet[packetSize];
+        for (uint64_t pushed = 0; pushed < total;)
+        {
+            for (uint8_t& value : packet)
+            {
+                value = sequence.Next();
+            }
+
+            while (ring.Free() < packetSize)
+            {
+                std::this_thread::yield();
+            }
+            pushed += ring.Push(packet, packetSize);
+        }
+    });
+
+    Sequence sequence { 7 };
+    uint8_t buffer[1100];
+    uint32_t lengthSeed = 11;
+    bool ordered = true;
+    for (uint64_t popped = 0; popped < total;)
+    {
+        lengthSeed = lengthSeed * 1103515245 + 12345;
+        uint32_t read = ring.Pop(buffer, 1 + (lengthSeed >> 8) % sizeof(buffer));
+        for (uint32_t i = 0; i < read; i++)
+        {
+            ordered &= buffer[i] == sequence.Next();
+        }
+
+        if (read == 0)
+        {
+            std::this_thread::yield();
+        }
+        popped += read;
+    }
+
+    producer.join();
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL_UINT32(0, ring.Available());
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestWrapAround);
+    RUN_TEST(TestProducerThread);
+    return UNITY_END();
+}
@@ -0,0 +1,537 @@
+// Sessions of the bootloader against the simulated host, link and flash: what ends up in the flash and the descriptor
+// log for transfers in every mode, batches, resumed and rewound updates, faulty links and files it has to refuse.
+
+#include <unity.h>
+#include "host/InfoQuery.h"
+#include "host/Session.h"
+#include "host/StatsQuery.h"
+#include "host/TestImages.h"
+
+static const uint32_t ImageAddress = ImageDescriptor::ImageAddress;
+
+/// @brief The data file address used by the batch tests: the last sector, which it shares with the descriptor log.
+static const uint32_t DataAddress = Hardware::STM32BaseAddress + Hardware::SectorOffsets[Hardware::SectorCount - 1];
+
+/// @brief A board on a 1ms link, its flash holding another image than the ones sent.
+struct Board {
+    VirtualClock Clock;
+    SimulatedLink Link { Clock };
+    SimulatedFlash Flash { Clock, Hardware::STM32BaseAddress, Hardware::FlashSize };
+
+    Board(bool blank = false)
+    {
+        Link.LatencyNanos = 1000000;
+        if (blank == false)
+        {
+            Hold(RandomImage(200 * 1024, 100));
+        }
+    }
+
+    void Hold(const std::vector<uint8_t>& image)
+    {
+        memcpy(Flash.At(ImageAddress), image.data(), image.size());
+    }
+
+    template <typename TReceiver = Receiver>
+    ReceiveFileResult Run(YModemSender& sender)
+    {
+        return RunSession<TReceiver>(Clock, Link, Flash, sender);
+    }
+
+    /// @brief Asks for the statistics of the last session like the uploader's `--stats`.
+    StatsQuery Stats()
+    {
+        StatsQuery query;
+        Link.Connect(&query);
+        Receiver::ServeCommands(100);
+        TEST_ASSERT_TRUE(query.Decode());
+        return query;
+    }
+
+    /// @return Whether the flash holds `image` and the descriptor describes it.
+    bool HasImage(const std::vector<uint8_t>& image)
+    {
+        return memcmp(Flash.At(ImageAddress), image.data(), image.size()) == 0
+            && ImageDescriptor::Verify(&Flash) == ImageCheckResult::Valid;
+    }
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void TestYModem()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 1);
+    YModemSender sender(image, "firmware.bin");
+    sender.OfferStreaming = false;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(sender.IsDone());
+    TEST_ASSERT_FALSE(sender.IsStreaming());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+static void TestYModemG()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(64 * 1024 + 100, 2);
+    YModemSender sender(image, "firmware.bin");
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(sender.IsStreaming());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+static void TestCompressed()
+{
+    Board board;
+    std::vector<uint8_t> image = FirmwareImage(200 * 1024, 3);
+    YModemSender sender(image, "firmware.bin");
+    sender.Compress = true;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_LESS_THAN_UINT32(image.size() * 3 / 4, sender.PayloadSize());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+static void TestExtendedFrames()
+{
+    Board board(true);
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 4);
+    YModemSender sender(image, "firmware.bin");
+    sender.PacketSize = 8192;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run<FrameReceiver>(sender));
+    TEST_ASSERT_LESS_THAN_UINT32(image.size() / 4096, sender.PacketsSent);
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+/// @brief A build without extended frames does not answer the `frame` option, the sender stays at 1K.
+static void TestFramesOfferedToThe1KBuild()
+{
+    Board board(true);
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 5);
+    YModemSender sender(image, "firmware.bin");
+    sender.PacketSize = 8192;
+    sender.OfferStreaming = false;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_GREATER_THAN_UINT32(image.size() / 1024, sender.PacketsSent);
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+static void TestSmallBuild()
+{
+    for (bool streaming : { false, true })
+    {
+        Board board;
+        std::vector<uint8_t> image = RandomImage(32 * 1024, 6);
+        YModemSender sender(image, "firmware.bin");
+        sender.PacketSize = 128;
+        sender.HeaderSize = 128;
+        sender.SendDigests = false;
+        sender.OfferStreaming = streaming;
+
+        TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run<SmallReceiver>(sender));
+        TEST_ASSERT_TRUE(board.HasImage(image));
+    }
+}
+
+/// @brief With the digests of the `delta` option the writer leaves the sectors that hold the image already alone.
+static void TestUnchangedImageIsNotErased()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 7);
+    board.Hold(image);
+    YModemSender sender(image, "firmware.bin");
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_EQUAL(0, board.Flash.SectorsErased);
+    TEST_ASSERT_TRUE(board.HasImage(image));
+
+    // The 16K, 16K, 64K and 128K sectors the image touches, the erases and programming that saved are reported
+    StatsQuery stats = board.Stats();
+    TEST_ASSERT_EQUAL_UINT8(0, stats.Flash.SectorsErased);
+    TEST_ASSERT_EQUAL_UINT8(4, stats.Flash.SectorsUnchanged);
+    TEST_ASSERT_EQUAL_UINT32(image.size() / 4, stats.Flash.WordsUnchanged);
+    TEST_ASSERT_EQUAL_UINT32(
+        Hardware::SectorEraseMillis(2) + Hardware::SectorEraseMillis(3) + Hardware::SectorEraseMillis(4) + Hardware::SectorEraseMillis(5)
+            + image.size() / 4 * Hardware::WordProgramMicros / 1000,
+        stats.Flash.MillisSaved);
+}
+
+/// @brief  Sectors that pass the blank check are not erased. The old image covers the first two sectors of the
+///         image area only, the two after them are blank.
+static void TestBlankSectorsAreSkipped()
+{
+    Board board(true);
+    board.Hold(RandomImage(32 * 1024, 28));
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 29);
+    YModemSender sender(image, "firmware.bin");
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(board.HasImage(image));
+
+    StatsQuery stats = board.Stats();
+    TEST_ASSERT_EQUAL_UINT8(2, stats.Flash.SectorsErased);
+    TEST_ASSERT_EQUAL_UINT8(2, stats.Flash.SectorsSkipped);
+    TEST_ASSERT_EQUAL_UINT8(0, stats.Flash.SectorsUnchanged);
+    TEST_ASSERT_EQUAL_UINT32(board.Flash.SectorsErased, stats.Flash.SectorsErased);
+}
+
+/// @brief A full descriptor log is erased with the last sector, the new descriptor has to make it into the fresh log.
+static void TestFullDescriptorLog()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 8);
+    board.Hold(image);
+    FillDescriptorLog(board.Flash);
+    YModemSender sender(image, "firmware.bin");
+    sender.Version = 0x10200;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(board.HasImage(image));
+
+    ImageRecord record;
+    TEST_ASSERT_TRUE(ImageDescriptor::FindLatest(&board.Flash, &record));
+    TEST_ASSERT_EQUAL_HEX32(0x10200, record.Version);
+}
+
+/// @brief  An image that ends before the last sector leaves erasing a full log to the descriptor code, the erase
+///         counts all the same.
+static void TestLogEraseIsCounted()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 30);
+    board.Hold(image);
+    FillDescriptorLog(board.Flash);
+    YModemSender sender(image, "firmware.bin");
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(board.HasImage(image));
+    TEST_ASSERT_EQUAL_UINT32(1, board.Flash.SectorsErased);
+    TEST_ASSERT_EQUAL_UINT8(1, board.Stats().Flash.SectorsErased);
+}
+
+/// @brief The `INFO` command the uploader confirms an upload with.
+static void TestInfoAfterUpload()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 9);
+    YModemSender sender(image, "firmware.bin");
+    sender.Version = 0x20001;
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+
+    InfoQuery info;
+    board.Link.Connect(&info);
+    Receiver::SetLastBootMicros(2001234);
+    Receiver::ServeCommands(100);
+    Receiver::SetLastBootMicros(0);
+
+    TEST_ASSERT_TRUE(info.Decode());
+    TEST_ASSERT_TRUE(info.HasDescriptor);
+    TEST_ASSERT_TRUE(info.Verified);
+    TEST_ASSERT_EQUAL_UINT32(image.size(), info.Size);
+    TEST_ASSERT_EQUAL_HEX32(Crc32::Update(Crc32::InitialValue, image.data(), image.size()), info.Crc);
+    TEST_ASSERT_EQUAL_HEX32(0x20001, info.Version);
+    TEST_ASSERT_EQUAL_UINT32(2001234, info.BootMicros);
+}
+
+static void TestBatchWithDataFile()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(96 * 1024, 10);
+    std::vector<uint8_t> data = RandomImage(16 * 1024, 11);
+    YModemSender sender(image, "firmware.bin");
+    sender.AddFile(data, "config.bin", DataAddress);
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_TRUE(sender.IsDone());
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), board.Flash.At(DataAddress), data.size());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+/// @brief A data file written in a session of its own keeps the descriptor of the image in the shared sector.
+static void TestDataFileKeepsDescriptor()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(96 * 1024, 12);
+    std::vector<uint8_t> data = RandomImage(16 * 1024, 13);
+    YModemSender imageSender(image, "firmware.bin");
+    YModemSender dataSender;
+    dataSender.AddFile(data, "config.bin", DataAddress);
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(imageSender));
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(dataSender));
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), board.Flash.At(DataAddress), data.size());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+static void TestDataFileOverTheImageIsRefused()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(96 * 1024, 14);
+    std::vector<uint8_t> data = RandomImage(16 * 1024, 15);
+    YModemSender sender(image, "firmware.bin");
+    sender.AddFile(data, "config.bin", ImageAddress + 0x8000);
+
+    TEST_ASSERT_NOT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_FALSE(sender.IsDone());
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+/// @brief  An update cut off after three quarters of its packets. It must leave no descriptor, and the next session
+///         for the same image continues where its saved progress ends.
+static void TestResume()
+{
+    for (bool compress : { false, true })
+    {
+        Board board;
+        std::vector<uint8_t> image = compress ? FirmwareImage(200 * 1024, 16) : RandomImage(200 * 1024, 16);
+        YModemSender interrupted(image, "firmware.bin");
+        interrupted.Compress = compress;
+        interrupted.OfferResume = true;
+        interrupted.StopAfterPackets = compress ? 75 : 150;
+
+        TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, board.Run(interrupted));
+        TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Check(&board.Flash));
+
+        YModemSender sender(image, "firmware.bin");
+        sender.Compress = compress;
+        sender.OfferResume = true;
+        TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+        TEST_ASSERT_GREATER_THAN_UINT32(0, sender.ResumedAt);
+        TEST_ASSERT_TRUE(board.HasImage(image));
+    }
+}
+
+static void TestOtherImageIsNotResumed()
+{
+    Board board;
+    std::vector<uint8_t> first = RandomImage(200 * 1024, 17);
+    std::vector<uint8_t> second = RandomImage(200 * 1024, 18);
+    YModemSender interrupted(first, "firmware.bin");
+    interrupted.OfferResume = true;
+    interrupted.StopAfterPackets = 150;
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, board.Run(interrupted));
+
+    YModemSender sender(second, "firmware.bin");
+    sender.OfferResume = true;
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_EQUAL_UINT32(0, sender.ResumedAt);
+    TEST_ASSERT_TRUE(board.HasImage(second));
+}
+
+/// @brief  Plain YModem sends broken or lost packets again, or gives up after too many errors in a row. YModem-G can
+///         only cancel. Either way no broken image may end up with a descriptor.
+static void TestLinkFaults()
+{
+    struct Case {
+        double DropRate;
+        double FlipRate;
+        bool Streaming;
+    };
+
+    for (Case test : { Case { 1e-4, 0, false }, Case { 3e-4, 0, false }, Case { 1e-3, 0, false },
+        Case { 0, 1e-4, false }, Case { 0, 1e-3, false }, Case { 1e-4, 1e-4, false }, Case { 0, 1e-4, true } })
+    {
+        Board board(true);
+        LinkFaults faults;
+        faults.DropRate = test.DropRate;
+        faults.FlipRate = test.FlipRate;
+        faults.Seed = 15;
+        board.Link.SetFaults(faults);
+
+        std::vector<uint8_t> image = RandomImage(64 * 1024, 19);
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = test.Streaming;
+        sender.SendDigests = false;
+
+        if (board.Run(sender) == ReceiveFileResult::Ok)
+        {
+            TEST_ASSERT_FALSE(test.Streaming);
+            TEST_ASSERT_GREATER_THAN_UINT32(0, sender.Retransmissions);
+            TEST_ASSERT_TRUE(board.HasImage(image));
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&board.Flash));
+        }
+    }
+}
+
+/// @brief  A flash word that does not take its data the first time: with `resume` offered the host sends the file
+///         again from the start of its sector, without it the session is cancelled.
+static void TestVerifyRewind()
+{
+    for (bool resume : { true, false })
+    {
+        Board board;
+        board.Flash.WeakAddress = ImageAddress + 40 * 1024 + 0x124;
+        board.Flash.WeakWrites = 1;
+
+        std::vector<uint8_t> image = RandomImage(200 * 1024, 20);
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferResume = resume;
+        ReceiveFileResult result = board.Run(sender);
+
+        TEST_ASSERT_EQUAL_UINT32(0, board.Flash.WeakWrites);
+        if (resume)
+        {
+            TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, result);
+            TEST_ASSERT_EQUAL_UINT32(1, sender.Rewinds);
+            TEST_ASSERT_TRUE(board.HasImage(image));
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, result);
+            TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&board.Flash));
+        }
+    }
+}
+
+static void TestWordThatStaysWeakCancels()
+{
+    Board board;
+    board.Flash.WeakAddress = ImageAddress + 40 * 1024 + 0x124;
+    board.Flash.WeakWrites = 100;
+
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 21);
+    YModemSender sender(image, "firmware.bin");
+    sender.OfferResume = true;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, board.Run(sender));
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&board.Flash));
+}
+
+/// @brief Runs of the erased value go as skip frames, in both modes, and still read back as erased.
+static void TestSparse()
+{
+    std::vector<uint8_t> image = RandomImage(200 * 1024, 22);
+    std::fill(image.begin() + 24 * 1024, image.begin() + 96 * 1024, 0xFF);
+    std::fill(image.begin() + 112 * 1024, image.begin() + 184 * 1024 + 100, 0xFF);
+
+    for (bool streaming : { false, true })
+    {
+        Board board;
+        YModemSender sender(image, "firmware.bin");
+        sender.OfferStreaming = streaming;
+        sender.OfferSparse = true;
+
+        TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+        TEST_ASSERT_EQUAL_UINT32(144 * 1024, sender.BytesSkipped);
+        TEST_ASSERT_EQUAL_UINT32(sender.BytesSkipped, Receiver::GetSkippedBytes());
+        TEST_ASSERT_TRUE(board.HasImage(image));
+    }
+}
+
+/// @brief  A skip run that does not end at a packet boundary leaves the following packets straddling sectors. The
+///         writer must not carry the decision for an unchanged sector over into the next one, which changed.
+static void TestUnalignedSkipRun()
+{
+    std::vector<uint8_t> held = RandomImage(64 * 1024, 27);
+    std::fill(held.begin() + 1024, held.begin() + 2560, 0xFF);
+    std::vector<uint8_t> image = held;
+    uint32_t sectorEnd = Hardware::SectorOffsets[3] - Hardware::FirmwareBinaryFileOffset;
+    std::fill(image.begin() + sectorEnd, image.begin() + sectorEnd + 64, 0x5A);
+
+    Board board;
+    board.Hold(held);
+    YModemSender sender(image, "firmware.bin");
+    sender.OfferSparse = true;
+    sender.ExactSkipRuns = true;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_EQUAL_UINT32(1536, sender.BytesSkipped);
+    TEST_ASSERT_TRUE(board.HasImage(image));
+}
+
+/// @brief YModem allows leaving the size out, the padding of the last packet then ends up in the flash too.
+static void TestUnsizedImage()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(64 * 1024 + 100, 23);
+    YModemSender sender(image, "firmware.bin");
+    sender.AnnounceSize = false;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_EQUAL_MEMORY(image.data(), board.Flash.At(ImageAddress), image.size());
+    TEST_ASSERT_EQUAL(ImageCheckResult::Valid, ImageDescriptor::Verify(&board.Flash));
+}
+
+/// @brief Only the image area bounds a file without a size, its data must not reach the descriptor log.
+static void TestUnsizedImageTooLarge()
+{
+    Board board(true);
+    std::vector<uint8_t> image = RandomImage(Hardware::MaxImageSize + 8 * 1024, 24);
+    YModemSender sender(image, "firmware.bin");
+    sender.AnnounceSize = false;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, board.Run(sender));
+    TEST_ASSERT_EQUAL_HEX8(CA, sender.FailedOn);
+    TEST_ASSERT_TRUE(memcmp(board.Flash.At(ImageDescriptor::LogAddress), &image[Hardware::MaxImageSize], Hardware::DescriptorLogSize) != 0);
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&board.Flash));
+}
+
+/// @brief Neither may a skip run, it is refused before any of it is queued.
+static void TestSkipRunPastTheImageArea()
+{
+    Board board(true);
+    std::vector<uint8_t> image = RandomImage(Hardware::MaxImageSize + 8 * 1024, 25);
+    std::fill(image.begin() + 8 * 1024, image.end(), 0xFF);
+    YModemSender sender(image, "firmware.bin");
+    sender.AnnounceSize = false;
+    sender.OfferSparse = true;
+
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Failed, board.Run(sender));
+    TEST_ASSERT_EQUAL_HEX8(CA, sender.FailedOn);
+    TEST_ASSERT_EQUAL_UINT32(0, Receiver::GetSkippedBytes());
+    TEST_ASSERT_EQUAL(ImageCheckResult::Missing, ImageDescriptor::Verify(&board.Flash));
+}
+
+static void TestImageTooLargeIsRefused()
+{
+    Board board;
+    std::vector<uint8_t> image = RandomImage(Hardware::MaxImageSize + 4, 26);
+    YModemSender sender(image, "firmware.bin");
+
+    TEST_ASSERT_NOT_EQUAL(ReceiveFileResult::Ok, board.Run(sender));
+    TEST_ASSERT_FALSE(sender.IsDone());
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestYModem);
+    RUN_TEST(TestYModemG);
+    RUN_TEST(TestCompressed);
+    RUN_TEST(TestExtendedFrames);
+    RUN_TEST(TestFramesOfferedToThe1KBuild);
+    RUN_TEST(TestSmallBuild);
+    RUN_TEST(TestUnchangedImageIsNotErased);
+    RUN_TEST(TestBlankSectorsAreSkipped);
+    RUN_TEST(TestFullDescriptorLog);
+    RUN_TEST(TestLogEraseIsCounted);
+    RUN_TEST(TestInfoAfterUpload);
+    RUN_TEST(TestBatchWithDataFile);
+    RUN_TEST(TestDataFileKeepsDescriptor);
+    RUN_TEST(TestDataFileOverTheImageIsRefused);
+    RUN_TEST(TestResume);
+    RUN_TEST(TestOtherImageIsNotResumed);
+    RUN_TEST(TestLinkFaults);
+    RUN_TEST(TestVerifyRewind);
+    RUN_TEST(TestWordThatStaysWeakCancels);
+    RUN_TEST(TestSparse);
+    RUN_TEST(TestUnalignedSkipRun);
+    RUN_TEST(TestUnsizedImage);
+    RUN_TEST(TestUnsizedImageTooLarge);
+    RUN_TEST(TestSkipRunPastTheImageArea);
+    RUN_TEST(TestImageTooLargeIsRefused);
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+// Sessions of the traced build read back with the `TRACE` command and replayed into the flash they started from. The
+// replay has to send the same bytes and take the same decisions at the same times as the traced session.
+
+#include <unity.h>
+#include "host/Session.h"
+#include "host/TestImages.h"
+
+#if defined(YMODEM_TRACE)
+static const uint32_t ImageAddress = ImageDescriptor::ImageAddress;
+
+struct Case {
+    bool Streaming;
+    double FlipRate;
+
+    /// @brief The times a weak word in the second sector of the image fails to program, see `SimulatedFlash::WeakWrites`.
+    uint32_t WeakWrites;
+};
+
+static void CheckReplay(Case test)
+{
+    std::vector<uint8_t> image = RandomImage(64 * 1024, 19);
+    std::vector<uint8_t> previous = RandomImage(64 * 1024, 20);
+    auto prepare = [&](SimulatedFlash& flash) {
+        memcpy(flash.At(ImageAddress), previous.data(), previous.size());
+        flash.WeakAddress = ImageAddress + 20 * 1024 + 0x124;
+        flash.WeakWrites = test.WeakWrites;
+    };
+
+    VirtualClock clock;
+    SimulatedLink link(clock);
+    TracedTransport<SimulatedLink> traced(link);
+    SimulatedFlash flash(clock, Hardware::STM32BaseAddress, Hardware::FlashSize);
+    prepare(flash);
+    link.LatencyNanos = 1000000;
+
+    LinkFaults faults;
+    faults.FlipRate = test.FlipRate;
+    faults.Seed = 21;
+    link.SetFaults(faults);
+
+    YModemSender sender(image, "firmware.bin");
+    sender.OfferStreaming = test.Streaming;
+    sender.OfferResume = true;
+    sender.SendDigests = false;
+
+    Trace::Start(&clock);
+    TracedReceiver<>::Init(&traced, &clock, &flash);
+    link.Connect(&sender);
+    int32_t fileSize = 0;
+    TEST_ASSERT_EQUAL(ReceiveFileResult::Ok, TracedReceiver<>::ReceiveFile(&fileSize));
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    TraceQuery query;
+    link.SetFaults(LinkFaults());
+    link.Connect(&query);
+    TracedReceiver<>::ServeCommands(100);
+    Trace::Stop();
+    while (link.NextEventNanos() != SimulatedDevice::NoEvent)
+    {
+        clock.Idle();
+    }
+
+    TEST_ASSERT_TRUE(query.Decode());
+    TEST_ASSERT_TRUE(query.Log.IsComplete());
+
+    TraceLog replay = ReplayTrace<PACKET_1K_SIZE>(query.Log, 1000000, prepare);
+    TraceLog repeat = ReplayTrace<PACKET_1K_SIZE>(query.Log, 1000000, prepare);
+    TraceComparison replayed = TraceComparison::Compare(query.Log, replay);
+    TraceComparison repeated = TraceComparison::Compare(replay, repeat);
+
+    TEST_ASSERT_TRUE(replayed.OutputMatches);
+    TEST_ASSERT_TRUE(replayed.StatesMatch);
+    TEST_ASSERT_TRUE(repeated.Matches());
+    TEST_ASSERT_EQUAL_UINT32(0, repeated.MaxDeviationMicros);
+}
+#endif
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void TestYModem()
+{
+#if defined(YMODEM_TRACE)
+    CheckReplay({ false, 0, 0 });
+#endif
+}
+
+static void TestYModemG()
+{
+#if defined(YMODEM_TRACE)
+    CheckReplay({ true, 0, 0 });
+#endif
+}
+
+static void TestFlippedBits()
+{
+#if defined(YMODEM_TRACE)
+    CheckReplay({ false, 3e-4, 0 });
+#endif
+}
+
+static void TestRewind()
+{
+#if defined(YMODEM_TRACE)
+    CheckReplay({ true, 0, 1 });
+#endif
+}
+
+int main(int, char**)
+{
+    UNITY_BEGIN();
+    RUN_TEST(TestYModem);
+    RUN_TEST(TestYModemG);
+    RUN_TEST(TestFlippedBits);
+    RUN_TEST(TestRewind);
+    return UNITY_END();
+}
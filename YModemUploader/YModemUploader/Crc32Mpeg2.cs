@@ -0,0 +1,39 @@
+﻿namespace YModemTester;
+
+/// <summary>
+/// CRC-32/MPEG-2 over little-endian 32-bit words, the way the STM32 CRC unit computes it.
+/// Each word is processed most significant byte first, a trailing partial word is padded with 0xFF.
+/// Produces the same checksum as Crc32.h of the bootloader.
+/// </summary>
+public class Crc32Mpeg2
+{
+    const uint poly = 0x04C11DB7;
+    public const uint InitialValue = 0xFFFFFFFF;
+    uint[] table = new uint[256];
+
+    public uint ComputeChecksum(byte[] bytes, int offset, int count, uint crc = InitialValue)
+    {
+        for (int i = 0; i < count; i += 4)
+        {
+            for (int k = 3; k >= 0; k--)
+            {
+                byte value = i + k < count ? bytes[offset + i + k] : (byte)0xFF;
+                crc = (crc << 8) ^ table[(crc >> 24) ^ value];
+            }
+        }
+        return crc;
+    }
+
+    public Crc32Mpeg2()
+    {
+        for (uint i = 0; i < table.Length; i++)
+        {
+            uint crc = i << 24;
+            for (int j = 0; j < 8; j++)
+            {
+                crc = (crc & 0x80000000) != 0 ? (crc << 1) ^ poly : crc << 1;
+            }
+            table[i] = crc;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+﻿namespace YModemTester;
+
+/// <summary>
+/// Compressor for the heatshrink LZSS format with a 1K window and up to 32 byte matches, what `heatshrink -w 10 -l 5`
+/// produces and HeatshrinkDecoder.h of the bootloader expands while flashing.
+/// The bit stream is MSB first: a 1 bit followed by a literal byte, or a 0 bit followed by the offset - 1 (10 bits)
+/// and the length - 1 (5 bits) of a back reference.
+/// </summary>
+public class HeatshrinkEncoder
+{
+    public const int WindowBits = 10;
+    public const int LookaheadBits = 5;
+
+    const int WindowSize = 1 << WindowBits;
+    const int MaxLength = 1 << LookaheadBits;
+    const int MinLength = 2;
+    const int MaxChain = 256;
+
+    public static byte[] Encode(byte[] data)
+    {
+        var output = new List<byte>(data.Length / 2);
+        int currentByte = 0;
+        int currentBits = 0;
+
+        void WriteBits(int value, int count)
+        {
+            while (count-- > 0)
+            {
+                currentByte = ((currentByte << 1) | ((value >> count) & 1)) & 0xFF;
+                if (++currentBits == 8)
+                {
+                    output.Add((byte)currentByte);
+                    currentBits = 0;
+                }
+            }
+        }
+
+        // Hash chains over byte pairs find the match candidates
+        var head = new int[1 << 16];
+        Array.Fill(head, -1);
+        var previous = new int[data.Length];
+
+        void Insert(int at)
+        {
+            if (at + 1 < data.Length)
+            {
+                int key = data[at] << 8 | data[at + 1];
+                previous[at] = head[key];
+                head[key] = at;
+            }
+        }
+
+        int position = 0;
+        while (position < data.Length)
+        {
+            int bestLength = 0;
+            int bestOffset = 0;
+
+            if (position + 1 < data.Length)
+            {
+                int candidate = head[data[position] << 8 | data[position + 1]];
+                int limit = Math.Min(MaxLength, data.Length - position);
+
+                for (int chain = 0; candidate >= 0 && position - candidate <= WindowSize && chain < MaxChain; chain++)
+                {
+                    int length = 0;
+                    while (length < limit && data[candidate + length] == data[position + length])
+                    {
+                        length++;
+                    }
+
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestOffset = position - candidate;
+                        if (length == limit)
+                        {
+                            break;
+                        }
+                    }
+
+                    candidate = previous[candidate];
+                }
+            }
+
+            if (bestLength >= MinLength)
+            {
+                WriteBits(0, 1);
+                WriteBits(bestOffset - 1, WindowBits);
+                WriteBits(bestLength - 1, LookaheadBits);
+            }
+            else
+            {
+                bestLength = 1;
+                WriteBits(1, 1);
+                WriteBits(data[position], 8);
+            }
+
+            for (int i = 0; i < bestLength; i++)
+            {
+                Insert(position++);
+            }
+        }
+
+        if (currentBits > 0)
+        {
+            WriteBits(0, 8 - currentBits);
+        }
+
+        return output.ToArray();
+    }
+}
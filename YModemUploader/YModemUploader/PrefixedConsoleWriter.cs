@@ -0,0 +1,33 @@
+﻿using System.Text;
+
+namespace YModemTester;
+
+/// <summary>
+/// Writes to the console line by line, each line with a prefix such as the port of a board. The lines of boards
+/// flashed in parallel interleave, but the bytes of one line never mix with another.
+/// </summary>
+public class PrefixedConsoleWriter : TextWriter
+{
+    readonly string prefix;
+    readonly StringBuilder line = new StringBuilder();
+
+    public PrefixedConsoleWriter(string prefix)
+    {
+        this.prefix = prefix;
+    }
+
+    public override Encoding Encoding => Console.OutputEncoding;
+
+    public override void Write(char value)
+    {
+        if (value != '\n')
+        {
+            line.Append(value);
+            return;
+        }
+
+        // Console.WriteLine is synchronized, a whole line goes out at once
+        Console.WriteLine(prefix + line.ToString().TrimEnd('\r'));
+        line.Clear();
+    }
+}
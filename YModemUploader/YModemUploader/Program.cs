@@ -2,14 +2,31 @@
  Very basic YModem uploader. Based on https://github.com/miuser00/YModem
  */
 
+using System.Diagnostics;
 using System.IO.Ports;
 using YModemTester;
 
 if (args.Length > 0 && args[0] == "-h")
 {
     Console.WriteLine("Usage:");
-    Console.WriteLine("YModemTester.exe [COM Port Name] [File path To Upload]");
+    Console.WriteLine("YModemTester.exe [COM Port Name] [File path To Upload] [More files...] [--no-stream] [--no-compress] [--no-resume] [--no-frames] [--no-sparse] [--small-packets] [--image-version <hex>] [--no-confirm] [--stats] [--trace <file>]");
+    Console.WriteLine("YModemTester.exe --board [COM Port Name] [File path To Upload] [More files...] [--board [COM Port Name] [Files...]]... [options]");
     Console.WriteLine("If the COM port is unavailable, the app will wait until it becomes available.");
+    Console.WriteLine("--board: flash several boards in parallel, each with the files up to the next --board and the same options.");
+    Console.WriteLine("         Takes as long as the slowest board. Each board's trace goes to the --trace file with the port name added.");
+    Console.WriteLine("All files are sent in one session. A file given as <path>@<hex address> is a data file written to that");
+    Console.WriteLine("address, which has to be the start of a flash sector past the end of the image. The others are images.");
+    Console.WriteLine("--no-stream: do not offer YModem-G streaming, wait for an ACK after every packet.");
+    Console.WriteLine("--no-compress: send the file as is, even if it compresses.");
+    Console.WriteLine("--no-resume: always send the whole image, even if the bootloader has the start of it from an interrupted upload.");
+    Console.WriteLine("--no-frames: send standard 1K packets only, do not offer the bootloader extended frames of up to 8K.");
+    Console.WriteLine("--no-sparse: send runs of erased flash (0xFF) in uncompressed files as packets, not as skip frames.");
+    Console.WriteLine("--small-packets: send 128 byte packets, for a bootloader built with YMODEM_MAX_PACKET=128. Implies --no-frames,");
+    Console.WriteLine("                 and the bootloader programs every sector as the header has no room for the delta digests.");
+    Console.WriteLine("--image-version: store this version in the bootloader's image descriptor.");
+    Console.WriteLine("--no-confirm: do not compare the bootloader's image descriptor with the file after the upload.");
+    Console.WriteLine("--stats: print the bootloader's sector and timing statistics of the upload.");
+    Console.WriteLine("--trace: save the bootloader's trace of the session to a file, also when the upload fails.");
     return;
 }
 
@@ -20,37 +37,263 @@ if (args.Length < 2)
     return;
 }
 
-if (File.Exists(args[1]) == false)
+// One port and its files, or one per --board
+var boards = new List<Board>();
+var multiBoard = args[0] == "--board";
+if (multiBoard == false)
 {
-    Console.WriteLine($"File '{args[1]}' does not exist.");
+    boards.Add(new Board(args[0]));
+}
+
+for (int i = multiBoard ? 0 : 1; i < args.Length; i++)
+{
+    if (args[i] == "--board")
+    {
+        if (i + 1 >= args.Length)
+        {
+            Console.WriteLine("--board needs a COM port name");
+            return;
+        }
+        boards.Add(new Board(args[++i]));
+        continue;
+    }
+
+    if (args[i].StartsWith("--"))
+    {
+        // Skip the value of the options that have one
+        if (args[i] == "--image-version" || args[i] == "--trace")
+        {
+            i++;
+        }
+        continue;
+    }
+
+    var path = args[i];
+    uint? address = null;
+    var at = path.LastIndexOf('@');
+    if (at > 0)
+    {
+        if (uint.TryParse(path[(at + 1)..], System.Globalization.NumberStyles.HexNumber, null, out var dataAddress) == false)
+        {
+            Console.WriteLine($"'{path}' does not end in a hex address.");
+            return;
+        }
+        address = dataAddress;
+        path = path[..at];
+    }
+
+    if (File.Exists(path) == false)
+    {
+        Console.WriteLine($"File '{path}' does not exist.");
+        return;
+    }
+    boards[^1].Files.Add(new UploadFile(path, address));
+}
+
+foreach (var board in boards)
+{
+    if (board.Files.Count == 0)
+    {
+        Console.WriteLine($"No files to upload to '{board.Port}'.");
+        return;
+    }
+}
+
+if (boards.Select(board => board.Port).Distinct().Count() != boards.Count)
+{
+    Console.WriteLine("Each COM port can only be given once.");
     return;
 }
 
-var targetPort = args[0];
+uint imageVersion = 0;
+var versionIndex = Array.IndexOf(args, "--image-version");
+if (versionIndex >= 0)
+{
+    if (versionIndex + 1 >= args.Length || uint.TryParse(args[versionIndex + 1], System.Globalization.NumberStyles.HexNumber, null, out imageVersion) == false)
+    {
+        Console.WriteLine("--image-version needs a hex number");
+        return;
+    }
+}
 
-Console.WriteLine($"Waiting for COM port '{targetPort}' to be available");
-var consolePos = Console.GetCursorPosition();
-while (true)
+var traceIndex = Array.IndexOf(args, "--trace");
+if (traceIndex >= 0 && traceIndex + 1 >= args.Length)
 {
-    
-    var ports = SerialPort.GetPortNames();
+    Console.WriteLine("--trace needs a file path");
+    return;
+}
 
-    Console.SetCursorPosition(consolePos.Left, consolePos.Top);
-    Console.WriteLine("Available Ports: " + string.Join(", ", ports));
+if (multiBoard == false)
+{
+    var targetPort = boards[0].Port;
 
-    if (ports.Contains(targetPort))
+    Console.WriteLine($"Waiting for COM port '{targetPort}' to be available");
+    var consolePos = Console.GetCursorPosition();
+    while (true)
     {
-        break;
+
+        var ports = SerialPort.GetPortNames();
+
+        Console.SetCursorPosition(consolePos.Left, consolePos.Top);
+        Console.WriteLine("Available Ports: " + string.Join(", ", ports));
+
+        if (PortAvailable(targetPort))
+        {
+            break;
+        }
     }
+
+    var serialPort = new SerialPort(targetPort);
+    var transmitter = CreateTransmitter(serialPort);
+    var succeeded = Upload(serialPort, transmitter, boards[0].Files.Select(transmitter.Prepare).ToList(), traceIndex >= 0 ? args[traceIndex + 1] : null);
+    Environment.ExitCode = succeeded ? 0 : 1;
+    return;
 }
 
+// Every board gets its own port, transmitter and thread. The files are read, compressed and checksummed for all of
+// them before any session starts, the sessions then only frame and send packets.
+var stopwatch = Stopwatch.StartNew();
+var uploads = new List<BoardUpload>();
+foreach (var board in boards)
+{
+    var serialPort = new SerialPort(board.Port);
+    var transmitter = CreateTransmitter(serialPort);
+    transmitter.Log = new PrefixedConsoleWriter($"[{board.Port}] ");
+    transmitter.LogPackets = false;
+    uploads.Add(new BoardUpload(board, serialPort, transmitter, board.Files.Select(transmitter.Prepare).ToList()));
+}
 
-var serialPort = new SerialPort(targetPort);
-var transmitter = new YModemTransmitter(serialPort, true);
-serialPort.ReadTimeout = 90000;
-serialPort.DtrEnable = true;
-serialPort.ReadBufferSize = 2048;
-serialPort.WriteBufferSize = 2048;
-serialPort.Open();
+foreach (var upload in uploads)
+{
+    var tracePath = traceIndex >= 0 ? BoardTracePath(args[traceIndex + 1], upload.Board.Port) : null;
+    upload.Task = Task.Factory.StartNew(() =>
+    {
+        try
+        {
+            upload.Transmitter.Log.WriteLine($"Waiting for COM port '{upload.Board.Port}' to be available");
+            while (PortAvailable(upload.Board.Port) == false)
+            {
+                Thread.Sleep(100);
+            }
 
-transmitter.SendFile(args[1]);
\ No newline at end of file
+            upload.Succeeded = Upload(upload.SerialPort, upload.Transmitter, upload.Files, tracePath);
+        }
+        catch (Exception e)
+        {
+            upload.Transmitter.Log.WriteLine($"Exception: {e.Message}");
+        }
+        upload.Seconds = stopwatch.Elapsed.TotalSeconds;
+    }, TaskCreationOptions.LongRunning);
+}
+
+// One line for all boards every second, instead of a line per packet and board
+var tasks = uploads.Select(upload => upload.Task!).ToArray();
+while (Task.WaitAll(tasks, 1000) == false)
+{
+    var seconds = stopwatch.Elapsed.TotalSeconds;
+    var boardProgress = uploads.Select(upload =>
+    {
+        var total = upload.Transmitter.BytesTotal;
+        var percent = total > 0 ? Math.Min(100, 100 * upload.Transmitter.BytesSent / total) : 0;
+        return $"{upload.Board.Port} {(upload.Task!.IsCompleted ? "done" : $"{percent}%")}";
+    });
+    var sent = uploads.Sum(upload => upload.Transmitter.BytesSent);
+    Console.WriteLine($"{seconds,7:0.0}s  {string.Join(", ", boardProgress)}  {sent / 1024.0:0.0} KB at {sent / 1024.0 / seconds:0.0} KB/s");
+}
+
+var elapsed = stopwatch.Elapsed.TotalSeconds;
+var sentTotal = uploads.Sum(upload => upload.Transmitter.BytesSent);
+Console.WriteLine();
+foreach (var upload in uploads)
+{
+    Console.WriteLine($"{upload.Board.Port,-16} {(upload.Succeeded ? "done" : "FAILED")} after {upload.Seconds:0.000}s, {upload.Transmitter.BytesSent / 1024.0:0.0} KB sent");
+}
+Console.WriteLine($"{uploads.Count(upload => upload.Succeeded)} of {uploads.Count} boards flashed in {elapsed:0.000}s, {sentTotal / 1024.0 / elapsed:0.0} KB/s combined");
+Environment.ExitCode = uploads.All(upload => upload.Succeeded) ? 0 : 1;
+
+YModemTransmitter CreateTransmitter(SerialPort serialPort)
+{
+    var transmitter = new YModemTransmitter(serialPort, true);
+    transmitter.AllowStreaming = args.Contains("--no-stream") == false;
+    transmitter.AllowCompression = args.Contains("--no-compress") == false;
+    transmitter.AllowResume = args.Contains("--no-resume") == false;
+    transmitter.AllowSparse = args.Contains("--no-sparse") == false;
+    if (args.Contains("--no-frames"))
+    {
+        transmitter.FrameSize = YModemTransmitter.DataSize;
+    }
+    if (args.Contains("--small-packets"))
+    {
+        transmitter.PacketSize = 128;
+    }
+    transmitter.ImageVersion = imageVersion;
+    return transmitter;
+}
+
+// Listed ports, or a device path such as a pseudo-terminal standing in for a board
+static bool PortAvailable(string port)
+{
+    return SerialPort.GetPortNames().Contains(port) || File.Exists(port);
+}
+
+// trace.bin for COM3 becomes trace.COM3.bin
+static string BoardTracePath(string path, string port)
+{
+    var name = Path.GetFileNameWithoutExtension(path) + "." + Path.GetFileName(port) + Path.GetExtension(path);
+    return Path.Combine(Path.GetDirectoryName(path) ?? "", name);
+}
+
+// One session on an open port and the queries after it
+bool Upload(SerialPort serialPort, YModemTransmitter transmitter, IReadOnlyList<PreparedFile> files, string? tracePath)
+{
+    serialPort.ReadTimeout = 90000;
+    serialPort.DtrEnable = true;
+    serialPort.ReadBufferSize = 2048;
+    serialPort.WriteBufferSize = 2048;
+    serialPort.Open();
+
+    var succeeded = transmitter.SendFiles(files);
+    if (succeeded)
+    {
+        if (args.Contains("--no-confirm") == false)
+        {
+            succeeded = transmitter.ConfirmImage();
+        }
+
+        if (args.Contains("--stats"))
+        {
+            transmitter.PrintBootloaderStats();
+        }
+    }
+
+    // A failed upload is what a trace is most useful for
+    if (tracePath != null)
+    {
+        transmitter.SaveBootloaderTrace(tracePath);
+    }
+
+    serialPort.Close();
+    return succeeded;
+}
+
+/// <summary>
+/// A port and the files to upload to the board on it.
+/// </summary>
+record Board(string Port)
+{
+    public List<UploadFile> Files { get; } = new List<UploadFile>();
+}
+
+/// <summary>
+/// The upload to one board of several flashed in parallel.
+/// </summary>
+class BoardUpload(Board board, SerialPort serialPort, YModemTransmitter transmitter, IReadOnlyList<PreparedFile> files)
+{
+    public Board Board { get; } = board;
+    public SerialPort SerialPort { get; } = serialPort;
+    public YModemTransmitter Transmitter { get; } = transmitter;
+    public IReadOnlyList<PreparedFile> Files { get; } = files;
+    public Task? Task { get; set; }
+    public bool Succeeded { get; set; }
+    public double Seconds { get; set; }
+}
\ No newline at end of file
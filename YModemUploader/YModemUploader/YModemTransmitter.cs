@@ -3,22 +3,109 @@ using System.Text;
 
 namespace YModemTester;
 
+/// <summary>
+/// A file of a batch. Files without an address are the image, the others go to a data region of the bootloader,
+/// whole flash sectors past the end of the image.
+/// </summary>
+public record UploadFile(string Path, uint? Address = null);
+
+/// <summary>
+/// A file read and made ready to send ahead of the session: the payload, compressed if that makes it smaller, the
+/// CRC32 of the file and the digests of its delta chunks.
+/// </summary>
+public record PreparedFile(UploadFile Upload, byte[] Data, byte[] Payload, uint Crc, IReadOnlyList<string> Digests)
+{
+    public bool Compressed => Payload != Data;
+}
+
 public class YModemTransmitter
 {
     const byte SOH = 1;
     const byte STX = 2;
+    const byte SOF = 3;
     const byte EOT = 4;
+    const byte SKP = 5;
     const byte ACK = 6;
     const byte NAK = 0x15;
     const byte C = 0x43;
+    const byte G = 0x47;
     const byte CAN = 0x18;
+    const byte S = 0x53;
+    const byte I = 0x49;
+    const byte R = 0x52;
+    const byte F = 0x46;
+    const byte T = 0x54;
+    const byte E = 0x45;
+
+    const int StatsVersion = 2;
+    const int InfoVersion = 2;
+    const int TraceVersion = 1;
+    // Sectors erased, blank, unchanged, verified and mismatched, a byte each, then words unchanged, words of the
+    // erased value and milliseconds saved
+    const int FlashStatsSize = 5 + 3 * 4;
+    static readonly string[] PhaseNames = { "protocol", "receive", "crc", "flash", "decompress", "erase", "program", "ack", "verify" };
 
     public const int DataSize = 1024;
     public const int CrcSize = 2;
 
+    // NAKs in a row for the same packet before giving up
+    public const int MaxRetries = 10;
+
+    // The bootloader compares the flash with these per chunk digests and leaves unchanged sectors alone
+    public const int DeltaChunkSize = 16 * 1024;
+
     SerialPort serialPort;
     public DateTime startDateTime = new DateTime(0);
 
+    // Offer YModem-G to the bootloader. It answers the header with 'G' if it agrees, or 'C' for plain YModem.
+    public bool AllowStreaming { get; set; } = true;
+
+    // Send the image heatshrink compressed when that makes it smaller, the bootloader expands it while flashing
+    public bool AllowCompression { get; set; } = true;
+
+    // Let the bootloader continue an interrupted upload of the same image where its saved progress ends
+    public bool AllowResume { get; set; } = true;
+
+    // Offer extended frames of up to this size, a power of two. A bootloader built for them answers with the size it
+    // takes, others ignore the offer and get standard 1K packets.
+    public int FrameSize { get; set; } = 8192;
+
+    // Send runs of erased flash (0xFF) in files sent uncompressed as skip frames of a few bytes instead of packets.
+    // The bootloader answers 'E' if it takes them.
+    public bool AllowSparse { get; set; } = true;
+
+    // The size of the header and the standard data packets, 1024 or 128. A bootloader built with YMODEM_MAX_PACKET=128
+    // takes nothing larger, so the header then leaves out the delta digests and extended frames are not offered.
+    public int PacketSize { get; set; } = DataSize;
+
+    // Stored in the bootloader's image descriptor, 0 sends none
+    public uint ImageVersion { get; set; } = 0;
+
+    // Where the progress of the session goes. Boards flashed in parallel each get their own.
+    public TextWriter Log { get; set; } = Console.Out;
+
+    // Log a line per data packet, too much when several boards are flashed at once
+    public bool LogPackets { get; set; } = true;
+    TextWriter PacketLog => LogPackets ? Log : TextWriter.Null;
+
+    // The payload bytes of the batch being sent and how many of them went out so far, counting packets sent again
+    // and runs sent as skip frames. Read from other threads for the combined progress of several boards.
+    long bytesTotal;
+    long bytesSent;
+    public long BytesTotal => Interlocked.Read(ref bytesTotal);
+    public long BytesSent => Interlocked.Read(ref bytesSent);
+
+    // The payload bytes of the batch that went as skip frames
+    public long BytesSkipped { get; private set; }
+
+    // An answer byte read ahead that ReadAnswer returns first, -1 if none
+    int pendingAnswer = -1;
+
+    // The size and CRC32 of the last image sent, for ConfirmImage
+    bool imageSent;
+    int sentImageSize;
+    uint sentImageCrc;
+
     public YModemTransmitter(SerialPort sp, bool timeout)
     {
         serialPort = sp;
@@ -35,15 +122,55 @@ public class YModemTransmitter
 
     public bool SendFile(string path)
     {
-        var fileStream = new FileStream(path, FileMode.Open, FileAccess.Read);
-        var packetCount = (int)(fileStream.Length - 1) / DataSize + 1;
+        return SendFiles(new[] { new UploadFile(path) });
+    }
 
-        var invertedPacketNumber = 255;
-        var data = new byte[DataSize];
-        var CRC = new byte[CrcSize];
+    public bool SendFiles(IReadOnlyList<UploadFile> files)
+    {
+        return SendFiles(files.Select(Prepare).ToList());
+    }
+
+    /// <summary>
+    /// Reads a file and does the work that does not need the bootloader: compressing it if allowed, its CRC32 and
+    /// the delta digests. Lets the session only frame and send packets.
+    /// </summary>
+    public PreparedFile Prepare(UploadFile file)
+    {
+        var fileData = File.ReadAllBytes(file.Path);
+        var payload = AllowCompression ? HeatshrinkEncoder.Encode(fileData) : fileData;
+        if (payload.Length < fileData.Length)
+        {
+            Log.WriteLine($"Compressed {Path.GetFileName(file.Path)} from {fileData.Length} to {payload.Length} bytes ({100.0 * payload.Length / fileData.Length:0.0}%)");
+        }
+        else
+        {
+            payload = fileData;
+        }
+
+        // The digests are over the file as it ends up in flash, compressed or not
+        var crc32 = new Crc32Mpeg2();
+        var digests = new List<string>();
+        for (int offset = 0; offset < fileData.Length; offset += DeltaChunkSize)
+        {
+            var length = Math.Min(DeltaChunkSize, fileData.Length - offset);
+            digests.Add(crc32.ComputeChecksum(fileData, offset, length).ToString("x8"));
+        }
 
+        return new PreparedFile(file, fileData, payload, crc32.ComputeChecksum(fileData, 0, fileData.Length), digests);
+    }
+
+    /// <summary>
+    /// Sends files as one YModem batch: after each file the bootloader asks for the next header packet, the empty one
+    /// ends the session. Saves a re-enumeration and handshake per file.
+    /// </summary>
+    public bool SendFiles(IReadOnlyList<PreparedFile> files)
+    {
         var crc16Ccitt = new Crc16Ccitt(InitialCrcValue.Zeros);
-        var packetIndex = 0;
+        imageSent = false;
+        Interlocked.Exchange(ref bytesTotal, files.Sum(file => (long)file.Payload.Length));
+        Interlocked.Exchange(ref bytesSent, 0);
+        BytesSkipped = 0;
+        pendingAnswer = -1;
         Thread.Sleep(1);
 
         try
@@ -54,163 +181,360 @@ public class YModemTransmitter
                 startDateTime = DateTime.Now;
             }
 
-            Console.Write($"Sending Initial packet 0 / {packetCount}...");
-            SendInitialPacket(STX, packetIndex, invertedPacketNumber, packetCount, data, DataSize, path, fileStream, CRC, CrcSize);
-            Console.Write($"Sent...");
+            foreach (var file in files)
+            {
+                if (SendFileData(file, crc16Ccitt) == false)
+                {
+                    return false;
+                }
+            }
 
-            var read = (byte)serialPort.ReadByte();
-            if (read != ACK)
+            var packetIndex = 0;
+            var invertedPacketNumber = 255;
+            var data = new byte[128];
+            data[0] = 0x00;
+            data[1] = data[3] = data[5] = 0x30;
+            data[2] = data[4] = 0x20;
+            var CRC = crc16Ccitt.ComputeChecksumBytes(data);
+
+            Log.Write($"Sending Closing Packet...");
+            for (var retries = 0; ; retries++)
+            {
+                SendClosingPacket(SOH, packetIndex, invertedPacketNumber, data, 128, CRC, CrcSize);
+                Log.Write("Sent...");
+
+                var ack3 = ReadAnswer(ACK);
+                if (ack3 == ACK)
+                {
+                    break;
+                }
+                if (ack3 != NAK || retries == MaxRetries)
+                {
+                    Log.WriteLine($"Unexpected: 0x{ack3:X}");
+                    return false;
+                }
+                Log.Write("NAK, Resending...");
+            }
+            Log.WriteLine("ACK");
+            TimeSpan span = DateTime.Now - startDateTime;
+
+            Log.WriteLine(files.Count == 1 ? "File successfully sent" : $"{files.Count} files successfully sent in {span.TotalSeconds:0.000}s");
+            if (BytesSkipped > 0)
+            {
+                Log.WriteLine($"{BytesSkipped} bytes of erased flash skipped");
+            }
+        }
+        catch (Exception e)
+        {
+            Log.WriteLine($"Exception: {e.Message}");
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Sends one file of a batch, from its header packet up to the bootloader's request for the next header.
+    /// </summary>
+    private bool SendFileData(PreparedFile file, Crc16Ccitt crc16Ccitt)
+    {
+        var path = file.Upload.Path;
+        var address = file.Upload.Address;
+        var fileData = file.Data;
+        var compressed = file.Compressed;
+
+        if (address == null)
+        {
+            imageSent = true;
+            sentImageSize = fileData.Length;
+            sentImageCrc = file.Crc;
+        }
+
+        var fileStream = new MemoryStream(file.Payload);
+        var packetSize = PacketSize;
+        var packetCount = (int)(fileStream.Length - 1) / packetSize + 1;
+        long firstByte = 0;
+
+        var invertedPacketNumber = 255;
+        var data = new byte[PacketSize];
+        var CRC = new byte[CrcSize];
+
+        var packetIndex = 0;
+        var fileStart = DateTime.Now;
+
+        Log.Write($"Sending Initial packet 0 / {packetCount} of {Path.GetFileName(path)}{(address == null ? "" : $" to 0x{address:X8}")}...");
+        var headerOptions = BuildHeaderOptions(file);
+        for (var retries = 0; ; retries++)
+        {
+            if (SendInitialPacket(PacketSize == DataSize ? STX : SOH, packetIndex, invertedPacketNumber, packetCount, data, PacketSize, path, fileStream, headerOptions, CRC, CrcSize) == false)
             {
-                Console.WriteLine($"NOT ACK: 0x{read:X}");
+                Log.WriteLine($"The file name and header options do not fit a {PacketSize} byte packet");
                 return false;
             }
+            Log.Write($"Sent...");
 
-            if (serialPort.ReadByte() != C)
+            var read = ReadAnswer(ACK);
+            if (read == ACK)
             {
-                Console.WriteLine($"NOT C: 0x{read:X}");
+                break;
+            }
+            if (read != NAK || retries == MaxRetries)
+            {
+                Log.WriteLine($"NOT ACK: 0x{read:X}");
                 return false;
             }
+            Log.Write("NAK, Resending...");
+        }
 
-            Console.WriteLine("ACK");
-            packetIndex++;
+        // Skip what the bootloader has already. A compressed file is compressed again from there, the bootloader
+        // starts a fresh decoder at that offset.
+        void ContinueAt(int offset)
+        {
+            if (compressed)
+            {
+                fileStream = new MemoryStream(HeatshrinkEncoder.Encode(fileData[offset..]));
+            }
+            else
+            {
+                fileStream.Position = firstByte = offset;
+            }
+            packetCount = (int)(fileStream.Length - fileStream.Position - 1) / packetSize + 1;
+        }
+
+        if (AllowResume)
+        {
+            // A bootloader without resume answers with the mode right away, it is left for the mode handling below
+            var first = serialPort.ReadByte();
+            if (first != R)
+            {
+                pendingAnswer = first;
+            }
+            else
+            {
+                var offset = ReadResumeOffset(crc16Ccitt, first);
+                if (offset < 0 || offset > fileData.Length)
+                {
+                    Log.WriteLine("Unexpected resume answer");
+                    return false;
+                }
+
+                if (offset > 0)
+                {
+                    Log.Write($"resuming at {offset} bytes...");
+                    ContinueAt(offset);
+                }
+            }
+        }
+
+        // The frame size and the sparse answer come before the mode, if the bootloader takes extended frames or skip
+        // frames
+        var mode = ReadAnswer(C, G, F, E);
+        if (mode == F)
+        {
+            packetSize = serialPort.ReadByte() * 1024;
+            if (packetSize <= DataSize || packetSize > FrameSize)
+            {
+                Log.WriteLine($"Unexpected frame size: {packetSize}");
+                return false;
+            }
 
+            Log.Write($"{packetSize / 1024}K frames...");
+            data = new byte[packetSize];
+            packetCount = (int)(fileStream.Length - fileStream.Position - 1) / packetSize + 1;
+            mode = ReadAnswer(C, G, E);
+        }
+
+        var sparse = mode == E;
+        if (sparse)
+        {
+            Log.Write("sparse...");
+            mode = ReadAnswer(C, G);
+        }
+
+        if (mode != C && mode != G)
+        {
+            Log.WriteLine($"NOT C: 0x{mode:X}");
+            return false;
+        }
+
+        // In streaming mode packets are sent back to back, the bootloader only answers to cancel
+        var streaming = mode == G;
+        Log.WriteLine(streaming ? "ACK, streaming (YModem-G)" : "ACK");
+        packetIndex++;
+        var packetRetries = 0;
+
+        long fileSkipped = 0;
+        var rewound = false;
+        do
+        {
             while (fileStream.Position < fileStream.Length)
             {
-                Console.Write($"Sending Packet {packetIndex} / {packetCount}...");
+                PacketLog.Write($"Sending Packet {packetIndex} / {packetCount}...");
                 var filePositionBefore = fileStream.Position;
-                var readBytes = fileStream.Read(data, 0, DataSize);
+                var readBytes = fileStream.Read(data, 0, packetSize);
 
                 if (readBytes == 0)
                 {
-                    Console.WriteLine("Could not read from file");
+                    Log.WriteLine("Could not read from file");
                     break;
                 }
 
-                // Fill the remaining bytes with 0x1A
-                for (int i = readBytes; i < DataSize; i++)
-                {
-                    data[i] = 0x1A;
-                }
-
                 // Roll packet Index
                 if (packetIndex > 255)
                 {
                     packetIndex -= 256;
                 }
 
-                var fileName = Path.GetFileName(path);
                 invertedPacketNumber = 255 - packetIndex;
-                CRC = crc16Ccitt.ComputeChecksumBytes(data);
 
-                SendPacket(STX, packetIndex, invertedPacketNumber, data, DataSize, CRC, CrcSize);
-                Console.Write($"Sent...");
+                // A run of erased flash goes as one skip frame, its length instead of the packets it takes
+                long skipped = 0;
+                if (sparse && IsErased(data, readBytes))
+                {
+                    long run = readBytes;
+                    while (fileStream.Position < fileStream.Length)
+                    {
+                        var chunkStart = fileStream.Position;
+                        var chunkBytes = fileStream.Read(data, 0, packetSize);
+                        if (IsErased(data, chunkBytes) == false)
+                        {
+                            fileStream.Position = chunkStart;
+                            break;
+                        }
+                        run += chunkBytes;
+                    }
+
+                    var length = BitConverter.GetBytes((uint)run);
+                    SendPacket(SKP, packetIndex, invertedPacketNumber, length, length.Length, crc16Ccitt.ComputeChecksumBytes(length), CrcSize);
+                    Interlocked.Add(ref bytesSent, run);
+                    skipped = run;
+                    fileSkipped += skipped;
+                    BytesSkipped += skipped;
+                    PacketLog.Write($"Skipped {run} bytes...");
+                }
+                else
+                {
+                    // Fill the remaining bytes with 0x1A
+                    for (int i = readBytes; i < packetSize; i++)
+                    {
+                        data[i] = 0x1A;
+                    }
+
+                    CRC = crc16Ccitt.ComputeChecksumBytes(data);
+
+                    SendPacket(packetSize > DataSize ? SOF : packetSize == DataSize ? STX : SOH, packetIndex, invertedPacketNumber, data, packetSize, CRC, CrcSize);
+                    Interlocked.Add(ref bytesSent, readBytes);
+                    PacketLog.Write($"Sent...");
+                }
+
+                if (streaming)
+                {
+                    if (serialPort.BytesToRead > 0 && serialPort.ReadByte() == CAN)
+                    {
+                        Log.WriteLine("CAN, Client Rejected");
+                        return false;
+                    }
 
-                int signal = serialPort.ReadByte();
+                    PacketLog.WriteLine("Streamed");
+                    packetIndex++;
+                    continue;
+                }
+
+                int signal = ReadAnswer(ACK);
                 if (signal == ACK)
                 {
-                    Console.WriteLine("ACK");
+                    PacketLog.WriteLine("ACK");
                     packetIndex++;
+                    packetRetries = 0;
                 }
-                else if (signal == NAK)
+                else if (signal == NAK && packetRetries < MaxRetries)
                 {
-                    Console.WriteLine("NAK, Resending");
+                    // The same packet again, its index has not moved on yet
+                    PacketLog.WriteLine("NAK, Resending");
                     fileStream.Position = filePositionBefore;
-                    packetIndex--;
+                    fileSkipped -= skipped;
+                    BytesSkipped -= skipped;
+                    packetRetries++;
                 }
                 else if (signal == CAN)
                 {
-                    Console.WriteLine("CAN, Client Rejected");
+                    Log.WriteLine("CAN, Client Rejected");
                     return false;
                 }
                 else
                 {
-                    Console.WriteLine($"Unexpected: 0x{signal:X}");
+                    Log.WriteLine($"Unexpected: 0x{signal:X}");
                     return false;
                 }
             }
 
-            Console.Write("Sending EOT...");
-            serialPort.Write(new byte[] { EOT }, 0, 1);
-            Console.Write("Sent...");
-
-            int act1 = serialPort.ReadByte();
-            if (act1 == ACK)
-            {
-                Console.Write("ACK1...");
-            }
-            else if (act1 == NAK)
+            Log.Write("Sending EOT...");
+            rewound = false;
+            for (var retries = 0; ; retries++)
             {
-                Console.Write("NAK, Sending EOT again...");
                 serialPort.Write(new byte[] { EOT }, 0, 1);
-                Console.Write("Sent...");
-            }
-            else
-            {
-                Console.WriteLine($"Unexpected: 0x{act1:X}");
-                return false;
-            }
-            
-
-            int act2 = serialPort.ReadByte();
-            if (act2 == ACK)
-            {
-                Console.Write("ACK2...");
-            }
-            else
-            {
-                Console.WriteLine($"Unexpected: 0x{act2:X}");
-                return false;
-            }
-            Console.WriteLine();
-
-            Console.Write($"Waiting for CRC request 0x{C:X}...");
-            var crcRequest = serialPort.ReadByte();
-            if (crcRequest != C)
-            {
-                Console.WriteLine($"Unexpected: 0x{crcRequest:X}");
-                return false;
-            }
-            Console.WriteLine($"Done");
+                Log.Write("Sent...");
 
-            packetIndex = 0;
-            invertedPacketNumber = 255;
-            data = new byte[128];
-            data[0] = 0x00;
-            data[1] = data[3] = data[5] = 0x30;
-            data[2] = data[4] = 0x20;
-            CRC = new byte[CrcSize];
-            CRC = crc16Ccitt.ComputeChecksumBytes(data);
+                int act1 = ReadAnswer(ACK, R);
+                if (act1 == ACK)
+                {
+                    Log.Write("ACK1...");
+                    break;
+                }
 
-            Console.Write($"Sending Closing Packet...");
-            SendClosingPacket(SOH, packetIndex, invertedPacketNumber, data, 128, CRC, CrcSize);
-            Console.Write("Sent...");
+                // A sector did not read back as programmed, the bootloader has the file continue at its start
+                if (act1 == R)
+                {
+                    var offset = ReadResumeOffset(crc16Ccitt, act1);
+                    if (offset < 0 || offset > fileData.Length)
+                    {
+                        Log.WriteLine("Corrupted rewind answer");
+                        return false;
+                    }
+
+                    Log.WriteLine($"verification failed, sending again from {offset} bytes");
+                    ContinueAt(offset);
+                    rewound = true;
+                    break;
+                }
 
-            var ack3 = serialPort.ReadByte();
-            if (ack3 != ACK)
-            {
-                Console.WriteLine($"Unexpected: 0x{ack3:X}");
-                return false;
+                if (act1 != NAK || retries == MaxRetries)
+                {
+                    Log.WriteLine($"Unexpected: 0x{act1:X}");
+                    return false;
+                }
+                Log.Write("NAK, Sending EOT again...");
             }
-            Console.WriteLine("ACK");
-            TimeSpan span = DateTime.Now - startDateTime;
+        } while (rewound);
 
-            Console.WriteLine("File successfully sent");
+        int act2 = serialPort.ReadByte();
+        if (act2 == ACK)
+        {
+            Log.Write("ACK2...");
         }
-        catch (Exception e)
+        else
         {
-            Console.WriteLine($"Exception: {e.Message}");
+            Log.WriteLine($"Unexpected: 0x{act2:X}");
             return false;
         }
-        finally
+        Log.WriteLine();
+
+        // The bootloader asks for the next header packet, another file or the closing packet
+        Log.Write($"Waiting for CRC request 0x{C:X}...");
+        var crcRequest = serialPort.ReadByte();
+        if (crcRequest != C)
         {
-            fileStream.Close();
+            Log.WriteLine($"Unexpected: 0x{crcRequest:X}");
+            return false;
         }
+        Log.WriteLine($"Done");
 
-
+        TimeSpan span = DateTime.Now - fileStart;
+        Log.WriteLine($"{fileData.Length} bytes ({fileStream.Length - firstByte - fileSkipped} sent{(fileSkipped > 0 ? $", {fileSkipped} skipped" : "")}) in {span.TotalSeconds:0.000}s, {fileData.Length / 1024.0 / span.TotalSeconds:0.0} KB/s ({(streaming ? "YModem-G" : "YModem")})");
         return true;
     }
 
-    private void SendInitialPacket(
+    private bool SendInitialPacket(
         byte STX,
         int packetNumber,
         int invertedPacketNumber,
@@ -218,7 +542,8 @@ public class YModemTransmitter
         byte[] data,
         int dataSize,
         string path,
-        FileStream fileStream,
+        Stream fileStream,
+        string options,
         byte[] CRC,
         int crcSize)
     {
@@ -230,6 +555,13 @@ public class YModemTransmitter
         var fileModTime = Convert.ToString(unixTime, 8);
         var packageCount = Convert.ToString(packetCount, 8);
         var fileNameBytes = Encoding.GetEncoding("ascii").GetBytes(fileName);
+        var optionBytes = Encoding.ASCII.GetBytes(options);
+
+        // Cutting an option off would change its value, the bootloader needs the terminating NUL too
+        if (fileNameBytes.Length + fileNameSize.Length + fileModTime.Length + packageCount.Length + 4 + optionBytes.Length >= dataSize)
+        {
+            return false;
+        }
 
         int i;
         for (i = 0; i < fileNameBytes.Length && (fileNameBytes[i] != 0); i++)
@@ -255,7 +587,11 @@ public class YModemTransmitter
             data[i + j + n + m + 3] = (byte)packageCount.ToCharArray()[n];
         }
         data[i + j + m + n + 3] = (byte)(' ');
-        for (int k = (i + j + m + n + 4); k < dataSize; k++)
+
+        var optionStart = i + j + m + n + 4;
+        Array.Copy(optionBytes, 0, data, optionStart, optionBytes.Length);
+
+        for (int k = optionStart + optionBytes.Length; k < dataSize; k++)
         {
             data[k] = 0;
         }
@@ -263,6 +599,315 @@ public class YModemTransmitter
         Crc16Ccitt crc16Ccitt = new Crc16Ccitt(InitialCrcValue.Zeros);
         CRC = crc16Ccitt.ComputeChecksumBytes(data);
         SendPacket(STX, packetNumber, invertedPacketNumber, data, dataSize, CRC, crcSize);
+        return true;
+    }
+
+    /// <summary>
+    /// Builds the extension options appended to the header packet as space separated key=value tokens.
+    /// </summary>
+    private string BuildHeaderOptions(PreparedFile file)
+    {
+        var address = file.Upload.Address;
+        var options = new List<string>();
+
+        if (AllowStreaming)
+        {
+            options.Add("stream=1");
+        }
+
+        if (AllowResume)
+        {
+            options.Add("resume=1");
+        }
+
+        if (FrameSize > DataSize && PacketSize == DataSize)
+        {
+            options.Add($"frame={FrameSize:x}");
+        }
+
+        // Compression already takes runs of erased flash down to a few bytes
+        if (AllowSparse && file.Compressed == false)
+        {
+            options.Add("sparse=1");
+        }
+
+        // Decoder parameters and the size of the expanded image, all hex
+        if (file.Compressed)
+        {
+            options.Add($"heatshrink={HeatshrinkEncoder.WindowBits:x},{HeatshrinkEncoder.LookaheadBits:x},{file.Data.Length:x}");
+        }
+
+        // Absolute, in hex. The version belongs to the image's descriptor, data files have none.
+        if (address != null)
+        {
+            options.Add($"addr={address:x}");
+        }
+        else if (ImageVersion != 0)
+        {
+            options.Add($"version={ImageVersion:x}");
+        }
+
+        // Sixteen digests do not fit a 128 byte header, the bootloader then programs every sector
+        if (PacketSize == DataSize)
+        {
+            options.Add("delta=" + string.Join(",", file.Digests));
+        }
+
+        return string.Join(" ", options);
+    }
+
+    /// <summary>
+    /// Queries the statistics of the last session and prints them: the sectors erased, skipped as blank and left
+    /// unchanged and the flash time that saved, and the timing per phase. The bootloader answers for a second after a
+    /// session, and only has the timing if it was built with YMODEM_STATS.
+    /// </summary>
+    public bool PrintBootloaderStats()
+    {
+        try
+        {
+            serialPort.DiscardInBuffer();
+            serialPort.Write(new byte[] { S }, 0, 1);
+
+            var header = ReadExactly(8);
+            if (header[0] != S || header[1] != StatsVersion)
+            {
+                Log.WriteLine($"Unexpected statistics answer: 0x{header[0]:X} version {header[1]}");
+                return false;
+            }
+
+            int phaseCount = header[2];
+            int bucketCount = header[3];
+            uint ticksPerSecond = BitConverter.ToUInt32(header, 4);
+            var body = ReadExactly(FlashStatsSize + phaseCount * (20 + bucketCount * 4) + 2);
+
+            var crc16Ccitt = new Crc16Ccitt(InitialCrcValue.Zeros);
+            var checkedBytes = header.Skip(1).Concat(body.Take(body.Length - 2)).ToArray();
+            if (crc16Ccitt.ComputeChecksum(checkedBytes) != (body[^2] << 8 | body[^1]))
+            {
+                Log.WriteLine("Statistics answer is corrupted");
+                return false;
+            }
+
+            Log.WriteLine($"Sectors erased {body[0]}, blank {body[1]}, unchanged {body[2]}, verified {body[3]}, mismatched {body[4]}");
+            Log.WriteLine($"Words unchanged {BitConverter.ToUInt32(body, 5)}, erased value {BitConverter.ToUInt32(body, 9)}, flash time saved {BitConverter.ToUInt32(body, 13)} ms");
+
+            if (phaseCount == 0)
+            {
+                Log.WriteLine("The bootloader was built without statistics (YMODEM_STATS)");
+                return true;
+            }
+
+            double microsPerTick = 1e6 / ticksPerSecond;
+            Log.WriteLine($"{"phase",-10} {"count",9} {"min us",10} {"mean us",10} {"max us",10}  histogram (up to us: count)");
+            for (int phase = 0; phase < phaseCount; phase++)
+            {
+                int offset = FlashStatsSize + phase * (20 + bucketCount * 4);
+                uint count = BitConverter.ToUInt32(body, offset);
+                uint min = BitConverter.ToUInt32(body, offset + 4);
+                uint max = BitConverter.ToUInt32(body, offset + 8);
+                ulong total = BitConverter.ToUInt64(body, offset + 12);
+                if (count == 0)
+                {
+                    continue;
+                }
+
+                var histogram = new StringBuilder();
+                for (int bucket = 0; bucket < bucketCount; bucket++)
+                {
+                    uint samples = BitConverter.ToUInt32(body, offset + 20 + bucket * 4);
+                    if (samples > 0)
+                    {
+                        histogram.Append($" {(2UL << bucket) * microsPerTick:0.###}:{samples}");
+                    }
+                }
+
+                var name = phase < PhaseNames.Length ? PhaseNames[phase] : phase.ToString();
+                Log.WriteLine($"{name,-10} {count,9} {min * microsPerTick,10:0.00} {(double)total / count * microsPerTick,10:0.00} {max * microsPerTick,10:0.00} {histogram}");
+            }
+        }
+        catch (Exception e)
+        {
+            Log.WriteLine($"Exception: {e.Message}");
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Saves the bootloader's trace of the last session to a file: every byte in and out with timestamps and the
+    /// protocol's decisions, as the answer came in. The native build of the bootloader replays it with --replay.
+    /// Only bootloaders built with YMODEM_TRACE record one.
+    /// </summary>
+    public bool SaveBootloaderTrace(string path)
+    {
+        try
+        {
+            serialPort.DiscardInBuffer();
+            serialPort.Write(new byte[] { T }, 0, 1);
+
+            var header = ReadExactly(10);
+            if (header[0] != T || header[1] != TraceVersion)
+            {
+                Log.WriteLine($"Unexpected trace answer: 0x{header[0]:X} version {header[1]}");
+                return false;
+            }
+
+            uint dropped = BitConverter.ToUInt32(header, 2);
+            int length = (int)BitConverter.ToUInt32(header, 6);
+            var body = ReadExactly(length + 2);
+
+            var crc16Ccitt = new Crc16Ccitt(InitialCrcValue.Zeros);
+            var checkedBytes = header.Skip(1).Concat(body.Take(length)).ToArray();
+            if (crc16Ccitt.ComputeChecksum(checkedBytes) != (body[^2] << 8 | body[^1]))
+            {
+                Log.WriteLine("Trace answer is corrupted");
+                return false;
+            }
+
+            if (length == 0)
+            {
+                Log.WriteLine("The bootloader was built without tracing (YMODEM_TRACE)");
+                return true;
+            }
+
+            File.WriteAllBytes(path, header.Concat(body).ToArray());
+            Log.WriteLine($"Saved {length} bytes of trace to {path}{(dropped > 0 ? $", the start of the session did not fit ({dropped} records dropped)" : "")}");
+        }
+        catch (Exception e)
+        {
+            Log.WriteLine($"Exception: {e.Message}");
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Asks the bootloader for the descriptor of the image in flash and compares it with the image just sent. The
+    /// bootloader computed the CRC32 while the data passed through and reads the image back on its side, so nothing
+    /// has to be transferred back. Also prints how long the previous boot took to start the application, if known.
+    /// </summary>
+    public bool ConfirmImage()
+    {
+        if (imageSent == false)
+        {
+            Log.WriteLine("No image in the batch, nothing to confirm");
+            return true;
+        }
+
+        try
+        {
+            serialPort.DiscardInBuffer();
+            serialPort.Write(new byte[] { I }, 0, 1);
+
+            var answer = ReadExactly(21);
+            if (answer[0] != I || answer[1] != InfoVersion)
+            {
+                Log.WriteLine($"Unexpected image info answer: 0x{answer[0]:X} version {answer[1]}");
+                return false;
+            }
+
+            var crc16Ccitt = new Crc16Ccitt(InitialCrcValue.Zeros);
+            if (crc16Ccitt.ComputeChecksum(answer.Skip(1).Take(18).ToArray()) != (answer[19] << 8 | answer[20]))
+            {
+                Log.WriteLine("Image info answer is corrupted");
+                return false;
+            }
+
+            bool hasDescriptor = (answer[2] & 1) != 0;
+            bool readBack = (answer[2] & 2) != 0;
+            uint size = BitConverter.ToUInt32(answer, 3);
+            uint crc = BitConverter.ToUInt32(answer, 7);
+            uint version = BitConverter.ToUInt32(answer, 11);
+            uint bootMicros = BitConverter.ToUInt32(answer, 15);
+
+            if (bootMicros != 0)
+            {
+                Log.WriteLine($"The previous boot started the application after {bootMicros / 1000.0:0.0} ms");
+            }
+
+            if (hasDescriptor == false)
+            {
+                Log.WriteLine("The bootloader has no valid image descriptor");
+                return false;
+            }
+
+            Log.WriteLine($"Image in flash: {size} bytes, CRC32 {crc:X8}, version {version:X}");
+            if (size != sentImageSize || crc != sentImageCrc || readBack == false)
+            {
+                Log.WriteLine($"Image does NOT match the file ({sentImageSize} bytes, CRC32 {sentImageCrc:X8}{(readBack ? "" : ", flash does not match the descriptor")})");
+                return false;
+            }
+
+            Log.WriteLine("Image confirmed");
+        }
+        catch (Exception e)
+        {
+            Log.WriteLine($"Exception: {e.Message}");
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Reads the bootloader's answer to a packet: one of the expected bytes, NAK or CAN. Anything else is an answer
+    /// garbled on the way and skipped, the bootloader asks with a NAK once it has waited too long for the next packet.
+    /// </summary>
+    private int ReadAnswer(params byte[] expected)
+    {
+        while (true)
+        {
+            var answer = pendingAnswer >= 0 ? pendingAnswer : serialPort.ReadByte();
+            pendingAnswer = -1;
+            if (answer == NAK || answer == CAN || Array.IndexOf(expected, (byte)answer) >= 0)
+            {
+                return answer;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Reads the offset the bootloader has the file continue at, its answer to the resume option or to an EOT: 'R',
+    /// the offset and its CRC16. Returns -1 if the answer is corrupted.
+    /// </summary>
+    private int ReadResumeOffset(Crc16Ccitt crc16Ccitt, int first)
+    {
+        if (first != R)
+        {
+            return -1;
+        }
+
+        var answer = ReadExactly(6);
+        if (crc16Ccitt.ComputeChecksum(answer.Take(4).ToArray()) != (answer[4] << 8 | answer[5]))
+        {
+            return -1;
+        }
+
+        return (int)BitConverter.ToUInt32(answer, 0);
+    }
+
+    private static bool IsErased(byte[] data, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (data[i] != 0xFF)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    private byte[] ReadExactly(int count)
+    {
+        var buffer = new byte[count];
+        for (int read = 0; read < count;)
+        {
+            read += serialPort.Read(buffer, read, count - read);
+        }
+        return buffer;
     }
 
     private void SendClosingPacket(byte SOH, int packetNumber, int invertedPacketNumber, byte[] data, int dataSize, byte[] CRC, int crcSize)